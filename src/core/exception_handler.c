@@ -15,6 +15,9 @@ static struct list live_handlers;
 static struct list free_handlers;
 
 static void exception_handler_install() {
+  /* the handlers are all free again if they were previously installed */
+  list_clear(&free_handlers);
+
   for (int i = 0; i < MAX_EXCEPTION_HANDLERS; i++) {
     struct exception_handler *handler = &handlers[i];
     list_add(&free_handlers, &handler->it);
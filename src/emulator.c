@@ -757,7 +757,9 @@ static void emu_host_resized(void *userdata) {
 }
 
 void emu_run_frame(struct emu *emu) {
-  static const int64_t MACHINE_STEP = HZ_TO_NANO(1000);
+  /* each tick yields at the next vblank, this only bounds how long a tick
+     runs while the video output is disabled */
+  static const int64_t MACHINE_STEP = HZ_TO_NANO(30);
 
   /* run dreamcast up until its next vblank */
   unsigned start_frame = emu->frame;
@@ -93,6 +93,8 @@ struct aica {
   struct aica_channel channels[AICA_NUM_CHANNELS];
   struct common_data *common_data;
   struct timer *sample_timer;
+  /* batches of samples waiting to be generated by the arm7 thread */
+  int pending_batches;
 
   /* raw audio recording */
   FILE *recording;
@@ -306,6 +308,8 @@ static void aica_update_sh(struct aica *aica) {
 static void aica_timer_reschedule(struct aica *aica, int n, uint32_t period);
 
 static void aica_timer_expire(struct aica *aica, int n) {
+  arm7_sync(aica->arm);
+
   /* reschedule timer as soon as it expires */
   aica->timers[n] = NULL;
   aica_timer_reschedule(aica, n, AICA_TIMER_PERIOD);
@@ -407,6 +411,7 @@ static void aica_rtc_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
 
 static void aica_rtc_timer(void *data) {
   struct aica *aica = data;
+  arm7_sync(aica->arm);
   aica->rtc++;
   aica->rtc_timer =
       scheduler_start_timer(aica->scheduler, &aica_rtc_timer, aica, NS_PER_SEC);
@@ -738,6 +743,8 @@ static void aica_common_reg_write(struct aica *aica, uint32_t addr,
 }
 
 uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t data_mask) {
+  arm7_sync(aica->arm);
+
   if (addr < 0x2000) {
     return aica_channel_reg_read(aica, addr, data_mask);
   } else if (addr >= 0x2800 && addr < 0x2d08) {
@@ -750,6 +757,8 @@ uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t data_mask) {
 
 void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
                     uint32_t data_mask) {
+  arm7_sync(aica->arm);
+
   if (addr < 0x2000) {
     aica_channel_reg_write(aica, addr, data, data_mask);
     return;
@@ -764,10 +773,26 @@ void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
   WRITE_DATA(&aica->reg[addr]);
 }
 
+void aica_generate_samples(struct aica *aica) {
+  while (aica->pending_batches) {
+    aica_generate_frames(aica);
+    aica->pending_batches--;
+  }
+}
+
 static void aica_next_sample(void *data) {
   struct aica *aica = data;
 
-  aica_generate_frames(aica);
+  arm7_sync(aica->arm);
+
+  /* while the arm7 is running on its own thread, the samples are generated
+     there at the start of its next slice */
+  aica->pending_batches++;
+
+  if (!arm7_threaded(aica->arm)) {
+    aica_generate_samples(aica);
+  }
+
   aica_raise_interrupt(aica, AICA_INT_SAMPLE);
   aica_update_arm(aica);
   aica_update_sh(aica);
@@ -779,6 +804,8 @@ static void aica_next_sample(void *data) {
 }
 
 static void aica_toggle_recording(struct aica *aica) {
+  arm7_sync(aica->arm);
+
   if (!aica->recording) {
     char filename[PATH_MAX];
     snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "aica.pcm",
@@ -855,6 +882,8 @@ void aica_debug_menu(struct aica *aica) {
 #endif
 
 void aica_destroy(struct aica *aica) {
+  arm7_sync(aica->arm);
+
   /* shutdown rtc */
   {
     if (aica->rtc_timer) {
@@ -895,7 +924,7 @@ AM_BEGIN(struct aica, aica_reg_map);
   AM_RANGE(0x00000000, 0x00010fff) AM_HANDLE("aica reg",
                                              (mmio_read_cb)&aica_reg_read,
                                              (mmio_write_cb)&aica_reg_write,
-                                             NULL, NULL)
+                                             NULL, NULL, NULL)
 AM_END();
 
 AM_BEGIN(struct aica, aica_data_map);
@@ -17,5 +17,6 @@ void aica_destroy(struct aica *aica);
 void aica_debug_menu(struct aica *aica);
 
 void aica_set_clock(struct aica *aica, uint32_t time);
+void aica_generate_samples(struct aica *aica);
 
 #endif
@@ -1,5 +1,7 @@
 #include "guest/arm7/arm7.h"
 #include "core/log.h"
+#include "core/option.h"
+#include "core/thread.h"
 #include "guest/aica/aica.h"
 #include "guest/dreamcast.h"
 #include "guest/scheduler.h"
@@ -16,6 +18,10 @@
 #include "jit/backend/interp/interp_backend.h"
 #endif
 
+DEFINE_OPTION_INT(arm7_thread, 0,
+                  "Run the arm7 and aica sample generation on their own "
+                  "thread");
+
 DEFINE_AGGREGATE_COUNTER(arm7_instrs);
 
 struct arm7 {
@@ -32,8 +38,25 @@ struct arm7 {
 
   /* interrupts */
   uint32_t requested_interrupts;
+
+  /* when running on its own thread, the arm7 trails the rest of the machine
+     by up to a single scheduler slice. the two sides meet at the end of each
+     slice, and whenever either side touches state shared between them (aica
+     registers, interrupts and aica timers) it first waits for the other side
+     to reach the end of its slice */
+  thread_t thread;
+  mutex_t thread_mutex;
+  cond_t thread_cond;
+  int thread_shutdown;
+  /* set while a slice is queued or running on the arm7 thread */
+  int thread_busy;
+  int thread_cycles;
+  /* set while the emulation thread is blocked on the arm7 thread */
+  int main_waiting;
 };
 
+static _Thread_local int arm7_on_thread;
+
 static void arm7_update_pending_interrupts(struct arm7 *arm);
 
 static void arm7_swap_registers(struct arm7 *arm, int old_mode, int new_mode) {
@@ -152,21 +175,115 @@ void arm7_suspend(struct arm7 *arm) {
   arm->execute_if->running = 0;
 }
 
-static void arm7_run(struct device *dev, int64_t ns) {
+static void arm7_run_cycles(struct arm7 *arm, int cycles) {
   PROF_ENTER("cpu", "arm7_run");
 
+  jit_run(arm->jit, cycles);
+
+  prof_counter_add(COUNTER_arm7_instrs, arm->ctx.ran_instrs);
+
+  PROF_LEAVE();
+}
+
+static void arm7_wait_slice(struct arm7 *arm) {
+  mutex_lock(arm->thread_mutex);
+
+  while (arm->thread_busy) {
+    /* let the arm7 thread know it has exclusive access to the machine until
+       its slice is finished */
+    arm->main_waiting = 1;
+    cond_signal(arm->thread_cond);
+    cond_wait(arm->thread_cond, arm->thread_mutex);
+  }
+
+  arm->main_waiting = 0;
+
+  mutex_unlock(arm->thread_mutex);
+}
+
+static void *arm7_thread(void *data) {
+  struct arm7 *arm = data;
+
+  arm7_on_thread = 1;
+
+  mutex_lock(arm->thread_mutex);
+
+  while (1) {
+    while (!arm->thread_busy && !arm->thread_shutdown) {
+      cond_wait(arm->thread_cond, arm->thread_mutex);
+    }
+
+    if (arm->thread_shutdown) {
+      break;
+    }
+
+    int cycles = arm->thread_cycles;
+    mutex_unlock(arm->thread_mutex);
+
+    aica_generate_samples(arm->aica);
+    arm7_run_cycles(arm, cycles);
+
+    mutex_lock(arm->thread_mutex);
+    arm->thread_busy = 0;
+    cond_signal(arm->thread_cond);
+  }
+
+  mutex_unlock(arm->thread_mutex);
+
+  return NULL;
+}
+
+int arm7_threaded(struct arm7 *arm) {
+  return arm->thread && arm->execute_if->running;
+}
+
+void arm7_sync(struct arm7 *arm) {
+  if (!arm->thread) {
+    return;
+  }
+
+  if (!arm7_on_thread) {
+    arm7_wait_slice(arm);
+    return;
+  }
+
+  /* wait for the emulation thread to finish its slice. it stays blocked until
+     the arm7's slice finishes.
+
+     note, the emulation thread only stops in arm7_wait_slice, which it reaches
+     at its own aica accesses or when starting the next arm7 slice. the
+     scheduler yields at each vblank, so once the emulation thread has run to
+     the end of the frame the next slice isn't started until the host calls
+     dc_tick again. an aica access from the arm7 can therefore block it for
+     up to most of a host frame, during which no samples are generated */
+  mutex_lock(arm->thread_mutex);
+
+  while (!arm->main_waiting) {
+    cond_wait(arm->thread_cond, arm->thread_mutex);
+  }
+
+  mutex_unlock(arm->thread_mutex);
+}
+
+static void arm7_run(struct device *dev, int64_t ns) {
   struct arm7 *arm = (struct arm7 *)dev;
-  struct armv3_context *ctx = &arm->ctx;
-  struct jit *jit = arm->jit;
 
   static int64_t ARM7_CLOCK_FREQ = INT64_C(20000000);
   int cycles = (int)NANO_TO_CYCLES(ns, ARM7_CLOCK_FREQ);
 
-  jit_run(arm->jit, cycles);
+  if (!arm->thread) {
+    arm7_run_cycles(arm, cycles);
+    return;
+  }
 
-  prof_counter_add(COUNTER_arm7_instrs, arm->ctx.ran_instrs);
+  /* finish the previous slice before handing off the next one */
+  arm7_wait_slice(arm);
 
-  PROF_LEAVE();
+  mutex_lock(arm->thread_mutex);
+  arm->thread_cycles = cycles;
+  arm->thread_busy = 1;
+  cond_signal(arm->thread_cond);
+  mutex_unlock(arm->thread_mutex);
 }
 
 static int arm7_init(struct device *dev) {
@@ -202,6 +319,7 @@ static int arm7_init(struct device *dev) {
     arm->guest->restore_mode = &arm7_restore_mode;
     arm->guest->software_interrupt = &arm7_software_interrupt;
     arm->guest->lookup = &as_lookup;
+    arm->guest->lookup_storage = &as_lookup_storage;
     arm->guest->r8 = &as_read8;
     arm->guest->r16 = &as_read16;
     arm->guest->r32 = &as_read32;
@@ -215,10 +333,32 @@ static int arm7_init(struct device *dev) {
 
   arm->wave_ram = memory_translate(dc->memory, "aica wave ram", 0x00000000);
 
+  if (OPTION_arm7_thread) {
+    arm->thread_mutex = mutex_create();
+    arm->thread_cond = cond_create();
+    arm->thread = thread_create(&arm7_thread, "arm7", arm);
+    CHECK_NOTNULL(arm->thread);
+  }
+
   return 1;
 }
 
 void arm7_destroy(struct arm7 *arm) {
+  if (arm->thread) {
+    arm7_wait_slice(arm);
+
+    mutex_lock(arm->thread_mutex);
+    arm->thread_shutdown = 1;
+    cond_signal(arm->thread_cond);
+    mutex_unlock(arm->thread_mutex);
+
+    void *result;
+    thread_join(arm->thread, &result);
+
+    cond_destroy(arm->thread_cond);
+    mutex_destroy(arm->thread_mutex);
+  }
+
   jit_destroy(arm->jit);
   armv3_guest_destroy(arm->guest);
   arm->frontend->destroy(arm->frontend);
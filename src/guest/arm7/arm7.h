@@ -21,4 +21,13 @@ void arm7_suspend(struct arm7 *arm);
 void arm7_reset(struct arm7 *arm);
 void arm7_raise_interrupt(struct arm7 *arm, enum arm7_interrupt intr);
 
+/* returns true while the arm7 is running on its own thread */
+int arm7_threaded(struct arm7 *arm);
+
+/* must be called before touching state shared with the arm7 when it's running
+   on its own thread, blocks until the other side has finished its slice. when
+   called from the arm7 thread, this can take up to most of a host frame, see
+   arm7.c */
+void arm7_sync(struct arm7 *arm);
+
 #endif
@@ -17,6 +17,9 @@
 #include "guest/sh4/sh4.h"
 
 void dc_vertical_blank(struct dreamcast *dc) {
+  /* return to the host at the end of each frame */
+  scheduler_yield(dc->scheduler);
+
   if (!dc->vertical_blank) {
     return;
   }
@@ -70,6 +73,24 @@ void dc_suspend(struct dreamcast *dc) {
   dc->running = 0;
 }
 
+static void dc_disc_key(struct disc *disc, char *key, int size) {
+  struct disc_meta meta;
+  disc_get_meta(disc, &meta);
+
+  char id[16];
+  char version[16];
+  strncpy_trim_spaces(id, meta.id, sizeof(meta.id));
+  strncpy_trim_spaces(version, meta.version, sizeof(meta.version));
+  snprintf(key, size, "%s_%s", id, version);
+
+  /* the key is used as a filename */
+  for (char *ptr = key; *ptr; ptr++) {
+    if (!isalnum(*ptr) && *ptr != '.' && *ptr != '-') {
+      *ptr = '_';
+    }
+  }
+}
+
 static int dc_load_disc(struct dreamcast *dc, const char *path) {
   struct disc *disc = disc_create(path);
 
@@ -78,6 +99,12 @@ static int dc_load_disc(struct dreamcast *dc, const char *path) {
   }
 
   gdrom_set_disc(dc->gdrom, disc);
+
+  /* reuse the code compiled for this disc by previous runs */
+  char key[64];
+  dc_disc_key(disc, key, sizeof(key));
+  jit_open_cache(dc->sh4->jit, key);
+
   sh4_reset(dc->sh4, 0xa0000000);
   dc_resume(dc);
 
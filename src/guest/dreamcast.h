@@ -77,6 +77,9 @@ typedef void (*device_run_cb)(struct device *, int64_t);
 struct execute_interface {
   device_run_cb run;
   int running;
+  /* set while the device is waiting on an external event (e.g. an interrupt)
+     and has nothing to run, it's skipped by the scheduler until cleared */
+  int halted;
 };
 
 /* memory interface */
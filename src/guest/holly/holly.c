@@ -302,6 +302,19 @@ static uint32_t holly_reg_read(struct holly *hl, uint32_t addr,
   return data;
 }
 
+static void *holly_reg_storage(struct holly *hl, uint32_t addr, int write) {
+  uint32_t offset = addr >> 2;
+  struct reg_cb *cb = &holly_cb[offset];
+
+  /* registers without a callback are plain storage, unless each access is
+     being logged */
+  if ((write && cb->write) || (!write && cb->read) || hl->log_reg_access) {
+    return NULL;
+  }
+
+  return &hl->reg[offset];
+}
+
 static uint32_t *holly_interrupt_status(struct holly *hl,
                                         enum holly_interrupt_type type) {
   switch (type) {
@@ -352,6 +365,11 @@ void holly_debug_menu(struct holly *hl) {
     if (igBeginMenu("HOLLY", 1)) {
       if (igMenuItem("log reg access", NULL, hl->log_reg_access, 1)) {
         hl->log_reg_access = !hl->log_reg_access;
+
+        /* compiled code may access plain storage registers directly, bypassing
+           the logging. recompile it so it goes through holly_reg_storage
+           again */
+        jit_invalidate_blocks(hl->sh4->jit);
       }
 
       if (igMenuItem("raise all HOLLY_INT_NRM", NULL, 0, 1)) {
@@ -687,7 +705,8 @@ AM_BEGIN(struct holly, holly_reg_map);
   AM_RANGE(0x00000000, 0x00007fff) AM_HANDLE("holly reg",
                                              (mmio_read_cb)&holly_reg_read,
                                              (mmio_write_cb)&holly_reg_write,
-                                             NULL, NULL)
+                                             NULL, NULL,
+                                             (mmio_storage_cb)&holly_reg_storage)
 AM_END();
 
 AM_BEGIN(struct holly, holly_modem_map);
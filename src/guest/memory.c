@@ -65,11 +65,28 @@ struct address_map {
 #define REGION_OFFSET_MASK (page_entry_t)(~REGION_HANDLE_MASK)
 #define MAX_REGIONS (1 << VIRT_PAGE_OFFSET_BITS)
 
+/* granularity mirrors are searched for at when protecting pages */
+#define AS_MIRROR_SHIFT 24
+#define AS_MIRROR_OFFSET_MASK (uint32_t)((1 << AS_MIRROR_SHIFT) - 1)
+#define AS_NUM_MIRRORS (1 << (32 - AS_MIRROR_SHIFT))
+
 typedef uint32_t page_entry_t;
 
+/* the slow-path accessors dispatch through a copy of each region's handlers,
+   indexed by the handle packed into the page entry, rather than looking up
+   the region through the machine and checking its type on each access.
+   physical regions are accessed through the host mapping and have no
+   handlers */
+struct region_dispatch {
+  mmio_read_cb read;
+  mmio_write_cb write;
+  void *data;
+};
+
 struct address_space {
   struct dreamcast *dc;
   page_entry_t pages[NUM_VIRT_PAGES];
+  struct region_dispatch dispatch[MAX_REGIONS];
   uint8_t *base;
 };
 
@@ -101,6 +118,7 @@ struct memory_region {
       mmio_write_cb write;
       mmio_read_string_cb read_string;
       mmio_write_string_cb write_string;
+      mmio_storage_cb storage;
     } mmio;
   };
 };
@@ -283,7 +301,7 @@ struct memory_region *memory_create_physical_region(struct memory *memory,
 struct memory_region *memory_create_mmio_region(
     struct memory *memory, const char *name, uint32_t size, void *data,
     mmio_read_cb read, mmio_write_cb write, mmio_read_string_cb read_string,
-    mmio_write_string_cb write_string) {
+    mmio_write_string_cb write_string, mmio_storage_cb storage) {
   struct memory_region *region = memory_get_region(memory, name);
 
   if (!region) {
@@ -303,6 +321,7 @@ struct memory_region *memory_create_mmio_region(
         read_string ? read_string : &default_mmio_read_string;
     region->mmio.write_string =
         write_string ? write_string : &default_mmio_write_string;
+    region->mmio.storage = storage;
   }
 
   return region;
@@ -376,7 +395,8 @@ struct memory *memory_create(struct dreamcast *dc) {
   memory->shmem = SHMEM_INVALID;
 
   /* create default region for unmapped pages */
-  memory_create_mmio_region(memory, "default", 0, NULL, NULL, NULL, NULL, NULL);
+  memory_create_mmio_region(memory, "default", 0, NULL, NULL, NULL, NULL, NULL,
+                            NULL);
 
   return memory;
 }
@@ -498,19 +518,19 @@ void as_memcpy_to_guest(struct address_space *space, uint32_t dst,
   }
 }
 
-#define define_read_bytes(name, data_type)                                     \
-  data_type as_##name(struct address_space *space, uint32_t addr) {            \
-    page_entry_t page = space->pages[get_page_index(addr)];                    \
-    int region_handle = get_region_handle(page);                               \
-    struct memory_region *region = &space->dc->memory->regions[region_handle]; \
-    if (region->type == REGION_PHYSICAL) {                                     \
-      return *(data_type *)(space->base + addr);                               \
-    }                                                                          \
-    static const uint32_t data_mask = (1ull << (sizeof(data_type) * 8)) - 1;   \
-    uint32_t region_offset = get_region_offset(page);                          \
-    uint32_t page_offset = get_page_offset(addr);                              \
-    return region->mmio.read(region->mmio.data, region_offset + page_offset,   \
-                             data_mask);                                       \
+#define define_read_bytes(name, data_type)                                   \
+  data_type as_##name(struct address_space *space, uint32_t addr) {          \
+    page_entry_t page = space->pages[get_page_index(addr)];                  \
+    const struct region_dispatch *region =                                   \
+        &space->dispatch[get_region_handle(page)];                           \
+    if (!region->read) {                                                     \
+      return *(data_type *)(space->base + addr);                             \
+    }                                                                        \
+    static const uint32_t data_mask = (1ull << (sizeof(data_type) * 8)) - 1; \
+    uint32_t region_offset = get_region_offset(page);                        \
+    uint32_t page_offset = get_page_offset(addr);                            \
+    return region->read(region->data, region_offset + page_offset,           \
+                        data_mask);                                          \
   }
 
 define_read_bytes(read8, uint8_t);
@@ -520,17 +540,16 @@ define_read_bytes(read32, uint32_t);
 #define define_write_bytes(name, data_type)                                    \
   void as_##name(struct address_space *space, uint32_t addr, data_type data) { \
     page_entry_t page = space->pages[get_page_index(addr)];                    \
-    int region_handle = get_region_handle(page);                               \
-    struct memory_region *region = &space->dc->memory->regions[region_handle]; \
-    if (region->type == REGION_PHYSICAL) {                                     \
+    const struct region_dispatch *region =                                     \
+        &space->dispatch[get_region_handle(page)];                             \
+    if (!region->write) {                                                      \
       *(data_type *)(space->base + addr) = data;                               \
       return;                                                                  \
     }                                                                          \
     static const uint32_t data_mask = (1ull << (sizeof(data_type) * 8)) - 1;   \
     uint32_t region_offset = get_region_offset(page);                          \
     uint32_t page_offset = get_page_offset(addr);                              \
-    region->mmio.write(region->mmio.data, region_offset + page_offset, data,   \
-                       data_mask);                                             \
+    region->write(region->data, region_offset + page_offset, data, data_mask); \
   }
 
 define_write_bytes(write8, uint8_t);
@@ -541,45 +560,82 @@ uint8_t *as_translate(struct address_space *space, uint32_t addr) {
   return space->base + addr;
 }
 
+void as_protect(struct address_space *space, uint32_t addr, uint32_t size,
+                enum page_access access) {
+  CHECK(is_page_aligned(addr, size));
+
+  /* each mirror of a physical page is a separate host mapping, so every one of
+     them needs to be protected. note, mirrors in the dreamcast's address maps
+     are all 16mb aligned, so only those virtual pages are checked */
+  for (uint32_t offset = 0; offset < size; offset += VIRT_PAGE_SIZE) {
+    uint32_t page_addr = addr + offset;
+    page_entry_t page = space->pages[get_page_index(page_addr)];
+    int region_handle = get_region_handle(page);
+    struct memory_region *region = &space->dc->memory->regions[region_handle];
+    CHECK_EQ(region->type, REGION_PHYSICAL);
+
+    for (uint32_t i = 0; i < AS_NUM_MIRRORS; i++) {
+      uint32_t mirror_addr =
+          (page_addr & AS_MIRROR_OFFSET_MASK) | (i << AS_MIRROR_SHIFT);
+
+      if (space->pages[get_page_index(mirror_addr)] != page) {
+        continue;
+      }
+
+      CHECK(protect_pages(space->base + mirror_addr, VIRT_PAGE_SIZE, access));
+    }
+  }
+}
+
 void as_lookup(struct address_space *space, uint32_t addr, void **ptr,
                void **userdata, mmio_read_cb *read, mmio_write_cb *write,
                uint32_t *offset) {
+  page_entry_t page = space->pages[get_page_index(addr)];
+  const struct region_dispatch *region =
+      &space->dispatch[get_region_handle(page)];
+  int physical = !region->read;
+
+  if (ptr) {
+    *ptr = physical ? space->base + addr : NULL;
+  }
+  if (userdata) {
+    *userdata = region->data;
+  }
+  if (read) {
+    *read = region->read;
+  }
+  if (write) {
+    *write = region->write;
+  }
+  if (offset) {
+    *offset =
+        physical ? 0 : get_region_offset(page) + get_page_offset(addr);
+  }
+}
+
+void *as_lookup_storage(struct address_space *space, uint32_t addr,
+                        int write) {
   struct memory_region *region;
-  uint32_t mmio_offset;
-  as_lookup_region(space, addr, &region, &mmio_offset);
+  uint32_t offset;
+  as_lookup_region(space, addr, &region, &offset);
+
+  if (region->type != REGION_MMIO || !region->mmio.storage) {
+    return NULL;
+  }
+
+  return region->mmio.storage(region->mmio.data, offset, write);
+}
+
+static void as_set_dispatch(struct address_space *space,
+                            const struct memory_region *region) {
+  struct region_dispatch *dispatch = &space->dispatch[region->handle];
 
   if (region->type == REGION_PHYSICAL) {
-    if (ptr) {
-      *ptr = space->base + addr;
-    }
-    if (userdata) {
-      *userdata = NULL;
-    }
-    if (read) {
-      *read = NULL;
-    }
-    if (write) {
-      *write = NULL;
-    }
-    if (offset) {
-      *offset = 0;
-    }
+    memset(dispatch, 0, sizeof(*dispatch));
   } else {
-    if (ptr) {
-      *ptr = NULL;
-    }
-    if (userdata) {
-      *userdata = region->mmio.data;
-    }
-    if (read) {
-      *read = region->mmio.read;
-    }
-    if (write) {
-      *write = region->mmio.write;
-    }
-    if (offset) {
-      *offset = mmio_offset;
-    }
+    dispatch->read = region->mmio.read;
+    dispatch->write = region->mmio.write;
+    dispatch->data = region->mmio.data;
   }
 }
 
@@ -607,6 +663,8 @@ static void as_merge_map(struct address_space *space,
         case MAP_ENTRY_PHYSICAL: {
           struct memory_region *region = entry->physical.region;
 
+          as_set_dispatch(space, region);
+
           for (int i = 0; i < num_pages; i++) {
             uint32_t region_offset = get_total_page_size(i);
 
@@ -618,6 +676,8 @@ static void as_merge_map(struct address_space *space,
         case MAP_ENTRY_MMIO: {
           struct memory_region *region = entry->mmio.region;
 
+          as_set_dispatch(space, region);
+
           for (int i = 0; i < num_pages; i++) {
             uint32_t region_offset = get_total_page_size(i);
 
@@ -708,6 +768,9 @@ int as_map(struct address_space *space, const char *name,
            const struct address_map *map) {
   as_unmap(space);
 
+  /* pages not covered by the map dispatch to the default region's handlers */
+  as_set_dispatch(space, &space->dc->memory->regions[0]);
+
   /* flatten the supplied address map out into a virtual page table */
   as_merge_map(space, map, 0);
 
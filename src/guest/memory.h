@@ -42,11 +42,11 @@ struct memory;
         memory_create_physical_region(machine->memory, name, size); \
     am_physical(map, region, size, begin, mask);                    \
   }
-#define AM_HANDLE(name, read, write, read_string, write_string)            \
+#define AM_HANDLE(name, read, write, read_string, write_string, storage)   \
   {                                                                        \
-    struct memory_region *region =                                         \
-        memory_create_mmio_region(machine->memory, name, size, self, read, \
-                                  write, read_string, write_string);       \
+    struct memory_region *region = memory_create_mmio_region(              \
+        machine->memory, name, size, self, read, write, read_string,       \
+        write_string, storage);                                            \
     am_mmio(map, region, size, begin, mask);                               \
   }
 
@@ -64,6 +64,11 @@ typedef uint32_t (*mmio_read_cb)(void *, uint32_t, uint32_t);
 typedef void (*mmio_write_cb)(void *, uint32_t, uint32_t, uint32_t);
 typedef void (*mmio_read_string_cb)(void *, void *, uint32_t, int);
 typedef void (*mmio_write_string_cb)(void *, uint32_t, const void *, int);
+/* returns the host memory backing the 32-bit register at the supplied offset
+   if reading (or writing) it has no side effects, letting compiled code
+   access it directly. returns NULL if the access must go through the read /
+   write callbacks */
+typedef void *(*mmio_storage_cb)(void *, uint32_t, int);
 
 struct memory *memory_create(struct dreamcast *dc);
 void memory_destroy(struct memory *memory);
@@ -78,7 +83,7 @@ struct memory_region *memory_create_physical_region(struct memory *memory,
 struct memory_region *memory_create_mmio_region(
     struct memory *memory, const char *name, uint32_t size, void *data,
     mmio_read_cb read, mmio_write_cb write, mmio_read_string_cb read_string,
-    mmio_write_string_cb write_string);
+    mmio_write_string_cb write_string, mmio_storage_cb storage);
 
 /* address map */
 typedef void (*address_map_cb)(void *, struct dreamcast *,
@@ -105,6 +110,9 @@ void as_lookup(struct address_space *space, uint32_t addr, void **ptr,
                void **userdata, mmio_read_cb *read, mmio_write_cb *write,
                uint32_t *offset);
 uint8_t *as_translate(struct address_space *space, uint32_t addr);
+void *as_lookup_storage(struct address_space *space, uint32_t addr, int write);
+void as_protect(struct address_space *space, uint32_t addr, uint32_t size,
+                enum page_access access);
 
 uint8_t as_read8(struct address_space *space, uint32_t addr);
 uint16_t as_read16(struct address_space *space, uint32_t addr);
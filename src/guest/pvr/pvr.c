@@ -120,6 +120,18 @@ static void pvr_reg_write(struct pvr *pvr, uint32_t addr, uint32_t data,
   pvr->reg[offset] = data;
 }
 
+static void *pvr_reg_storage(struct pvr *pvr, uint32_t addr, int write) {
+  uint32_t offset = addr >> 2;
+  struct reg_cb *cb = &pvr_cb[offset];
+
+  /* registers without a callback are plain storage */
+  if ((write && (cb->write || offset == ID)) || (!write && cb->read)) {
+    return NULL;
+  }
+
+  return &pvr->reg[offset];
+}
+
 static uint32_t pvr_palette_read(struct pvr *pvr, uint32_t addr,
                                  uint32_t data_mask) {
   return READ_DATA(&pvr->palette_ram[addr]);
@@ -258,11 +270,12 @@ AM_BEGIN(struct pvr, pvr_reg_map);
   AM_RANGE(0x00000000, 0x00000fff) AM_HANDLE("pvr reg",
                                              (mmio_read_cb)&pvr_reg_read,
                                              (mmio_write_cb)&pvr_reg_write,
-                                             NULL, NULL)
+                                             NULL, NULL,
+                                             (mmio_storage_cb)&pvr_reg_storage)
   AM_RANGE(0x00001000, 0x00001fff) AM_HANDLE("pvr palette",
                                              (mmio_read_cb)&pvr_palette_read,
                                              (mmio_write_cb)&pvr_palette_write,
-                                             NULL, NULL)
+                                             NULL, NULL, NULL)
 AM_END();
 
 AM_BEGIN(struct pvr, pvr_vram_map);
@@ -271,11 +284,13 @@ AM_BEGIN(struct pvr, pvr_vram_map);
                                              (mmio_read_cb)&pvr_vram_read,
                                              (mmio_write_cb)&pvr_vram_write,
                                              NULL,
+                                             NULL,
                                              NULL)
   AM_RANGE(0x01000000, 0x017fffff) AM_HANDLE("video ram interleaved",
                                              (mmio_read_cb)&pvr_vram_interleaved_read,
                                              (mmio_write_cb)&pvr_vram_interleaved_write,
                                              (mmio_read_string_cb)&pvr_vram_interleaved_read_string,
-                                             (mmio_write_string_cb)&pvr_vram_interleaved_write_string)
+                                             (mmio_write_string_cb)&pvr_vram_interleaved_write_string,
+                                             NULL)
 AM_END();
 /* clang-format on */
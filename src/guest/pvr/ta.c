@@ -750,12 +750,15 @@ REG_W32(pvr_cb, TA_YUV_TEX_BASE) {
 AM_BEGIN(struct ta, ta_fifo_map);
   AM_RANGE(0x00000000, 0x007fffff) AM_HANDLE("ta poly fifo",
                                              NULL, NULL, NULL,
-                                             (mmio_write_string_cb)&ta_poly_fifo_write)
+                                             (mmio_write_string_cb)&ta_poly_fifo_write,
+                                             NULL)
   AM_RANGE(0x00800000, 0x00ffffff) AM_HANDLE("ta yuv fifo",
                                              NULL, NULL, NULL,
-                                             (mmio_write_string_cb)&ta_yuv_fifo_write)
+                                             (mmio_write_string_cb)&ta_yuv_fifo_write,
+                                             NULL)
   AM_RANGE(0x01000000, 0x01ffffff) AM_HANDLE("ta texture fifo",
                                             NULL, NULL, NULL,
-                                            (mmio_write_string_cb)&ta_texture_fifo_write)
+                                            (mmio_write_string_cb)&ta_texture_fifo_write,
+                                            NULL)
 AM_END();
 /* clang-format on */
@@ -120,6 +120,6 @@ AM_BEGIN(struct boot, boot_rom_map);
   AM_RANGE(0x00000000, 0x001fffff) AM_HANDLE("boot rom",
                                              (mmio_read_cb)&boot_rom_read,
                                              NULL,
-                                             NULL, NULL)
+                                             NULL, NULL, NULL)
 AM_END();
 /* clang-format on */
@@ -5,31 +5,156 @@
 #include "core/list.h"
 #include "guest/dreamcast.h"
 
-#define MAX_TIMERS 128
+/* timers are allocated in blocks which aren't freed until the scheduler is
+   destroyed, keeping the pointers handed out to devices valid as the pool
+   grows */
+#define TIMER_BLOCK_SIZE 64
 
 struct timer {
   int active;
   int64_t expire;
+  /* order the timer was started in, used to expire timers sharing the same
+     expiration in the order they were started */
+  uint64_t seq;
+  /* position in the scheduler's heap while active */
+  int index;
   timer_cb cb;
   void *data;
   struct list_node it;
 };
 
+struct timer_block {
+  struct timer timers[TIMER_BLOCK_SIZE];
+  struct list_node it;
+};
+
 struct scheduler {
   struct dreamcast *dc;
-  struct timer timers[MAX_TIMERS];
+
+  /* timer pool */
+  struct list timer_blocks;
   struct list free_timers;
-  struct list live_timers;
+
+  /* active timers, stored as a binary min-heap ordered by expiration */
+  struct timer **heap;
+  int num_timers;
+  int max_timers;
+
+  uint64_t next_seq;
   int64_t base_time;
+
+  /* end the current tick once the expired timers have run */
+  int yield;
 };
 
+static inline int scheduler_timer_before(const struct timer *a,
+                                         const struct timer *b) {
+  if (a->expire != b->expire) {
+    return a->expire < b->expire;
+  }
+  return a->seq < b->seq;
+}
+
+static inline void scheduler_heap_set(struct scheduler *sch, int index,
+                                      struct timer *timer) {
+  sch->heap[index] = timer;
+  timer->index = index;
+}
+
+static void scheduler_heap_up(struct scheduler *sch, int index) {
+  struct timer *timer = sch->heap[index];
+
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+
+    if (!scheduler_timer_before(timer, sch->heap[parent])) {
+      break;
+    }
+
+    scheduler_heap_set(sch, index, sch->heap[parent]);
+    index = parent;
+  }
+
+  scheduler_heap_set(sch, index, timer);
+}
+
+static void scheduler_heap_down(struct scheduler *sch, int index) {
+  struct timer *timer = sch->heap[index];
+
+  while (1) {
+    int child = index * 2 + 1;
+
+    if (child >= sch->num_timers) {
+      break;
+    }
+
+    if (child + 1 < sch->num_timers &&
+        scheduler_timer_before(sch->heap[child + 1], sch->heap[child])) {
+      child++;
+    }
+
+    if (!scheduler_timer_before(sch->heap[child], timer)) {
+      break;
+    }
+
+    scheduler_heap_set(sch, index, sch->heap[child]);
+    index = child;
+  }
+
+  scheduler_heap_set(sch, index, timer);
+}
+
+static void scheduler_heap_insert(struct scheduler *sch, struct timer *timer) {
+  if (sch->num_timers == sch->max_timers) {
+    sch->max_timers *= 2;
+    sch->heap = realloc(sch->heap, sch->max_timers * sizeof(struct timer *));
+  }
+
+  int index = sch->num_timers++;
+  scheduler_heap_set(sch, index, timer);
+  scheduler_heap_up(sch, index);
+}
+
+static void scheduler_heap_remove(struct scheduler *sch, struct timer *timer) {
+  int index = timer->index;
+  struct timer *last = sch->heap[--sch->num_timers];
+
+  if (last == timer) {
+    return;
+  }
+
+  /* move the last timer into the hole and restore the heap property in
+     whichever direction it's now violated */
+  scheduler_heap_set(sch, index, last);
+
+  if (index > 0 && scheduler_timer_before(last, sch->heap[(index - 1) / 2])) {
+    scheduler_heap_up(sch, index);
+  } else {
+    scheduler_heap_down(sch, index);
+  }
+}
+
+static struct timer *scheduler_next_timer(struct scheduler *sch) {
+  return sch->num_timers ? sch->heap[0] : NULL;
+}
+
+static void scheduler_alloc_timers(struct scheduler *sch) {
+  struct timer_block *block = calloc(1, sizeof(struct timer_block));
+  list_add(&sch->timer_blocks, &block->it);
+
+  for (int i = 0; i < TIMER_BLOCK_SIZE; i++) {
+    struct timer *timer = &block->timers[i];
+    list_add(&sch->free_timers, &timer->it);
+  }
+}
+
 void scheduler_cancel_timer(struct scheduler *sch, struct timer *timer) {
   if (!timer->active) {
     return;
   }
 
   timer->active = 0;
-  list_remove(&sch->live_timers, &timer->it);
+  scheduler_heap_remove(sch, timer);
   list_add(&sch->free_timers, &timer->it);
 }
 
@@ -39,42 +164,41 @@ int64_t scheduler_remaining_time(struct scheduler *sch, struct timer *timer) {
 
 struct timer *scheduler_start_timer(struct scheduler *sch, timer_cb cb,
                                     void *data, int64_t ns) {
+  if (list_empty(&sch->free_timers)) {
+    scheduler_alloc_timers(sch);
+  }
+
   struct timer *timer = list_first_entry(&sch->free_timers, struct timer, it);
   CHECK_NOTNULL(timer);
   timer->active = 1;
   timer->expire = sch->base_time + ns;
+  timer->seq = sch->next_seq++;
   timer->cb = cb;
   timer->data = data;
 
   /* remove from free list */
   list_remove(&sch->free_timers, &timer->it);
 
-  /* add to sorted live list */
-  struct list_node *after = NULL;
-
-  list_for_each(&sch->live_timers, it) {
-    struct timer *entry = list_entry(it, struct timer, it);
-
-    if (entry->expire > timer->expire) {
-      break;
-    }
-
-    after = it;
-  }
-
-  list_add_after(&sch->live_timers, after, &timer->it);
+  /* add to heap of live timers */
+  scheduler_heap_insert(sch, timer);
 
   return timer;
 }
 
+void scheduler_yield(struct scheduler *sch) {
+  sch->yield = 1;
+}
+
 void scheduler_tick(struct scheduler *sch, int64_t ns) {
   int64_t target_time = sch->base_time + ns;
 
-  while (sch->dc->running && sch->base_time < target_time) {
-    /* run devices up to the next timer */
+  sch->yield = 0;
+
+  while (sch->dc->running && !sch->yield && sch->base_time < target_time) {
+    /* run devices up to the next timer, each device is handed the entire
+       distance to it as a single slice */
     int64_t next_time = target_time;
-    struct timer *next_timer =
-        list_first_entry(&sch->live_timers, struct timer, it);
+    struct timer *next_timer = scheduler_next_timer(sch);
 
     if (next_timer && next_timer->expire < next_time) {
       next_time = next_timer->expire;
@@ -87,15 +211,16 @@ void scheduler_tick(struct scheduler *sch, int64_t ns) {
 
     /* execute each device */
     list_for_each_entry(dev, &sch->dc->devices, struct device, it) {
-      if (dev->execute_if && dev->execute_if->running) {
-        dev->execute_if->run(dev, slice);
+      struct execute_interface *execute_if = dev->execute_if;
+
+      if (execute_if && execute_if->running && !execute_if->halted) {
+        execute_if->run(dev, slice);
       }
     }
 
     /* execute expired timers */
     while (1) {
-      struct timer *timer =
-          list_first_entry(&sch->live_timers, struct timer, it);
+      struct timer *timer = scheduler_next_timer(sch);
 
       if (!timer || timer->expire > sch->base_time) {
         break;
@@ -110,6 +235,11 @@ void scheduler_tick(struct scheduler *sch, int64_t ns) {
 }
 
 void scheduler_destroy(struct scheduler *sch) {
+  list_for_each_entry_safe(block, &sch->timer_blocks, struct timer_block, it) {
+    free(block);
+  }
+
+  free(sch->heap);
   free(sch);
 }
 
@@ -118,12 +248,10 @@ struct scheduler *scheduler_create(struct dreamcast *dc) {
 
   sch->dc = dc;
 
-  /* add all timers to the free list initially */
-  for (int i = 0; i < MAX_TIMERS; i++) {
-    struct timer *timer = &sch->timers[i];
+  sch->max_timers = TIMER_BLOCK_SIZE;
+  sch->heap = malloc(sch->max_timers * sizeof(struct timer *));
 
-    list_add(&sch->free_timers, &timer->it);
-  }
+  scheduler_alloc_timers(sch);
 
   return sch;
 }
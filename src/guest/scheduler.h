@@ -19,6 +19,7 @@ struct scheduler *scheduler_create(struct dreamcast *dc);
 void scheduler_destroy(struct scheduler *sch);
 
 void scheduler_tick(struct scheduler *sch, int64_t ns);
+void scheduler_yield(struct scheduler *sch);
 
 struct timer *scheduler_start_timer(struct scheduler *sch, timer_cb cb,
                                     void *data, int64_t ns);
@@ -1,5 +1,6 @@
 #include "guest/sh4/sh4.h"
 #include "core/math.h"
+#include "core/option.h"
 #include "core/string.h"
 #include "core/time.h"
 #include "guest/aica/aica.h"
@@ -12,6 +13,8 @@
 #include "guest/rom/boot.h"
 #include "guest/rom/flash.h"
 #include "guest/scheduler.h"
+#include "jit/backend/interp/interp_backend.h"
+#include "jit/backend/ir_interp/ir_interp_backend.h"
 #include "jit/frontend/sh4/sh4_fallback.h"
 #include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/frontend/sh4/sh4_guest.h"
@@ -20,10 +23,12 @@
 
 #if ARCH_X64
 #include "jit/backend/x64/x64_backend.h"
-#else
-#include "jit/backend/interp/interp_backend.h"
 #endif
 
+DEFINE_OPTION_INT(sh4_interp, 0,
+                  "Interpret sh4 code rather than compiling it. 1 interprets "
+                  "each instruction, 2 interprets the optimized ir");
+
 DEFINE_AGGREGATE_COUNTER(sh4_instrs);
 DEFINE_AGGREGATE_COUNTER(sh4_sr_updates);
 
@@ -92,6 +97,18 @@ static void sh4_reg_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
   sh4->reg[offset] = data;
 }
 
+static void *sh4_reg_storage(struct sh4 *sh4, uint32_t addr, int write) {
+  uint32_t offset = SH4_REG_OFFSET(addr);
+  struct reg_cb *cb = &sh4_cb[offset];
+
+  /* registers without a callback are plain storage */
+  if ((write && cb->write) || (!write && cb->read)) {
+    return NULL;
+  }
+
+  return &sh4->reg[offset];
+}
+
 static void sh4_sleep(void *data) {
   struct sh4 *sh4 = data;
 
@@ -99,8 +116,17 @@ static void sh4_sleep(void *data) {
   CHECK_EQ(sh4->STBCR->STBY, 0);
   CHECK_EQ(sh4->STBCR2->DSLP, 0);
 
-  /* do nothing but spin on the current pc until an interrupt is raised */
+  /* do nothing but spin on the current pc until an interrupt is raised. as
+     nothing can raise one until another device runs, exhaust the remaining
+     cycles to yield up to the next scheduled event */
   sh4->ctx.sleep_mode = 1;
+  sh4->ctx.run_cycles = -1;
+
+  /* don't bother running again until an interrupt wakes the cpu back up. the
+     pending interrupts are updated now that the block bit is being ignored,
+     which wakes it right back up if one is already waiting */
+  sh4->execute_if->halted = 1;
+  sh4_intc_update_pending(sh4);
 }
 
 static void sh4_invalid_instr(void *data) {
@@ -117,6 +143,22 @@ static void sh4_invalid_instr(void *data) {
   LOG_FATAL("Unhandled invalid instruction at 0x%08x", sh4->ctx.pc);
 }
 
+static int sh4_protect_code(void *data, uint32_t addr, uint32_t size,
+                            int protect) {
+  struct sh4 *sh4 = data;
+
+  /* only code in system ram is protected, code in other areas (e.g. the boot
+     rom) is left for icache resets to invalidate */
+  if ((addr & 0x1c000000) != 0x0c000000) {
+    return 0;
+  }
+
+  as_protect(sh4->memory_if->space, addr, size,
+             protect ? ACC_READONLY : ACC_READWRITE);
+
+  return 1;
+}
+
 static void sh4_run(struct device *dev, int64_t ns) {
   PROF_ENTER("cpu", "sh4_run");
 
@@ -143,11 +185,22 @@ static int sh4_init(struct device *dev) {
 
 #if ARCH_X64
   DEFINE_JIT_CODE_BUFFER(sh4_code);
-  sh4->backend = x64_backend_create(sh4_code, sizeof(sh4_code));
-#else
-  sh4->backend = interp_backend_create();
+  if (!OPTION_sh4_interp) {
+    sh4->backend = x64_backend_create(sh4_code, sizeof(sh4_code));
+  }
 #endif
 
+  /* hosts without a native backend fall back to the interpreter. the
+     optimized ir is only interpreted on request, as it's slower on the
+     fixed-point loops benchmarked so far */
+  if (!sh4->backend) {
+    if (OPTION_sh4_interp == 2) {
+      sh4->backend = ir_interp_backend_create();
+    } else {
+      sh4->backend = interp_backend_create();
+    }
+  }
+
   {
     sh4->guest = sh4_guest_create();
 
@@ -170,12 +223,14 @@ static int sh4_init(struct device *dev) {
     sh4->guest->sr_updated = &sh4_sr_updated;
     sh4->guest->fpscr_updated = &sh4_fpscr_updated;
     sh4->guest->lookup = &as_lookup;
+    sh4->guest->lookup_storage = &as_lookup_storage;
     sh4->guest->r8 = &as_read8;
     sh4->guest->r16 = &as_read16;
     sh4->guest->r32 = &as_read32;
     sh4->guest->w8 = &as_write8;
     sh4->guest->w16 = &as_write16;
     sh4->guest->w32 = &as_write32;
+    sh4->guest->protect_code = &sh4_protect_code;
   }
 
   sh4->jit = jit_create("sh4", sh4->frontend, sh4->backend,
@@ -216,6 +271,7 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc) {
   sh4_intc_reprioritize(sh4);
 
   sh4->execute_if->running = 1;
+  sh4->execute_if->halted = 0;
 }
 
 #if ENABLE_IMGUI
@@ -239,6 +295,39 @@ void sh4_debug_menu(struct sh4 *sh4) {
         }
       }
 
+      /* blocks need to be recompiled to start / stop counting their runs */
+      if (!jit->profile_blocks) {
+        if (igMenuItem("start profiling blocks", NULL, 0, 1)) {
+          jit->profile_blocks = 1;
+          jit_invalidate_blocks(jit);
+        }
+      } else {
+        if (igMenuItem("stop profiling blocks", NULL, 1, 1)) {
+          jit->profile_blocks = 0;
+          jit_invalidate_blocks(jit);
+        }
+      }
+
+      if (igBeginMenu("hot blocks", 1)) {
+        struct jit_block *blocks[16];
+        int n = jit_get_hot_blocks(jit, blocks, array_size(blocks));
+
+        for (int i = 0; i < n; i++) {
+          struct jit_block *block = blocks[i];
+          char label[128];
+          snprintf(label, sizeof(label), "0x%08x %d runs, %d instrs, tier %d",
+                   block->guest_addr, block->num_runs, block->num_instrs,
+                   block->tier);
+          igMenuItem(label, NULL, 0, 0);
+        }
+
+        if (igMenuItem("dump hot blocks", NULL, 0, 1)) {
+          jit_dump_hot_blocks(jit);
+        }
+
+        igEndMenu();
+      }
+
       igEndMenu();
     }
 
@@ -342,7 +431,8 @@ AM_BEGIN(struct sh4, sh4_data_map)
   AM_RANGE(0x1c000000, 0x1fffffff) AM_HANDLE("sh4 reg",
                                              (mmio_read_cb)&sh4_reg_read,
                                              (mmio_write_cb)&sh4_reg_write,
-                                             NULL, NULL)
+                                             NULL, NULL,
+                                             (mmio_storage_cb)&sh4_reg_storage)
 
   /* physical mirrors */
   AM_RANGE(0x20000000, 0x3fffffff) AM_MIRROR(0x00000000)  /* p0 */
@@ -357,10 +447,10 @@ AM_BEGIN(struct sh4, sh4_data_map)
   AM_RANGE(0x7c000000, 0x7fffffff) AM_HANDLE("sh4 cache",
                                              (mmio_read_cb)&sh4_ccn_cache_read,
                                              (mmio_write_cb)&sh4_ccn_cache_write,
-                                             NULL, NULL)
+                                             NULL, NULL, NULL)
   AM_RANGE(0xe0000000, 0xe3ffffff) AM_HANDLE("sh4 sq",
                                              (mmio_read_cb)&sh4_ccn_sq_read,
                                              (mmio_write_cb)&sh4_ccn_sq_write,
-                                             NULL, NULL)
+                                             NULL, NULL, NULL)
 AM_END();
 /* clang-format on */
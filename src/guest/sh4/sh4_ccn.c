@@ -19,7 +19,9 @@ static void sh4_ccn_reset(struct sh4 *sh4) {
      end the block */
   LOG_INFO("sh4_ccn_reset");
 
-  jit_invalidate_blocks(sh4->jit);
+  /* writes to code in system ram have already invalidated the blocks compiled
+     from it, only blocks whose code couldn't be protected need to go */
+  jit_invalidate_unprotected_blocks(sh4->jit);
 }
 
 void sh4_ccn_sq_prefetch(void *data, uint32_t addr) {
@@ -27,6 +27,11 @@ void sh4_intc_update_pending(struct sh4 *sh4) {
   }
 
   sh4->ctx.pending_interrupts = sh4->requested_interrupts & mask;
+
+  /* wake the cpu from sleep, the interrupt is serviced once it runs again */
+  if (sh4->ctx.sleep_mode && sh4->ctx.pending_interrupts) {
+    sh4->execute_if->halted = 0;
+  }
 }
 
 void sh4_intc_check_pending(void *data) {
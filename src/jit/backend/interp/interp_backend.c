@@ -1,12 +1,46 @@
 #include <stdlib.h>
+#include "jit/backend/interp/interp_backend.h"
+#include "core/math.h"
 #include "jit/backend/jit_backend.h"
 #include "jit/frontend/jit_frontend.h"
 #include "jit/jit.h"
 
+/* blocks are decoded into a fixed size buffer, which is split into regions
+   that are evicted one at a time once it fills up, the same as a native code
+   buffer */
+#define INTERP_CODE_SIZE 0x800000
+#define INTERP_REGION_SIZE 0x80000
+
+/* the decoded form of a block, cached for its guest address in place of native
+   code */
+struct interp_code {
+  struct jit_block *block;
+  uint32_t guest_addr;
+  int num_instrs;
+  struct jit_instr instrs[];
+};
+
 struct interp_backend {
   struct jit_backend;
+
+  /* decoded blocks directly mapped by guest address */
+  struct interp_code **cache;
+  int cache_shift;
+
+  uint8_t *code;
+  int code_size;
+  int num_regions;
+  int region;
+  int offset;
+  int limit;
 };
 
+static inline struct interp_code **interp_backend_cache_entry(
+    struct interp_backend *backend, uint32_t addr) {
+  uint32_t addr_mask = backend->jit->guest->addr_mask;
+  return &backend->cache[(addr & addr_mask) >> backend->cache_shift];
+}
+
 static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   struct interp_backend *backend = (struct interp_backend *)base;
   struct jit *jit = backend->jit;
@@ -15,32 +49,69 @@ static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   uint32_t *pc = (uint32_t *)(ctx + guest->offset_pc);
   int32_t *run_cycles = (int32_t *)(ctx + guest->offset_cycles);
   int32_t *ran_instrs = (int32_t *)(ctx + guest->offset_instrs);
+  uint64_t *pending_interrupts =
+      (uint64_t *)(ctx + guest->offset_interrupts);
 
   *run_cycles = cycles;
   *ran_instrs = 0;
 
   while (*run_cycles > 0) {
-    int RUN_SLICE = MIN(*run_cycles, 64);
+    if (*pending_interrupts) {
+      guest->interrupt_check(guest->data);
+    }
+
+    uint32_t addr = *pc;
+    struct interp_code *code = *interp_backend_cache_entry(backend, addr);
+
+    /* multiple guest addresses map to the same entry, make sure the decoded
+       block is for this one */
+    if (!code || code->guest_addr != addr) {
+      jit_compile_block(jit, addr);
+      continue;
+    }
+
+    struct jit_block *block = code->block;
+    if (block->profile) {
+      block->num_runs++;
+    }
+
+    /* each fallback updates the pc as it goes, keep calling them until a
+       branch leaves the block */
+    struct jit_instr *instr = code->instrs;
+    struct jit_instr *end = instr + code->num_instrs;
     int cycles = 0;
     int instrs = 0;
 
     do {
-      uint32_t addr = *pc;
-      uint32_t data = guest->r32(guest->space, addr);
-      const struct jit_opdef *def =
-          jit->frontend->lookup_op(jit->frontend, &data);
-      def->fallback(guest, addr, data);
-      cycles += def->cycles;
-      instrs += 1;
-    } while (cycles < RUN_SLICE);
+      instr->fallback(guest, instr->addr, instr->data);
+      cycles += instr->cycles;
+      instrs++;
+      instr++;
+    } while (instr != end && *pc == instr->addr);
 
     *run_cycles -= cycles;
     *ran_instrs += instrs;
-
-    guest->interrupt_check(guest->data);
   }
 }
 
+static void *interp_backend_lookup_code(struct jit_backend *base,
+                                        uint32_t addr) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  return *interp_backend_cache_entry(backend, addr);
+}
+
+static void interp_backend_cache_code(struct jit_backend *base, uint32_t addr,
+                                      void *code) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  *interp_backend_cache_entry(backend, addr) = code;
+}
+
+static void interp_backend_invalidate_code(struct jit_backend *base,
+                                           uint32_t addr) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  *interp_backend_cache_entry(backend, addr) = NULL;
+}
+
 static int interp_backend_handle_exception(struct jit_backend *base,
                                            struct exception_state *ex) {
   return 0;
@@ -49,16 +120,94 @@ static int interp_backend_handle_exception(struct jit_backend *base,
 static void interp_backend_dump_code(struct jit_backend *base,
                                      const struct jit_block *block) {}
 
-static void interp_backend_reset(struct jit_backend *base) {}
+static void interp_backend_region_range(struct interp_backend *backend,
+                                        int region, int *begin, int *end) {
+  *begin = region * INTERP_REGION_SIZE;
+  *end = MIN((region + 1) * INTERP_REGION_SIZE, backend->code_size);
+}
+
+static void interp_backend_set_region(struct interp_backend *backend,
+                                      int region) {
+  int begin, end;
+  interp_backend_region_range(backend, region, &begin, &end);
+
+  backend->region = region;
+  backend->offset = begin;
+  backend->limit = end;
+}
+
+static void interp_backend_next_region(struct jit_backend *base, void **begin,
+                                       void **end) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+
+  int region = (backend->region + 1) % backend->num_regions;
+  interp_backend_set_region(backend, region);
+
+  *begin = backend->code + backend->offset;
+  *end = backend->code + backend->limit;
+}
+
+static int interp_backend_assemble_code(struct jit_backend *base,
+                                        struct jit_block *block,
+                                        struct ir *ir) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  struct jit_frontend *frontend = backend->jit->frontend;
+
+  /* the block's instruction count includes any ran by another's fallback, so
+     this may reserve a few more records than are decoded */
+  int size = (int)(sizeof(struct interp_code) +
+                   block->num_instrs * sizeof(struct jit_instr));
+
+  /* if the current region overflows, let the jit know so it can move on to the
+     next region and try again */
+  if (backend->offset + size > backend->limit) {
+    int begin, end;
+    interp_backend_region_range(backend, backend->region, &begin, &end);
+    CHECK_NE(backend->offset, begin, "block 0x%08x is too large for a region",
+             block->guest_addr);
+    return 0;
+  }
+
+  struct interp_code *code =
+      (struct interp_code *)(backend->code + backend->offset);
+  code->block = block;
+  code->guest_addr = block->guest_addr;
+  code->num_instrs = frontend->decode_code(frontend, block, code->instrs);
+  CHECK_LE(code->num_instrs, block->num_instrs);
+
+  size = (int)(sizeof(struct interp_code) +
+               code->num_instrs * sizeof(struct jit_instr));
+  backend->offset += size;
+
+  block->host_addr = code;
+  block->host_size = size;
+
+  return 1;
+}
+
+static void interp_backend_reset(struct jit_backend *base) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+
+  interp_backend_set_region(backend, 0);
+}
 
 static void interp_backend_destroy(struct jit_backend *base) {
   struct interp_backend *backend = (struct interp_backend *)base;
 
+  free(backend->cache);
+  free(backend->code);
   free(backend);
 }
 
 static void interp_backend_init(struct jit_backend *base) {
   struct interp_backend *backend = (struct interp_backend *)base;
+  struct jit_guest *guest = backend->jit->guest;
+
+  backend->cache_shift = ctz32(guest->addr_mask);
+  int num_entries = (guest->addr_mask >> backend->cache_shift) + 1;
+  backend->cache = calloc(num_entries, sizeof(struct interp_code *));
+
+  interp_backend_set_region(backend, 0);
 }
 
 struct jit_backend *interp_backend_create() {
@@ -70,18 +219,25 @@ struct jit_backend *interp_backend_create() {
   /* compile interface */
   backend->registers = NULL;
   backend->num_registers = 0;
+  backend->decodes_code = 1;
   backend->reset = &interp_backend_reset;
-  backend->assemble_code = NULL;
+  backend->next_region = &interp_backend_next_region;
+  backend->assemble_code = &interp_backend_assemble_code;
   backend->dump_code = &interp_backend_dump_code;
   backend->handle_exception = &interp_backend_handle_exception;
 
   /* dispatch interface */
   backend->run_code = &interp_backend_run_code;
-  backend->lookup_code = NULL;
-  backend->cache_code = NULL;
-  backend->invalidate_code = NULL;
+  backend->lookup_code = &interp_backend_lookup_code;
+  backend->cache_code = &interp_backend_cache_code;
+  backend->invalidate_code = &interp_backend_invalidate_code;
   backend->patch_edge = NULL;
   backend->restore_edge = NULL;
 
+  backend->code = malloc(INTERP_CODE_SIZE);
+  backend->code_size = INTERP_CODE_SIZE;
+  backend->num_regions =
+      (INTERP_CODE_SIZE + INTERP_REGION_SIZE - 1) / INTERP_REGION_SIZE;
+
   return (struct jit_backend *)backend;
 }
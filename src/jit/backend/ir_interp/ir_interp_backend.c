@@ -0,0 +1,1348 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit/backend/ir_interp/ir_interp_backend.h"
+#include "core/math.h"
+#include "jit/backend/jit_backend.h"
+#include "jit/frontend/jit_frontend.h"
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+
+/* blocks are assembled into a fixed size buffer, which is split into regions
+   that are evicted one at a time once it fills up, the same as a native code
+   buffer */
+#define IR_INTERP_CODE_SIZE 0x1000000
+#define IR_INTERP_REGION_SIZE 0x100000
+
+/* size of the stack space values are spilled to */
+#define IR_INTERP_LOCALS_SIZE 4096
+
+/* the register file is a set of slots in memory, which the register allocator
+   packs values into the same as it would host registers. as no registers are
+   clobbered by calls, they're all considered callee-saved */
+#define IR_INTERP_NUM_INT_REGS 32
+#define IR_INTERP_NUM_FLOAT_REGS 32
+#define IR_INTERP_NUM_REGS (IR_INTERP_NUM_INT_REGS + IR_INTERP_NUM_FLOAT_REGS)
+
+#define INT_REG(n) {"r" #n, VALUE_INT_MASK, JIT_CALLEE_SAVED, NULL}
+#define FLOAT_REG(n) \
+  {"f" #n, VALUE_FLOAT_MASK | VALUE_VECTOR_MASK, JIT_CALLEE_SAVED, NULL}
+
+static const struct jit_register ir_interp_registers[] = {
+    INT_REG(0),    INT_REG(1),    INT_REG(2),    INT_REG(3),    INT_REG(4),
+    INT_REG(5),    INT_REG(6),    INT_REG(7),    INT_REG(8),    INT_REG(9),
+    INT_REG(10),   INT_REG(11),   INT_REG(12),   INT_REG(13),   INT_REG(14),
+    INT_REG(15),   INT_REG(16),   INT_REG(17),   INT_REG(18),   INT_REG(19),
+    INT_REG(20),   INT_REG(21),   INT_REG(22),   INT_REG(23),   INT_REG(24),
+    INT_REG(25),   INT_REG(26),   INT_REG(27),   INT_REG(28),   INT_REG(29),
+    INT_REG(30),   INT_REG(31),   FLOAT_REG(0),  FLOAT_REG(1),  FLOAT_REG(2),
+    FLOAT_REG(3),  FLOAT_REG(4),  FLOAT_REG(5),  FLOAT_REG(6),  FLOAT_REG(7),
+    FLOAT_REG(8),  FLOAT_REG(9),  FLOAT_REG(10), FLOAT_REG(11), FLOAT_REG(12),
+    FLOAT_REG(13), FLOAT_REG(14), FLOAT_REG(15), FLOAT_REG(16), FLOAT_REG(17),
+    FLOAT_REG(18), FLOAT_REG(19), FLOAT_REG(20), FLOAT_REG(21), FLOAT_REG(22),
+    FLOAT_REG(23), FLOAT_REG(24), FLOAT_REG(25), FLOAT_REG(26), FLOAT_REG(27),
+    FLOAT_REG(28), FLOAT_REG(29), FLOAT_REG(30), FLOAT_REG(31),
+};
+
+/* every integer constant can be encoded directly into an instruction, so the
+   only constants the allocator copies into registers are floating point */
+static struct jit_emitter ir_interp_emitters[IR_NUM_OPS];
+
+/* ir ops are lowered into interpreter ops. integer arithmetic is shared by
+   each type, with results masked to the result's width, while the most common
+   memory ops and comparisons are specialized to avoid a second dispatch. the
+   pointer loads / stores are ordered the same as ir_type, and the integer
+   comparisons the same as ir_cmp. EXIT leaves a block which doesn't terminate
+   in an unconditional branch, the pc having ideally been set by a non-branch
+   operation such as a fallback handler */
+#define IR_INTERP_OPS(X)  \
+  X(FALLBACK)             \
+  X(LOAD_PTR_I8)          \
+  X(LOAD_PTR_I16)         \
+  X(LOAD_PTR_I32)         \
+  X(LOAD_PTR_I64)         \
+  X(LOAD_PTR_F32)         \
+  X(LOAD_PTR_F64)         \
+  X(LOAD_PTR_V128)        \
+  X(STORE_PTR_I8)         \
+  X(STORE_PTR_I16)        \
+  X(STORE_PTR_I32)        \
+  X(STORE_PTR_I64)        \
+  X(STORE_PTR_F32)        \
+  X(STORE_PTR_F64)        \
+  X(STORE_PTR_V128)       \
+  X(LOAD_HOST)            \
+  X(STORE_HOST)           \
+  X(LOAD_GUEST)           \
+  X(STORE_GUEST)          \
+  X(LOAD_MMIO)            \
+  X(STORE_MMIO)           \
+  X(FTOI_I32)             \
+  X(FTOI_I64)             \
+  X(ITOF_F32)             \
+  X(ITOF_F64)             \
+  X(TRUNC)                \
+  X(SEXT)                 \
+  X(FTRUNC)               \
+  X(FEXT)                 \
+  X(SELECT)               \
+  X(CMP_EQ)               \
+  X(CMP_NE)               \
+  X(CMP_SGE)              \
+  X(CMP_SGT)              \
+  X(CMP_UGE)              \
+  X(CMP_UGT)              \
+  X(CMP_SLE)              \
+  X(CMP_SLT)              \
+  X(CMP_ULE)              \
+  X(CMP_ULT)              \
+  X(FCMP_F32)             \
+  X(FCMP_F64)             \
+  X(ADD)                  \
+  X(SUB)                  \
+  X(MUL)                  \
+  X(NEG)                  \
+  X(ABS)                  \
+  X(FADD_F32)             \
+  X(FADD_F64)             \
+  X(FSUB_F32)             \
+  X(FSUB_F64)             \
+  X(FMUL_F32)             \
+  X(FMUL_F64)             \
+  X(FDIV_F32)             \
+  X(FDIV_F64)             \
+  X(FNEG_F32)             \
+  X(FNEG_F64)             \
+  X(FABS_F32)             \
+  X(FABS_F64)             \
+  X(SQRT_F32)             \
+  X(SQRT_F64)             \
+  X(VBROADCAST)           \
+  X(VADD)                 \
+  X(VDOT)                 \
+  X(VMUL)                 \
+  X(AND)                  \
+  X(OR)                   \
+  X(XOR)                  \
+  X(NOT)                  \
+  X(SHL)                  \
+  X(ASHR)                 \
+  X(LSHR)                 \
+  X(ASHD)                 \
+  X(LSHD)                 \
+  X(BRANCH)               \
+  X(BRANCH_FALSE)         \
+  X(BRANCH_TRUE)          \
+  X(CALL)                 \
+  X(CALL_COND)            \
+  X(ASSERT_LT)            \
+  X(COPY)                 \
+  X(EXIT)
+
+enum {
+#define IR_INTERP_OP(name) IR_INTERP_##name,
+  IR_INTERP_OPS(IR_INTERP_OP)
+#undef IR_INTERP_OP
+};
+
+/* integer values are always stored zero-extended to 64-bits, and only ever
+   read through i64, making the layout independent of the host's endianness */
+union ir_interp_slot {
+  uint64_t i64;
+  float f32;
+  double f64;
+  float v128[4];
+};
+
+struct ir_interp_instr {
+  int op;
+  /* type of the value loaded or stored by memory ops */
+  int type;
+  /* ir_cmp for float comparisons, or the mask applied to shift amounts */
+  int cond;
+  /* number of bits to shift arg0 left and back right to sign extend it */
+  int sext;
+  /* mask applied to integer results */
+  uint64_t mask;
+  /* host pointer or callback for memory ops and fallbacks */
+  void *ptr;
+  void *data;
+  union ir_interp_slot *res;
+  union ir_interp_slot *arg[IR_MAX_ARGS];
+};
+
+/* the assembled form of a block, cached for its guest address in place of
+   native code. the instructions are followed by the constants they reference */
+struct ir_interp_code {
+  struct jit_block *block;
+  uint32_t guest_addr;
+  int num_instrs;
+  int num_consts;
+  struct ir_interp_instr instrs[];
+};
+
+struct ir_interp_backend {
+  struct jit_backend;
+
+  union ir_interp_slot regs[IR_INTERP_NUM_REGS];
+  union ir_interp_slot locals[IR_INTERP_LOCALS_SIZE /
+                              sizeof(union ir_interp_slot)];
+
+  /* assembled blocks directly mapped by guest address */
+  struct ir_interp_code **cache;
+  int cache_shift;
+
+  uint8_t *code;
+  int code_size;
+  int num_regions;
+  int region;
+  int offset;
+  int limit;
+};
+
+typedef void (*ir_interp_call_cb)(uint64_t, uint64_t);
+
+static inline int64_t ir_interp_sext(uint64_t v, int sext) {
+  return (int64_t)(v << sext) >> sext;
+}
+
+static inline void ir_interp_load(union ir_interp_slot *r, const void *ptr,
+                                  int type) {
+  switch (type) {
+    case VALUE_I8:
+      r->i64 = *(const uint8_t *)ptr;
+      break;
+    case VALUE_I16:
+      r->i64 = *(const uint16_t *)ptr;
+      break;
+    case VALUE_I32:
+      r->i64 = *(const uint32_t *)ptr;
+      break;
+    case VALUE_I64:
+      r->i64 = *(const uint64_t *)ptr;
+      break;
+    case VALUE_F32:
+      r->f32 = *(const float *)ptr;
+      break;
+    case VALUE_F64:
+      r->f64 = *(const double *)ptr;
+      break;
+    case VALUE_V128:
+      memcpy(r->v128, ptr, sizeof(r->v128));
+      break;
+    default:
+      LOG_FATAL("unexpected load type");
+      break;
+  }
+}
+
+static inline void ir_interp_store(void *ptr, const union ir_interp_slot *v,
+                                   int type) {
+  switch (type) {
+    case VALUE_I8:
+      *(uint8_t *)ptr = (uint8_t)v->i64;
+      break;
+    case VALUE_I16:
+      *(uint16_t *)ptr = (uint16_t)v->i64;
+      break;
+    case VALUE_I32:
+      *(uint32_t *)ptr = (uint32_t)v->i64;
+      break;
+    case VALUE_I64:
+      *(uint64_t *)ptr = v->i64;
+      break;
+    case VALUE_F32:
+      *(float *)ptr = v->f32;
+      break;
+    case VALUE_F64:
+      *(double *)ptr = v->f64;
+      break;
+    case VALUE_V128:
+      memcpy(ptr, v->v128, sizeof(v->v128));
+      break;
+    default:
+      LOG_FATAL("unexpected store type");
+      break;
+  }
+}
+
+static inline int ir_interp_fcmp(int cond, double a, double b) {
+  switch (cond) {
+    case CMP_EQ:
+      return a == b;
+    case CMP_NE:
+      return a != b;
+    case CMP_SGE:
+    case CMP_UGE:
+      return a >= b;
+    case CMP_SGT:
+    case CMP_UGT:
+      return a > b;
+    case CMP_SLE:
+    case CMP_ULE:
+      return a <= b;
+    case CMP_SLT:
+    case CMP_ULT:
+      return a < b;
+    default:
+      LOG_FATAL("unexpected comparison");
+      return 0;
+  }
+}
+
+static inline struct ir_interp_code **ir_interp_backend_cache_entry(
+    struct ir_interp_backend *backend, uint32_t addr) {
+  uint32_t addr_mask = backend->jit->guest->addr_mask;
+  return &backend->cache[(addr & addr_mask) >> backend->cache_shift];
+}
+
+static void ir_interp_backend_exec(struct ir_interp_backend *backend,
+                                   const struct ir_interp_code *code) {
+  struct jit_guest *guest = backend->jit->guest;
+  uint32_t *pc = (uint32_t *)((uint8_t *)guest->ctx + guest->offset_pc);
+  const struct ir_interp_instr *instr = code->instrs;
+
+#define RES instr->res
+#define ARG0 instr->arg[0]
+#define ARG1 instr->arg[1]
+#define ARG2 instr->arg[2]
+#define ARG3 instr->arg[3]
+
+/* when supported, each op dispatches the next through a table of label
+   addresses, giving the host's branch predictor a separate indirect branch
+   per op to learn from */
+#if defined(__GNUC__)
+  static const void *dispatch[] = {
+#define IR_INTERP_OP(name) &&op_##name,
+      IR_INTERP_OPS(IR_INTERP_OP)
+#undef IR_INTERP_OP
+  };
+
+#define OP(name) \
+  case IR_INTERP_##name: \
+  op_##name:
+#define DISPATCH() goto *dispatch[instr->op]
+#define NEXT() goto *dispatch[(++instr)->op]
+#else
+#define OP(name) case IR_INTERP_##name:
+#define DISPATCH()
+#define NEXT() \
+  instr++;     \
+  continue
+#endif
+
+  DISPATCH();
+
+  for (;;) {
+    switch (instr->op) {
+      OP(FALLBACK) {
+        jit_fallback fallback = (jit_fallback)instr->ptr;
+        fallback(guest, (uint32_t)ARG1->i64, (uint32_t)ARG2->i64);
+      } NEXT();
+
+      OP(LOAD_PTR_I8)
+        RES->i64 = *(const uint8_t *)instr->ptr;
+        NEXT();
+
+      OP(LOAD_PTR_I16)
+        RES->i64 = *(const uint16_t *)instr->ptr;
+        NEXT();
+
+      OP(LOAD_PTR_I32)
+        RES->i64 = *(const uint32_t *)instr->ptr;
+        NEXT();
+
+      OP(LOAD_PTR_I64)
+        RES->i64 = *(const uint64_t *)instr->ptr;
+        NEXT();
+
+      OP(LOAD_PTR_F32)
+        RES->f32 = *(const float *)instr->ptr;
+        NEXT();
+
+      OP(LOAD_PTR_F64)
+        RES->f64 = *(const double *)instr->ptr;
+        NEXT();
+
+      OP(LOAD_PTR_V128)
+        memcpy(RES->v128, instr->ptr, sizeof(RES->v128));
+        NEXT();
+
+      OP(STORE_PTR_I8)
+        *(uint8_t *)instr->ptr = (uint8_t)ARG1->i64;
+        NEXT();
+
+      OP(STORE_PTR_I16)
+        *(uint16_t *)instr->ptr = (uint16_t)ARG1->i64;
+        NEXT();
+
+      OP(STORE_PTR_I32)
+        *(uint32_t *)instr->ptr = (uint32_t)ARG1->i64;
+        NEXT();
+
+      OP(STORE_PTR_I64)
+        *(uint64_t *)instr->ptr = ARG1->i64;
+        NEXT();
+
+      OP(STORE_PTR_F32)
+        *(float *)instr->ptr = ARG1->f32;
+        NEXT();
+
+      OP(STORE_PTR_F64)
+        *(double *)instr->ptr = ARG1->f64;
+        NEXT();
+
+      OP(STORE_PTR_V128)
+        memcpy(instr->ptr, ARG1->v128, sizeof(ARG1->v128));
+        NEXT();
+
+      OP(LOAD_HOST)
+        ir_interp_load(RES, (const void *)(uintptr_t)ARG0->i64, instr->type);
+        NEXT();
+
+      OP(STORE_HOST)
+        ir_interp_store((void *)(uintptr_t)ARG0->i64, ARG1, instr->type);
+        NEXT();
+
+      OP(LOAD_GUEST) {
+        uint32_t addr = (uint32_t)ARG0->i64;
+        switch (instr->type) {
+          case VALUE_I8:
+            RES->i64 = guest->r8(guest->space, addr);
+            break;
+          case VALUE_I16:
+            RES->i64 = guest->r16(guest->space, addr);
+            break;
+          case VALUE_I32:
+            RES->i64 = guest->r32(guest->space, addr);
+            break;
+          case VALUE_I64:
+            RES->i64 = guest->r64(guest->space, addr);
+            break;
+          default:
+            LOG_FATAL("unexpected load result type");
+            break;
+        }
+      } NEXT();
+
+      OP(STORE_GUEST) {
+        uint32_t addr = (uint32_t)ARG0->i64;
+        uint64_t data = ARG1->i64;
+        switch (instr->type) {
+          case VALUE_I8:
+            guest->w8(guest->space, addr, (uint8_t)data);
+            break;
+          case VALUE_I16:
+            guest->w16(guest->space, addr, (uint16_t)data);
+            break;
+          case VALUE_I32:
+            guest->w32(guest->space, addr, (uint32_t)data);
+            break;
+          case VALUE_I64:
+            guest->w64(guest->space, addr, data);
+            break;
+          default:
+            LOG_FATAL("unexpected store value type");
+            break;
+        }
+      } NEXT();
+
+      OP(LOAD_MMIO) {
+        mem_read_cb read = (mem_read_cb)instr->ptr;
+        uint32_t offset = (uint32_t)ARG0->i64;
+        RES->i64 = read(instr->data, offset, (uint32_t)instr->mask);
+      } NEXT();
+
+      OP(STORE_MMIO) {
+        mem_write_cb write = (mem_write_cb)instr->ptr;
+        uint32_t offset = (uint32_t)ARG0->i64;
+        uint32_t data = (uint32_t)(ARG1->i64 & instr->mask);
+        write(instr->data, offset, data, (uint32_t)instr->mask);
+      } NEXT();
+
+      OP(FTOI_I32)
+        RES->i64 = (uint32_t)(int32_t)ARG0->f32;
+        NEXT();
+
+      OP(FTOI_I64)
+        RES->i64 = (uint64_t)(int64_t)ARG0->f64;
+        NEXT();
+
+      OP(ITOF_F32)
+        RES->f32 = (float)(int32_t)ARG0->i64;
+        NEXT();
+
+      OP(ITOF_F64)
+        RES->f64 = (double)(int64_t)ARG0->i64;
+        NEXT();
+
+      OP(TRUNC)
+        RES->i64 = ARG0->i64 & instr->mask;
+        NEXT();
+
+      OP(SEXT)
+        RES->i64 = (uint64_t)ir_interp_sext(ARG0->i64, instr->sext) &
+                   instr->mask;
+        NEXT();
+
+      OP(FTRUNC)
+        RES->f32 = (float)ARG0->f64;
+        NEXT();
+
+      OP(FEXT)
+        RES->f64 = (double)ARG0->f32;
+        NEXT();
+
+      OP(SELECT)
+        *RES = ARG2->i64 ? *ARG0 : *ARG1;
+        NEXT();
+
+      OP(CMP_EQ)
+        RES->i64 = ARG0->i64 == ARG1->i64;
+        NEXT();
+
+      OP(CMP_NE)
+        RES->i64 = ARG0->i64 != ARG1->i64;
+        NEXT();
+
+      OP(CMP_SGE)
+        RES->i64 = ir_interp_sext(ARG0->i64, instr->sext) >=
+                   ir_interp_sext(ARG1->i64, instr->sext);
+        NEXT();
+
+      OP(CMP_SGT)
+        RES->i64 = ir_interp_sext(ARG0->i64, instr->sext) >
+                   ir_interp_sext(ARG1->i64, instr->sext);
+        NEXT();
+
+      OP(CMP_UGE)
+        RES->i64 = ARG0->i64 >= ARG1->i64;
+        NEXT();
+
+      OP(CMP_UGT)
+        RES->i64 = ARG0->i64 > ARG1->i64;
+        NEXT();
+
+      OP(CMP_SLE)
+        RES->i64 = ir_interp_sext(ARG0->i64, instr->sext) <=
+                   ir_interp_sext(ARG1->i64, instr->sext);
+        NEXT();
+
+      OP(CMP_SLT)
+        RES->i64 = ir_interp_sext(ARG0->i64, instr->sext) <
+                   ir_interp_sext(ARG1->i64, instr->sext);
+        NEXT();
+
+      OP(CMP_ULE)
+        RES->i64 = ARG0->i64 <= ARG1->i64;
+        NEXT();
+
+      OP(CMP_ULT)
+        RES->i64 = ARG0->i64 < ARG1->i64;
+        NEXT();
+
+      OP(FCMP_F32)
+        RES->i64 = ir_interp_fcmp(instr->cond, ARG0->f32, ARG1->f32);
+        NEXT();
+
+      OP(FCMP_F64)
+        RES->i64 = ir_interp_fcmp(instr->cond, ARG0->f64, ARG1->f64);
+        NEXT();
+
+      OP(ADD)
+        RES->i64 = (ARG0->i64 + ARG1->i64) & instr->mask;
+        NEXT();
+
+      OP(SUB)
+        RES->i64 = (ARG0->i64 - ARG1->i64) & instr->mask;
+        NEXT();
+
+      OP(MUL)
+        /* the low bits of the product are the same when signed */
+        RES->i64 = (ARG0->i64 * ARG1->i64) & instr->mask;
+        NEXT();
+
+      OP(NEG)
+        RES->i64 = (0 - ARG0->i64) & instr->mask;
+        NEXT();
+
+      OP(ABS) {
+        int64_t v = ir_interp_sext(ARG0->i64, instr->sext);
+        RES->i64 = (uint64_t)(v < 0 ? -v : v) & instr->mask;
+      } NEXT();
+
+      OP(FADD_F32)
+        RES->f32 = ARG0->f32 + ARG1->f32;
+        NEXT();
+
+      OP(FADD_F64)
+        RES->f64 = ARG0->f64 + ARG1->f64;
+        NEXT();
+
+      OP(FSUB_F32)
+        RES->f32 = ARG0->f32 - ARG1->f32;
+        NEXT();
+
+      OP(FSUB_F64)
+        RES->f64 = ARG0->f64 - ARG1->f64;
+        NEXT();
+
+      OP(FMUL_F32)
+        RES->f32 = ARG0->f32 * ARG1->f32;
+        NEXT();
+
+      OP(FMUL_F64)
+        RES->f64 = ARG0->f64 * ARG1->f64;
+        NEXT();
+
+      OP(FDIV_F32)
+        RES->f32 = ARG0->f32 / ARG1->f32;
+        NEXT();
+
+      OP(FDIV_F64)
+        RES->f64 = ARG0->f64 / ARG1->f64;
+        NEXT();
+
+      OP(FNEG_F32)
+        RES->f32 = -ARG0->f32;
+        NEXT();
+
+      OP(FNEG_F64)
+        RES->f64 = -ARG0->f64;
+        NEXT();
+
+      OP(FABS_F32)
+        RES->f32 = fabsf(ARG0->f32);
+        NEXT();
+
+      OP(FABS_F64)
+        RES->f64 = fabs(ARG0->f64);
+        NEXT();
+
+      OP(SQRT_F32)
+        RES->f32 = sqrtf(ARG0->f32);
+        NEXT();
+
+      OP(SQRT_F64)
+        RES->f64 = sqrt(ARG0->f64);
+        NEXT();
+
+      OP(VBROADCAST) {
+        float v = ARG0->f32;
+        for (int i = 0; i < 4; i++) {
+          RES->v128[i] = v;
+        }
+      } NEXT();
+
+      OP(VADD)
+        for (int i = 0; i < 4; i++) {
+          RES->v128[i] = ARG0->v128[i] + ARG1->v128[i];
+        }
+        NEXT();
+
+      OP(VDOT) {
+        float v = 0.0f;
+        for (int i = 0; i < 4; i++) {
+          v += ARG0->v128[i] * ARG1->v128[i];
+        }
+        RES->f32 = v;
+      } NEXT();
+
+      OP(VMUL)
+        for (int i = 0; i < 4; i++) {
+          RES->v128[i] = ARG0->v128[i] * ARG1->v128[i];
+        }
+        NEXT();
+
+      OP(AND)
+        RES->i64 = ARG0->i64 & ARG1->i64;
+        NEXT();
+
+      OP(OR)
+        RES->i64 = ARG0->i64 | ARG1->i64;
+        NEXT();
+
+      OP(XOR)
+        RES->i64 = ARG0->i64 ^ ARG1->i64;
+        NEXT();
+
+      OP(NOT)
+        RES->i64 = ~ARG0->i64 & instr->mask;
+        NEXT();
+
+      OP(SHL)
+        RES->i64 = (ARG0->i64 << (ARG1->i64 & instr->cond)) & instr->mask;
+        NEXT();
+
+      OP(ASHR)
+        RES->i64 = (uint64_t)(ir_interp_sext(ARG0->i64, instr->sext) >>
+                              (ARG1->i64 & instr->cond)) &
+                   instr->mask;
+        NEXT();
+
+      OP(LSHR)
+        RES->i64 = ARG0->i64 >> (ARG1->i64 & instr->cond);
+        NEXT();
+
+      OP(ASHD) {
+        int32_t v = (int32_t)ARG0->i64;
+        uint32_t n = (uint32_t)ARG1->i64;
+        if (!(n & 0x80000000)) {
+          v = (int32_t)((uint32_t)v << (n & 0x1f));
+        } else if (!(n & 0x1f)) {
+          /* right shift overflowed */
+          v >>= 31;
+        } else {
+          v >>= (0 - n) & 0x1f;
+        }
+        RES->i64 = (uint32_t)v;
+      } NEXT();
+
+      OP(LSHD) {
+        uint32_t v = (uint32_t)ARG0->i64;
+        uint32_t n = (uint32_t)ARG1->i64;
+        if (!(n & 0x80000000)) {
+          v <<= n & 0x1f;
+        } else if (!(n & 0x1f)) {
+          /* right shift overflowed */
+          v = 0;
+        } else {
+          v >>= (0 - n) & 0x1f;
+        }
+        RES->i64 = v;
+      } NEXT();
+
+      OP(BRANCH)
+        *pc = (uint32_t)ARG0->i64;
+        return;
+
+      OP(BRANCH_FALSE)
+        if (!ARG1->i64) {
+          *pc = (uint32_t)ARG0->i64;
+          return;
+        }
+        NEXT();
+
+      OP(BRANCH_TRUE)
+        if (ARG1->i64) {
+          *pc = (uint32_t)ARG0->i64;
+          return;
+        }
+        NEXT();
+
+      OP(CALL) {
+        ir_interp_call_cb fn = (ir_interp_call_cb)(uintptr_t)ARG0->i64;
+        fn(ARG1 ? ARG1->i64 : 0, ARG2 ? ARG2->i64 : 0);
+      } NEXT();
+
+      OP(CALL_COND)
+        if (ARG1->i64) {
+          ir_interp_call_cb fn = (ir_interp_call_cb)(uintptr_t)ARG0->i64;
+          fn(ARG2 ? ARG2->i64 : 0, ARG3 ? ARG3->i64 : 0);
+        }
+        NEXT();
+
+      OP(ASSERT_LT)
+        CHECK_LT(ir_interp_sext(ARG0->i64, instr->sext),
+                 ir_interp_sext(ARG1->i64, instr->sext));
+        NEXT();
+
+      OP(COPY)
+        *RES = *ARG0;
+        NEXT();
+
+      OP(EXIT)
+        return;
+
+      default:
+        LOG_FATAL("unexpected op %d", instr->op);
+        NEXT();
+    }
+  }
+
+#undef RES
+#undef ARG0
+#undef ARG1
+#undef ARG2
+#undef ARG3
+#undef OP
+#undef DISPATCH
+#undef NEXT
+}
+
+static void ir_interp_backend_run_code(struct jit_backend *base, int cycles) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+  struct jit *jit = backend->jit;
+  struct jit_guest *guest = jit->guest;
+  uint8_t *ctx = guest->ctx;
+  uint32_t *pc = (uint32_t *)(ctx + guest->offset_pc);
+  int32_t *run_cycles = (int32_t *)(ctx + guest->offset_cycles);
+  int32_t *ran_instrs = (int32_t *)(ctx + guest->offset_instrs);
+  uint64_t *pending_interrupts =
+      (uint64_t *)(ctx + guest->offset_interrupts);
+
+  *run_cycles = cycles;
+  *ran_instrs = 0;
+
+  while (*run_cycles > 0) {
+    if (*pending_interrupts) {
+      guest->interrupt_check(guest->data);
+    }
+
+    uint32_t addr = *pc;
+    struct ir_interp_code *code = *ir_interp_backend_cache_entry(backend, addr);
+
+    /* multiple guest addresses map to the same entry, make sure the assembled
+       block is for this one */
+    if (!code || code->guest_addr != addr) {
+      jit_compile_block(jit, addr);
+      continue;
+    }
+
+    /* count the block's runs, promoting it to the next tier once it's hot */
+    struct jit_block *block = code->block;
+    if (block->profile) {
+      block->num_runs++;
+
+      if (block->promote_runs && block->num_runs >= block->promote_runs) {
+        jit_promote_block(jit, addr);
+        continue;
+      }
+    }
+
+    *run_cycles -= block->num_cycles;
+    *ran_instrs += block->num_instrs;
+
+    ir_interp_backend_exec(backend, code);
+  }
+}
+
+static void *ir_interp_backend_lookup_code(struct jit_backend *base,
+                                           uint32_t addr) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+  return *ir_interp_backend_cache_entry(backend, addr);
+}
+
+static void ir_interp_backend_cache_code(struct jit_backend *base,
+                                         uint32_t addr, void *code) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+  *ir_interp_backend_cache_entry(backend, addr) = code;
+}
+
+static void ir_interp_backend_invalidate_code(struct jit_backend *base,
+                                              uint32_t addr) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+  *ir_interp_backend_cache_entry(backend, addr) = NULL;
+}
+
+static int ir_interp_backend_handle_exception(struct jit_backend *base,
+                                              struct exception_state *ex) {
+  return 0;
+}
+
+static void ir_interp_backend_dump_code(struct jit_backend *base,
+                                        const struct jit_block *block) {}
+
+static void ir_interp_backend_region_range(struct ir_interp_backend *backend,
+                                           int region, int *begin, int *end) {
+  *begin = region * IR_INTERP_REGION_SIZE;
+  *end = MIN((region + 1) * IR_INTERP_REGION_SIZE, backend->code_size);
+}
+
+static void ir_interp_backend_set_region(struct ir_interp_backend *backend,
+                                         int region) {
+  int begin, end;
+  ir_interp_backend_region_range(backend, region, &begin, &end);
+
+  backend->region = region;
+  backend->offset = begin;
+  backend->limit = end;
+}
+
+static void ir_interp_backend_next_region(struct jit_backend *base,
+                                          void **begin, void **end) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+
+  int region = (backend->region + 1) % backend->num_regions;
+  ir_interp_backend_set_region(backend, region);
+
+  *begin = backend->code + backend->offset;
+  *end = backend->code + backend->limit;
+}
+
+static uint64_t ir_interp_mask(enum ir_type type) {
+  int bits = ir_type_size(type) * 8;
+  return bits >= 64 ? ~UINT64_C(0) : (UINT64_C(1) << bits) - 1;
+}
+
+static int ir_interp_sext_shift(enum ir_type type) {
+  return 64 - ir_type_size(type) * 8;
+}
+
+static union ir_interp_slot *ir_interp_backend_slot(
+    struct ir_interp_backend *backend, const struct ir_value *v,
+    union ir_interp_slot **consts) {
+  if (!v) {
+    return NULL;
+  }
+
+  if (ir_is_constant(v)) {
+    union ir_interp_slot *slot = (*consts)++;
+    memset(slot, 0, sizeof(*slot));
+
+    if (v->type == VALUE_F32) {
+      slot->f32 = v->f32;
+    } else if (v->type == VALUE_F64) {
+      slot->f64 = v->f64;
+    } else {
+      slot->i64 = ir_zext_constant(v);
+    }
+
+    return slot;
+  }
+
+  CHECK_NE(v->reg, NO_REGISTER);
+  return &backend->regs[v->reg];
+}
+
+static void ir_interp_backend_lower(struct ir_interp_backend *backend,
+                                    const struct ir_instr *ir_instr,
+                                    struct ir_interp_instr *instr) {
+  struct jit_guest *guest = backend->jit->guest;
+  struct ir_value *res = ir_instr->result;
+  struct ir_value *arg0 = ir_instr->arg[0];
+
+  /* integer ops mask their result to its width and sign extend their first
+     argument from its width when needed */
+  enum ir_type type = res ? res->type : (arg0 ? arg0->type : VALUE_V);
+  if (ir_is_int(type)) {
+    instr->mask = ir_interp_mask(type);
+  }
+  if (arg0 && ir_is_int(arg0->type)) {
+    instr->sext = ir_interp_sext_shift(arg0->type);
+  }
+
+  switch (ir_instr->op) {
+    case OP_FALLBACK:
+      instr->op = IR_INTERP_FALLBACK;
+      instr->ptr = (void *)(intptr_t)arg0->i64;
+      break;
+
+    case OP_LOAD_HOST:
+      instr->op = IR_INTERP_LOAD_HOST;
+      instr->type = res->type;
+      break;
+
+    case OP_STORE_HOST:
+      instr->op = IR_INTERP_STORE_HOST;
+      instr->type = ir_instr->arg[1]->type;
+      break;
+
+    case OP_LOAD_GUEST:
+    case OP_LOAD_FAST:
+      instr->op = IR_INTERP_LOAD_GUEST;
+      instr->type = res->type;
+
+      /* try to either directly access memory or invoke the MMIO callback */
+      if (ir_is_constant(arg0) && res->type != VALUE_I64) {
+        void *ptr;
+        void *userdata;
+        mem_read_cb read;
+        uint32_t offset;
+        guest->lookup(guest->space, arg0->i32, &ptr, &userdata, &read, NULL,
+                      &offset);
+
+        /* see the x64 backend's LOAD_GUEST emitter */
+        void *storage = NULL;
+        if (!ptr && guest->lookup_storage && res->type <= VALUE_I32) {
+          storage = guest->lookup_storage(guest->space, arg0->i32, 0);
+        }
+
+        if (ptr) {
+          instr->op = IR_INTERP_LOAD_PTR_I8 + res->type - VALUE_I8;
+          instr->ptr = (uint8_t *)guest->mem + (uint32_t)arg0->i32;
+        } else if (storage) {
+          instr->op = IR_INTERP_LOAD_PTR_I8 + res->type - VALUE_I8;
+          instr->ptr = storage;
+        } else {
+          instr->op = IR_INTERP_LOAD_MMIO;
+          instr->ptr = (void *)read;
+          instr->data = userdata;
+          instr->arg[0]->i64 = offset;
+        }
+      }
+      break;
+
+    case OP_STORE_GUEST:
+    case OP_STORE_FAST:
+      instr->op = IR_INTERP_STORE_GUEST;
+      instr->type = ir_instr->arg[1]->type;
+
+      if (ir_is_constant(arg0) && instr->type != VALUE_I64) {
+        void *ptr;
+        void *userdata;
+        mem_write_cb write;
+        uint32_t offset;
+        guest->lookup(guest->space, arg0->i32, &ptr, &userdata, NULL, &write,
+                      &offset);
+
+        /* see the x64 backend's STORE_GUEST emitter */
+        void *storage = NULL;
+        if (!ptr && guest->lookup_storage && instr->type == VALUE_I32) {
+          storage = guest->lookup_storage(guest->space, arg0->i32, 1);
+        }
+
+        if (ptr) {
+          instr->op = IR_INTERP_STORE_PTR_I8 + instr->type - VALUE_I8;
+          instr->ptr = (uint8_t *)guest->mem + (uint32_t)arg0->i32;
+        } else if (storage) {
+          instr->op = IR_INTERP_STORE_PTR_I32;
+          instr->ptr = storage;
+        } else {
+          instr->op = IR_INTERP_STORE_MMIO;
+          instr->ptr = (void *)write;
+          instr->data = userdata;
+          instr->mask = ir_interp_mask(instr->type);
+          instr->arg[0]->i64 = offset;
+        }
+      }
+      break;
+
+    case OP_LOAD_CONTEXT:
+      instr->op = IR_INTERP_LOAD_PTR_I8 + res->type - VALUE_I8;
+      instr->ptr = (uint8_t *)guest->ctx + arg0->i32;
+      break;
+
+    case OP_STORE_CONTEXT:
+      instr->op = IR_INTERP_STORE_PTR_I8 + ir_instr->arg[1]->type - VALUE_I8;
+      instr->ptr = (uint8_t *)guest->ctx + arg0->i32;
+      break;
+
+    case OP_LOAD_LOCAL:
+      instr->op = IR_INTERP_LOAD_PTR_I8 + res->type - VALUE_I8;
+      instr->ptr = (uint8_t *)backend->locals + arg0->i32;
+      break;
+
+    case OP_STORE_LOCAL:
+      instr->op = IR_INTERP_STORE_PTR_I8 + ir_instr->arg[1]->type - VALUE_I8;
+      instr->ptr = (uint8_t *)backend->locals + arg0->i32;
+      break;
+
+    case OP_FTOI:
+      instr->op =
+          res->type == VALUE_I32 ? IR_INTERP_FTOI_I32 : IR_INTERP_FTOI_I64;
+      break;
+
+    case OP_ITOF:
+      instr->op =
+          res->type == VALUE_F32 ? IR_INTERP_ITOF_F32 : IR_INTERP_ITOF_F64;
+      break;
+
+    case OP_TRUNC:
+    case OP_ZEXT:
+      /* integers are already stored zero-extended */
+      instr->op = IR_INTERP_TRUNC;
+      break;
+
+    case OP_SEXT:
+      instr->op = IR_INTERP_SEXT;
+      break;
+
+    case OP_FTRUNC:
+      instr->op = IR_INTERP_FTRUNC;
+      break;
+
+    case OP_FEXT:
+      instr->op = IR_INTERP_FEXT;
+      break;
+
+    case OP_SELECT:
+      instr->op = IR_INTERP_SELECT;
+      break;
+
+    case OP_CMP:
+      instr->op = IR_INTERP_CMP_EQ + ir_instr->arg[2]->i32;
+      break;
+
+    case OP_FCMP:
+      instr->op = arg0->type == VALUE_F32 ? IR_INTERP_FCMP_F32
+                                          : IR_INTERP_FCMP_F64;
+      instr->cond = ir_instr->arg[2]->i32;
+      break;
+
+    case OP_ADD:
+      instr->op = IR_INTERP_ADD;
+      break;
+
+    case OP_SUB:
+      instr->op = IR_INTERP_SUB;
+      break;
+
+    case OP_SMUL:
+    case OP_UMUL:
+      instr->op = IR_INTERP_MUL;
+      break;
+
+    case OP_NEG:
+      instr->op = IR_INTERP_NEG;
+      break;
+
+    case OP_ABS:
+      instr->op = IR_INTERP_ABS;
+      break;
+
+#define FLOAT_OP(name)                                    \
+  case OP_##name:                                         \
+    instr->op = res->type == VALUE_F32 ? IR_INTERP_##name##_F32 \
+                                       : IR_INTERP_##name##_F64; \
+    break;
+
+      FLOAT_OP(FADD)
+      FLOAT_OP(FSUB)
+      FLOAT_OP(FMUL)
+      FLOAT_OP(FDIV)
+      FLOAT_OP(FNEG)
+      FLOAT_OP(FABS)
+      FLOAT_OP(SQRT)
+
+#undef FLOAT_OP
+
+    case OP_VBROADCAST:
+      instr->op = IR_INTERP_VBROADCAST;
+      break;
+
+    case OP_VADD:
+      instr->op = IR_INTERP_VADD;
+      break;
+
+    case OP_VDOT:
+      instr->op = IR_INTERP_VDOT;
+      break;
+
+    case OP_VMUL:
+      instr->op = IR_INTERP_VMUL;
+      break;
+
+    case OP_AND:
+      instr->op = IR_INTERP_AND;
+      break;
+
+    case OP_OR:
+      instr->op = IR_INTERP_OR;
+      break;
+
+    case OP_XOR:
+      instr->op = IR_INTERP_XOR;
+      break;
+
+    case OP_NOT:
+      instr->op = IR_INTERP_NOT;
+      break;
+
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+      instr->op = ir_instr->op == OP_SHL
+                      ? IR_INTERP_SHL
+                      : (ir_instr->op == OP_ASHR ? IR_INTERP_ASHR
+                                                 : IR_INTERP_LSHR);
+      /* shift amounts are masked the same as x86 */
+      instr->cond = res->type == VALUE_I64 ? 63 : 31;
+      break;
+
+    case OP_ASHD:
+      CHECK_EQ(res->type, VALUE_I32);
+      instr->op = IR_INTERP_ASHD;
+      break;
+
+    case OP_LSHD:
+      CHECK_EQ(res->type, VALUE_I32);
+      instr->op = IR_INTERP_LSHD;
+      break;
+
+    case OP_BRANCH:
+      instr->op = IR_INTERP_BRANCH;
+      break;
+
+    case OP_BRANCH_FALSE:
+      instr->op = IR_INTERP_BRANCH_FALSE;
+      break;
+
+    case OP_BRANCH_TRUE:
+      instr->op = IR_INTERP_BRANCH_TRUE;
+      break;
+
+    case OP_CALL:
+      instr->op = IR_INTERP_CALL;
+      break;
+
+    case OP_CALL_COND:
+      instr->op = IR_INTERP_CALL_COND;
+      break;
+
+    case OP_ASSERT_LT:
+      instr->op = IR_INTERP_ASSERT_LT;
+      break;
+
+    case OP_COPY:
+      instr->op = IR_INTERP_COPY;
+      break;
+
+    default:
+      LOG_FATAL("unsupported op %s", ir_opdefs[ir_instr->op].name);
+      break;
+  }
+}
+
+static int ir_interp_backend_assemble_code(struct jit_backend *base,
+                                           struct jit_block *block,
+                                           struct ir *ir) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+
+  CHECK_LT(ir->locals_size, IR_INTERP_LOCALS_SIZE);
+
+  /* count the instructions and constants needed, each block which doesn't
+     terminate in an unconditional branch getting an extra exit */
+  int num_instrs = 0;
+  int num_consts = 0;
+
+  list_for_each_entry(ir_block, &ir->blocks, struct ir_block, it) {
+    int terminated = 0;
+
+    list_for_each_entry(ir_instr, &ir_block->instrs, struct ir_instr, it) {
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *arg = ir_instr->arg[i];
+        num_consts += arg && ir_is_constant(arg);
+      }
+      num_instrs++;
+      terminated = ir_instr->op == OP_BRANCH;
+    }
+
+    num_instrs += !terminated;
+  }
+
+  int size = (int)(sizeof(struct ir_interp_code) +
+                   num_instrs * sizeof(struct ir_interp_instr) +
+                   num_consts * sizeof(union ir_interp_slot));
+  size = align_up(size, 16);
+
+  /* if the current region overflows, let the jit know so it can move on to the
+     next region and try again */
+  if (backend->offset + size > backend->limit) {
+    int begin, end;
+    ir_interp_backend_region_range(backend, backend->region, &begin, &end);
+    CHECK_NE(backend->offset, begin, "block 0x%08x is too large for a region",
+             block->guest_addr);
+    return 0;
+  }
+
+  struct ir_interp_code *code =
+      (struct ir_interp_code *)(backend->code + backend->offset);
+  code->block = block;
+  code->guest_addr = block->guest_addr;
+  code->num_instrs = num_instrs;
+  code->num_consts = num_consts;
+
+  struct ir_interp_instr *instr = code->instrs;
+  union ir_interp_slot *consts =
+      (union ir_interp_slot *)(code->instrs + num_instrs);
+
+  list_for_each_entry(ir_block, &ir->blocks, struct ir_block, it) {
+    int terminated = 0;
+
+    list_for_each_entry(ir_instr, &ir_block->instrs, struct ir_instr, it) {
+      memset(instr, 0, sizeof(*instr));
+
+      instr->res = ir_interp_backend_slot(backend, ir_instr->result, &consts);
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        instr->arg[i] =
+            ir_interp_backend_slot(backend, ir_instr->arg[i], &consts);
+      }
+
+      ir_interp_backend_lower(backend, ir_instr, instr);
+
+      terminated = ir_instr->op == OP_BRANCH;
+      instr++;
+    }
+
+    if (!terminated) {
+      memset(instr, 0, sizeof(*instr));
+      instr->op = IR_INTERP_EXIT;
+      instr++;
+    }
+  }
+
+  backend->offset += size;
+
+  block->host_addr = code;
+  block->host_size = size;
+
+  return 1;
+}
+
+static void ir_interp_backend_reset(struct jit_backend *base) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+
+  ir_interp_backend_set_region(backend, 0);
+}
+
+static void ir_interp_backend_destroy(struct jit_backend *base) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+
+  free(backend->cache);
+  free(backend->code);
+  free(backend);
+}
+
+static void ir_interp_backend_init(struct jit_backend *base) {
+  struct ir_interp_backend *backend = (struct ir_interp_backend *)base;
+  struct jit_guest *guest = backend->jit->guest;
+
+  backend->cache_shift = ctz32(guest->addr_mask);
+  int num_entries = (guest->addr_mask >> backend->cache_shift) + 1;
+  backend->cache = calloc(num_entries, sizeof(struct ir_interp_code *));
+
+  ir_interp_backend_set_region(backend, 0);
+}
+
+struct jit_backend *ir_interp_backend_create() {
+  struct ir_interp_backend *backend =
+      calloc(1, sizeof(struct ir_interp_backend));
+
+  for (int i = 0; i < IR_NUM_OPS; i++) {
+    struct jit_emitter *emitter = &ir_interp_emitters[i];
+
+    for (int j = 0; j < IR_MAX_ARGS; j++) {
+      emitter->arg_flags[j] = JIT_CONSTRAINT_IMM_I64;
+    }
+  }
+
+  backend->init = &ir_interp_backend_init;
+  backend->destroy = &ir_interp_backend_destroy;
+
+  /* compile interface */
+  backend->registers = ir_interp_registers;
+  backend->num_registers = array_size(ir_interp_registers);
+  backend->emitters = ir_interp_emitters;
+  backend->num_emitters = array_size(ir_interp_emitters);
+  backend->reset = &ir_interp_backend_reset;
+  backend->next_region = &ir_interp_backend_next_region;
+  backend->assemble_code = &ir_interp_backend_assemble_code;
+  backend->dump_code = &ir_interp_backend_dump_code;
+  backend->handle_exception = &ir_interp_backend_handle_exception;
+
+  /* dispatch interface */
+  backend->run_code = &ir_interp_backend_run_code;
+  backend->lookup_code = &ir_interp_backend_lookup_code;
+  backend->cache_code = &ir_interp_backend_cache_code;
+  backend->invalidate_code = &ir_interp_backend_invalidate_code;
+  backend->patch_edge = NULL;
+  backend->restore_edge = NULL;
+
+  backend->code = malloc(IR_INTERP_CODE_SIZE);
+  backend->code_size = IR_INTERP_CODE_SIZE;
+  backend->num_regions = (IR_INTERP_CODE_SIZE + IR_INTERP_REGION_SIZE - 1) /
+                         IR_INTERP_REGION_SIZE;
+
+  return (struct jit_backend *)backend;
+}
@@ -0,0 +1,8 @@
+#ifndef IR_INTERP_BACKEND_H
+#define IR_INTERP_BACKEND_H
+
+#include "jit/backend/jit_backend.h"
+
+struct jit_backend *ir_interp_backend_create();
+
+#endif
@@ -17,14 +17,22 @@ struct jit_block;
    further, the code buffer needs to be no greater than 1 MB in size so the a64
    backend can use conditional branches to thunks without trampolining
 
+   the buffer is sized generously as its pages aren't touched until the backend
+   grows into them. this lets the x64 backend keep far more code
+   resident than it would fill in most titles, while staying comfortably within
+   the 2 GB window
+
    finally, the code buffer needs to be aligned to a 4kb page so it's easy to
    mprotect */
 #if ARCH_A64
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t name[0x100000] ALIGNED(4096)
+#define JIT_CODE_BUFFER_SIZE 0x100000
 #else
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t name[0x800000] ALIGNED(4096)
+#define JIT_CODE_BUFFER_SIZE 0x4000000
 #endif
 
+#define DEFINE_JIT_CODE_BUFFER(name) \
+  static uint8_t name[JIT_CODE_BUFFER_SIZE] ALIGNED(4096)
+
 /* backend-specific register definition */
 enum {
   JIT_CALLEE_SAVED = 0x1,
@@ -67,11 +75,21 @@ struct jit_backend {
   const struct jit_emitter *emitters;
   int num_emitters;
 
+  /* backends which run the frontend's decoded instructions rather than
+     compiling ir set this. blocks aren't translated to ir for them, and
+     assemble_code is passed an empty ir */
+  int decodes_code;
+
   void (*init)(struct jit_backend *);
   void (*destroy)(struct jit_backend *);
 
   /* compile interface */
   void (*reset)(struct jit_backend *);
+  /* code is emitted into the code buffer one region at a time. once the
+     current region is full, this moves emission on to the next region and
+     returns its host address range. any blocks still resident in the range
+     must be freed before more code is assembled */
+  void (*next_region)(struct jit_backend *, void **, void **);
   int (*assemble_code)(struct jit_backend *, struct jit_block *, struct ir *);
   void (*dump_code)(struct jit_backend *, const struct jit_block *);
   int (*handle_exception)(struct jit_backend *, struct exception_state *);
@@ -294,6 +294,17 @@ static void x64_backend_emit_prologue(struct x64_backend *backend,
   e.test(e.rax, e.rax);
   e.jnz(backend->dispatch_interrupt);
 
+  /* count the block's runs, promoting it to the next tier once it's hot */
+  if (block->profile) {
+    e.mov(e.rax, (uint64_t)&block->num_runs);
+    e.inc(e.dword[e.rax]);
+
+    if (block->promote_runs) {
+      e.cmp(e.dword[e.rax], block->promote_runs);
+      e.jae(backend->dispatch_promote);
+    }
+  }
+
   /* update run counts */
   e.sub(e.dword[guestctx + guest->offset_cycles], block->num_cycles);
   e.add(e.dword[guestctx + guest->offset_instrs], block->num_instrs);
@@ -553,21 +564,61 @@ static void x64_backend_dump_code(struct jit_backend *base,
   cs_free(insns, count);
 }
 
+static void x64_backend_region_range(struct x64_backend *backend, int region,
+                                     int *begin, int *end) {
+  /* the first region begins after the thunks, which are never evicted */
+  *begin = MAX(region * X64_REGION_SIZE, X64_THUNK_SIZE);
+  *end = MIN((region + 1) * X64_REGION_SIZE, backend->code_size);
+}
+
+static void x64_backend_set_region(struct x64_backend *backend, int region) {
+  int begin, end;
+  x64_backend_region_range(backend, region, &begin, &end);
+
+  backend->region = region;
+  backend->codegen->set_limit(end);
+  backend->codegen->setSize(begin);
+}
+
+static void x64_backend_next_region(struct jit_backend *base, void **begin,
+                                    void **end) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  /* grow into the next untouched region while there is one, after which the
+     oldest region is evicted */
+  int region = (backend->region + 1) % backend->num_regions;
+  x64_backend_set_region(backend, region);
+
+  int region_begin, region_end;
+  x64_backend_region_range(backend, region, &region_begin, &region_end);
+  *begin = backend->code + region_begin;
+  *end = backend->code + region_end;
+}
+
 static int x64_backend_assemble_code(struct jit_backend *base,
                                      struct jit_block *block, struct ir *ir) {
   PROF_ENTER("cpu", "x64_backend_assemble_code");
 
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
+  size_t start = backend->codegen->getSize();
   int res = 1;
 
-  /* try to generate the x64 code. if the code buffer overflows let the backend
-     know so it can reset the cache and try again */
+  /* try to generate the x64 code. if the current region overflows let the
+     jit know so it can move on to the next region and try again */
   try {
     x64_backend_emit(backend, block, ir);
   } catch (const Xbyak::Error &e) {
     if (e != Xbyak::ERR_CODE_IS_TOO_BIG) {
       LOG_FATAL("x64 codegen failure, %s", e.what());
     }
+
+    /* moving on to the next region won't help if it didn't fit in an empty
+       one */
+    int begin, end;
+    x64_backend_region_range(backend, backend->region, &begin, &end);
+    CHECK_NE(start, (size_t)begin, "block 0x%08x is too large for a region",
+             block->guest_addr);
+
     res = 0;
   }
 
@@ -581,7 +632,7 @@ static void x64_backend_reset(struct jit_backend *base) {
 
   /* avoid reemitting thunks by just resetting the size to a safe spot after
      the thunks */
-  backend->codegen->setSize(X64_THUNK_SIZE);
+  x64_backend_set_region(backend, 0);
 }
 
 static void x64_backend_destroy(struct jit_backend *base) {
@@ -606,6 +657,8 @@ static void x64_backend_init(struct jit_backend *base) {
   x64_backend_emit_thunks(backend);
   x64_backend_emit_constants(backend);
   CHECK_LT(backend->codegen->getSize(), X64_THUNK_SIZE);
+
+  x64_backend_set_region(backend, 0);
 }
 
 struct jit_backend *x64_backend_create(void *code, int code_size) {
@@ -625,6 +678,7 @@ struct jit_backend *x64_backend_create(void *code, int code_size) {
   backend->base.emitters = x64_emitters;
   backend->base.num_emitters = array_size(x64_emitters);
   backend->base.reset = &x64_backend_reset;
+  backend->base.next_region = &x64_backend_next_region;
   backend->base.assemble_code = &x64_backend_assemble_code;
   backend->base.dump_code = &x64_backend_dump_code;
   backend->base.handle_exception = &x64_backend_handle_exception;
@@ -637,7 +691,10 @@ struct jit_backend *x64_backend_create(void *code, int code_size) {
   backend->base.patch_edge = &x64_dispatch_patch_edge;
   backend->base.restore_edge = &x64_dispatch_restore_edge;
 
-  backend->codegen = new Xbyak::CodeGenerator(code_size, code);
+  backend->code = (uint8_t *)code;
+  backend->code_size = code_size;
+  backend->num_regions = (code_size + X64_REGION_SIZE - 1) / X64_REGION_SIZE;
+  backend->codegen = new x64_codegen(code_size, code);
   backend->use_avx = cpu.has(Xbyak::util::Cpu::tAVX2);
 
   int res = cs_open(CS_ARCH_X86, CS_MODE_64, &backend->capstone_handle);
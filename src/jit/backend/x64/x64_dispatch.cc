@@ -2,9 +2,15 @@
 
 extern "C" {
 #include "core/assert.h"
+#include "core/profiler.h"
 #include "jit/jit.h"
 }
 
+DEFINE_AGGREGATE_COUNTER(x64_ras_hits);
+DEFINE_AGGREGATE_COUNTER(x64_ras_misses);
+DEFINE_AGGREGATE_COUNTER(x64_ic_hits);
+DEFINE_AGGREGATE_COUNTER(x64_ic_misses);
+
 /* log out pc each time dispatch is entered for debugging */
 #define LOG_DISPATCH_EVERY_N 0
 
@@ -30,6 +36,97 @@ static void x64_dispatch_log(struct x64_ctx *ctx) {
 }
 #endif
 
+/* called when a dynamic branch's inline cache misses, updating it to predict
+   the new destination next time */
+static void x64_dispatch_update_ic(struct x64_backend *backend,
+                                   struct x64_inline_cache *ic, uint32_t addr) {
+  backend->predict->ic_misses++;
+
+  ic->guest_addr = addr;
+  ic->code = x64_dispatch_code_ptr(backend, addr);
+}
+
+void x64_dispatch_emit_call(struct x64_backend *backend, uint32_t ret_addr) {
+  struct x64_predict *predict = backend->predict;
+  auto &e = *backend->codegen;
+
+  static_assert(sizeof(struct x64_ras_entry) == 16, "unexpected entry size");
+
+  /* push the return address and its code cache entry onto the return address
+     stack. the stack is circular, so deep call chains overwrite the oldest
+     entries rather than overflowing */
+  e.mov(e.rax, (uint64_t)predict);
+  e.mov(arg0.cvt32(), e.dword[e.rax + offsetof(struct x64_predict, ras_top)]);
+  e.add(arg0.cvt32(), 1);
+  e.and_(arg0.cvt32(), X64_RAS_SIZE - 1);
+  e.mov(e.dword[e.rax + offsetof(struct x64_predict, ras_top)], arg0.cvt32());
+  e.shl(arg0.cvt32(), 4);
+  e.add(e.rax, arg0);
+  e.mov(e.dword[e.rax + offsetof(struct x64_predict, ras) +
+                offsetof(struct x64_ras_entry, guest_addr)],
+        ret_addr);
+  e.mov(arg1, (uint64_t)x64_dispatch_code_ptr(backend, ret_addr));
+  e.mov(e.qword[e.rax + offsetof(struct x64_predict, ras) +
+                offsetof(struct x64_ras_entry, code)],
+        arg1);
+}
+
+void x64_dispatch_emit_return(struct x64_backend *backend,
+                              const Xbyak::Reg &dst) {
+  struct x64_predict *predict = backend->predict;
+  auto &e = *backend->codegen;
+
+  Xbyak::Label miss;
+
+  /* pop the top of the return address stack, and jump directly to its code
+     if it matches the actual destination */
+  e.mov(e.rax, (uint64_t)predict);
+  e.mov(arg0.cvt32(), e.dword[e.rax + offsetof(struct x64_predict, ras_top)]);
+  e.mov(arg1.cvt32(), arg0.cvt32());
+  e.sub(arg0.cvt32(), 1);
+  e.and_(arg0.cvt32(), X64_RAS_SIZE - 1);
+  e.mov(e.dword[e.rax + offsetof(struct x64_predict, ras_top)], arg0.cvt32());
+  e.shl(arg1.cvt32(), 4);
+  e.cmp(dst, e.dword[e.rax + arg1 + offsetof(struct x64_predict, ras) +
+                     offsetof(struct x64_ras_entry, guest_addr)]);
+  e.jne(miss);
+  e.inc(e.qword[e.rax + offsetof(struct x64_predict, ras_hits)]);
+  e.mov(e.rax, e.qword[e.rax + arg1 + offsetof(struct x64_predict, ras) +
+                       offsetof(struct x64_ras_entry, code)]);
+  e.jmp(e.qword[e.rax]);
+
+  e.L(miss);
+  e.inc(e.qword[e.rax + offsetof(struct x64_predict, ras_misses)]);
+  e.jmp(backend->dispatch_dynamic);
+}
+
+void x64_dispatch_emit_indirect(struct x64_backend *backend,
+                                const Xbyak::Reg &dst) {
+  struct x64_predict *predict = backend->predict;
+  auto &e = *backend->codegen;
+
+  Xbyak::Label miss;
+
+  /* entries aren't reset when handed out, as the previous site may still be
+     using it. whatever destination it holds is still a valid prediction */
+  struct x64_inline_cache *ic =
+      &predict->ic[predict->ic_next++ & (X64_IC_SIZE - 1)];
+
+  /* compare against the destination cached from the last time the branch was
+     taken, jumping directly to its code on a hit. on a miss, the inline cache
+     is updated before dispatching as usual */
+  e.mov(e.rax, (uint64_t)ic);
+  e.cmp(dst, e.dword[e.rax + offsetof(struct x64_inline_cache, guest_addr)]);
+  e.jne(miss);
+  e.mov(arg0, (uint64_t)&predict->ic_hits);
+  e.inc(e.qword[arg0]);
+  e.mov(e.rax, e.qword[e.rax + offsetof(struct x64_inline_cache, code)]);
+  e.jmp(e.qword[e.rax]);
+
+  e.L(miss);
+  e.jmp(backend->dispatch_ic_miss);
+}
+
 void x64_dispatch_restore_edge(struct jit_backend *base, void *code,
                                uint32_t dst) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
@@ -65,7 +162,18 @@ void *x64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
 
 void x64_dispatch_run_code(struct jit_backend *base, int cycles) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
+  struct x64_predict *predict = backend->predict;
+
   backend->dispatch_enter(cycles);
+
+  prof_counter_add(COUNTER_x64_ras_hits, predict->ras_hits);
+  prof_counter_add(COUNTER_x64_ras_misses, predict->ras_misses);
+  prof_counter_add(COUNTER_x64_ic_hits, predict->ic_hits);
+  prof_counter_add(COUNTER_x64_ic_misses, predict->ic_misses);
+  predict->ras_hits = 0;
+  predict->ras_misses = 0;
+  predict->ic_hits = 0;
+  predict->ic_misses = 0;
 }
 
 void x64_dispatch_emit_thunks(struct x64_backend *backend) {
@@ -93,6 +201,21 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.jmp(e.qword[e.rax + e.rcx * (sizeof(void *) >> backend->cache_shift)]);
   }
 
+  {
+    /* called when a dynamic branch misses its inline cache, with the address
+       of the inline cache in rax. the inline cache is updated to predict the
+       current pc before falling through to the dynamic branch thunk */
+    e.align(32);
+
+    backend->dispatch_ic_miss = e.getCurr<void *>();
+
+    e.mov(arg0, (uint64_t)backend);
+    e.mov(arg1, e.rax);
+    e.mov(arg2.cvt32(), e.dword[guestctx + jit->guest->offset_pc]);
+    e.call(&x64_dispatch_update_ic);
+    e.jmp(backend->dispatch_dynamic);
+  }
+
   {
     /* called after a static branch instruction stores the next pc to the
        context. the thunk calls jit_add_edge which adds an edge between the
@@ -116,19 +239,6 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.jmp(backend->dispatch_dynamic);
   }
 
-  {
-    /* default cache entry for all blocks. compiles the desired pc before
-       jumping to the block through the dynamic dispatch thunk */
-    e.align(32);
-
-    backend->dispatch_compile = e.getCurr<void *>();
-
-    e.mov(arg0, (uint64_t)jit);
-    e.mov(arg1, e.dword[guestctx + jit->guest->offset_pc]);
-    e.call(&jit_compile_block);
-    e.jmp(backend->dispatch_dynamic);
-  }
-
   {
     /* processes the pending interrupt request, and then jumps to the new pc
        through the dynamic dispatch thunk */
@@ -195,6 +305,45 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.ret();
   }
 
+  {
+    /* default cache entry for all blocks. compiles the desired pc before
+       jumping to the block through the dynamic dispatch thunk. when compiling
+       in the background, the block is instead interpreted, so the remaining
+       cycles and pending interrupts need to be checked like in a block's
+       prologue before dispatching to the next pc */
+    e.align(32);
+
+    backend->dispatch_compile = e.getCurr<void *>();
+
+    e.mov(arg0, (uint64_t)jit);
+    e.mov(arg1, e.dword[guestctx + jit->guest->offset_pc]);
+    e.call(&jit_compile_block);
+
+    e.mov(e.eax, e.dword[guestctx + jit->guest->offset_cycles]);
+    e.test(e.eax, e.eax);
+    e.js(backend->dispatch_exit);
+
+    e.mov(e.rax, e.qword[guestctx + jit->guest->offset_interrupts]);
+    e.test(e.rax, e.rax);
+    e.jnz(backend->dispatch_interrupt);
+
+    e.jmp(backend->dispatch_dynamic);
+  }
+
+  {
+    /* called from a block's prologue once it's been ran enough times to be
+       promoted. the block is invalidated before dispatching to the same pc
+       again, so it gets recompiled at the next tier */
+    e.align(32);
+
+    backend->dispatch_promote = e.getCurr<void *>();
+
+    e.mov(arg0, (uint64_t)jit);
+    e.mov(arg1, e.dword[guestctx + jit->guest->offset_pc]);
+    e.call(&jit_promote_block);
+    e.jmp(backend->dispatch_dynamic);
+  }
+
   /* reset cache entries to point to the new compile thunk */
   for (int i = 0; i < backend->cache_size; i++) {
     backend->cache[i] = backend->dispatch_compile;
@@ -202,6 +351,7 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
 }
 
 void x64_dispatch_shutdown(struct x64_backend *backend) {
+  free(backend->predict);
   free(backend->cache);
 }
 
@@ -213,4 +363,19 @@ void x64_dispatch_init(struct x64_backend *backend) {
   backend->cache_shift = ctz32(jit->guest->addr_mask);
   backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
   backend->cache = (void **)malloc(backend->cache_size * sizeof(void *));
+
+  /* initialize the return address stack and inline caches with entries no
+     branch can match */
+  backend->predict =
+      (struct x64_predict *)calloc(1, sizeof(struct x64_predict));
+
+  for (int i = 0; i < X64_RAS_SIZE; i++) {
+    backend->predict->ras[i].guest_addr = 1;
+    backend->predict->ras[i].code = backend->cache;
+  }
+
+  for (int i = 0; i < X64_IC_SIZE; i++) {
+    backend->predict->ic[i].guest_addr = 1;
+    backend->predict->ic[i].code = backend->cache;
+  }
 }
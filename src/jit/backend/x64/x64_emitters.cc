@@ -92,10 +92,21 @@ EMITTER(LOAD_GUEST, CONSTRAINTS(NONE, IMM_I32)) {
     guest->lookup(guest->space, addr->i32, &ptr, &userdata, &read, NULL,
                   &offset);
 
+    /* registers without side effects are read straight from their backing
+       memory. the callbacks return the entire register, so a narrower load
+       from its start is equivalent */
+    void *storage = NULL;
+    if (!ptr && guest->lookup_storage && RES->type <= VALUE_I32) {
+      storage = guest->lookup_storage(guest->space, addr->i32, 0);
+    }
+
     if (ptr) {
       /* FIXME couldn't we directly load from guestmem + addr */
       e.mov(e.eax, addr->i32);
       x64_backend_load_mem(backend, RES, e.rax + guestmem);
+    } else if (storage) {
+      e.mov(e.rax, reinterpret_cast<uint64_t>(storage));
+      x64_backend_load_mem(backend, RES, e.rax);
     } else {
       int data_size = ir_type_size(RES->type);
       uint32_t data_mask = (1 << (data_size * 8)) - 1;
@@ -151,10 +162,20 @@ EMITTER(STORE_GUEST, CONSTRAINTS(NONE, IMM_I32, NONE)) {
     guest->lookup(guest->space, addr->i32, &ptr, &userdata, NULL, &write,
                   &offset);
 
+    /* the callbacks overwrite the entire register, so only 32-bit stores can
+       be written straight to the backing memory */
+    void *storage = NULL;
+    if (!ptr && guest->lookup_storage && data->type == VALUE_I32) {
+      storage = guest->lookup_storage(guest->space, addr->i32, 1);
+    }
+
     if (ptr) {
       /* FIXME couldn't we directly load from guestmem + addr */
       e.mov(e.eax, addr->i32);
       x64_backend_store_mem(backend, e.rax + guestmem, data);
+    } else if (storage) {
+      e.mov(e.rax, reinterpret_cast<uint64_t>(storage));
+      x64_backend_store_mem(backend, e.rax, data);
     } else {
       Xbyak::Reg rb = x64_backend_reg(backend, data);
       int data_size = ir_type_size(data->type);
@@ -381,25 +402,285 @@ EMITTER(FTRUNC, CONSTRAINTS(NONE, NONE)) {
   e.cvtsd2ss(rd, ra);
 }
 
+/* condition codes shared by the setcc / jcc / cmovcc lowering of each
+   comparison. they're ordered in pairs such that flipping the low bit inverts
+   the condition */
+enum x64_cond {
+  X64_COND_E,
+  X64_COND_NE,
+  X64_COND_L,
+  X64_COND_GE,
+  X64_COND_LE,
+  X64_COND_G,
+  X64_COND_B,
+  X64_COND_AE,
+  X64_COND_BE,
+  X64_COND_A,
+};
+
+#define X64_MAX_FUSE_DISTANCE 16
+
+static enum x64_cond x64_cmp_cond(const struct ir_instr *cmp) {
+  int fcmp = cmp->op == OP_FCMP;
+
+  switch ((enum ir_cmp)cmp->arg[2]->i32) {
+    case CMP_EQ:
+      return X64_COND_E;
+    case CMP_NE:
+      return X64_COND_NE;
+    case CMP_SGE:
+      return fcmp ? X64_COND_AE : X64_COND_GE;
+    case CMP_SGT:
+      return fcmp ? X64_COND_A : X64_COND_G;
+    case CMP_SLE:
+      return fcmp ? X64_COND_BE : X64_COND_LE;
+    case CMP_SLT:
+      return fcmp ? X64_COND_B : X64_COND_L;
+    case CMP_UGE:
+      return X64_COND_AE;
+    case CMP_UGT:
+      return X64_COND_A;
+    case CMP_ULE:
+      return X64_COND_BE;
+    case CMP_ULT:
+      return X64_COND_B;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+static void x64_emit_setcc(Xbyak::CodeGenerator &e, enum x64_cond cond,
+                           const Xbyak::Reg &rd) {
+  switch (cond) {
+    case X64_COND_E:
+      e.sete(rd);
+      break;
+    case X64_COND_NE:
+      e.setne(rd);
+      break;
+    case X64_COND_L:
+      e.setl(rd);
+      break;
+    case X64_COND_GE:
+      e.setge(rd);
+      break;
+    case X64_COND_LE:
+      e.setle(rd);
+      break;
+    case X64_COND_G:
+      e.setg(rd);
+      break;
+    case X64_COND_B:
+      e.setb(rd);
+      break;
+    case X64_COND_AE:
+      e.setae(rd);
+      break;
+    case X64_COND_BE:
+      e.setbe(rd);
+      break;
+    case X64_COND_A:
+      e.seta(rd);
+      break;
+  }
+}
+
+static void x64_emit_jcc(Xbyak::CodeGenerator &e, enum x64_cond cond,
+                         const char *label) {
+  switch (cond) {
+    case X64_COND_E:
+      e.je(label);
+      break;
+    case X64_COND_NE:
+      e.jne(label);
+      break;
+    case X64_COND_L:
+      e.jl(label);
+      break;
+    case X64_COND_GE:
+      e.jge(label);
+      break;
+    case X64_COND_LE:
+      e.jle(label);
+      break;
+    case X64_COND_G:
+      e.jg(label);
+      break;
+    case X64_COND_B:
+      e.jb(label);
+      break;
+    case X64_COND_AE:
+      e.jae(label);
+      break;
+    case X64_COND_BE:
+      e.jbe(label);
+      break;
+    case X64_COND_A:
+      e.ja(label);
+      break;
+  }
+}
+
+static void x64_emit_cmovcc(Xbyak::CodeGenerator &e, enum x64_cond cond,
+                            const Xbyak::Reg &rd, const Xbyak::Reg &rs) {
+  switch (cond) {
+    case X64_COND_E:
+      e.cmove(rd, rs);
+      break;
+    case X64_COND_NE:
+      e.cmovne(rd, rs);
+      break;
+    case X64_COND_L:
+      e.cmovl(rd, rs);
+      break;
+    case X64_COND_GE:
+      e.cmovge(rd, rs);
+      break;
+    case X64_COND_LE:
+      e.cmovle(rd, rs);
+      break;
+    case X64_COND_G:
+      e.cmovg(rd, rs);
+      break;
+    case X64_COND_B:
+      e.cmovb(rd, rs);
+      break;
+    case X64_COND_AE:
+      e.cmovae(rd, rs);
+      break;
+    case X64_COND_BE:
+      e.cmovbe(rd, rs);
+      break;
+    case X64_COND_A:
+      e.cmova(rd, rs);
+      break;
+  }
+}
+
+static int x64_cond_arg(const struct ir_instr *instr) {
+  switch (instr->op) {
+    case OP_SELECT:
+      return 2;
+    case OP_BRANCH_TRUE:
+    case OP_BRANCH_FALSE:
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+static const struct ir_instr *x64_cond_cmp(const struct ir_value *cond) {
+  if (ir_is_constant(cond)) {
+    return NULL;
+  }
+
+  const struct ir_instr *def = cond->def;
+
+  /* look through the zero extension of the i8 result to a larger type */
+  if (def->op == OP_ZEXT && !ir_is_constant(def->arg[0])) {
+    def = def->arg[0]->def;
+  }
+
+  if (def->op != OP_CMP && def->op != OP_FCMP) {
+    return NULL;
+  }
+
+  return def;
+}
+
+static int x64_preserves_flags(const struct ir_instr *instr,
+                               const struct ir_instr *cmp) {
+  switch (instr->op) {
+    /* these are all lowered to plain movs */
+    case OP_LOAD_CONTEXT:
+    case OP_STORE_CONTEXT:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_ZEXT:
+    case OP_COPY:
+      return 1;
+    /* selects consuming the same comparison don't test their condition */
+    case OP_SELECT:
+      return x64_cond_cmp(instr->arg[2]) == cmp;
+    default:
+      return 0;
+  }
+}
+
+/* find the comparison producing a conditional instruction's condition, if the
+   flags it set are still live when the conditional instruction is emitted. in
+   this case, the flags can be consumed directly with a jcc / cmovcc instead of
+   testing the materialized result of the comparison */
+static const struct ir_instr *x64_fused_cmp(const struct ir_instr *instr,
+                                            const struct ir_value *cond) {
+  const struct ir_instr *cmp = x64_cond_cmp(cond);
+
+  if (!cmp) {
+    return NULL;
+  }
+
+  const struct ir_instr *it = list_prev_entry(instr, struct ir_instr, it);
+
+  for (int i = 0; it && i < X64_MAX_FUSE_DISTANCE; i++) {
+    if (it == cmp) {
+      return cmp;
+    }
+
+    if (!x64_preserves_flags(it, cmp)) {
+      break;
+    }
+
+    it = list_prev_entry(it, struct ir_instr, it);
+  }
+
+  return NULL;
+}
+
+static int x64_cmp_fully_fused(const struct ir_instr *cmp) {
+  /* the result only needs to be materialized if it has a user which isn't
+     going to consume the flags directly */
+  list_for_each_entry(use, &cmp->result->uses, struct ir_use, it) {
+    const struct ir_instr *user = use->instr;
+    int n = x64_cond_arg(user);
+
+    if (n < 0 || use->parg != &user->arg[n]) {
+      return 0;
+    }
+
+    if (x64_fused_cmp(user, user->arg[n]) != cmp) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
 EMITTER(SELECT, CONSTRAINTS(NONE, NONE, NONE, NONE)) {
   Xbyak::Reg rd = RES_REG;
   Xbyak::Reg t = ARG0_REG;
   Xbyak::Reg f = ARG1_REG;
-  Xbyak::Reg cond = ARG2_REG;
 
   /* convert result to Reg32e to please xbyak */
   CHECK_GE(rd.getBit(), 32);
   Xbyak::Reg32e rd_32e(rd.getIdx(), rd.getBit());
 
-  e.test(cond, cond);
+  enum x64_cond cond = X64_COND_NE;
+  const struct ir_instr *cmp = x64_fused_cmp(instr, ARG2);
+
+  if (cmp) {
+    cond = x64_cmp_cond(cmp);
+  } else {
+    Xbyak::Reg c = ARG2_REG;
+    e.test(c, c);
+  }
+
   if (rd_32e != t) {
-    e.cmovnz(rd_32e, t);
+    x64_emit_cmovcc(e, cond, rd_32e, t);
   }
-  e.cmovz(rd_32e, f);
+  x64_emit_cmovcc(e, (enum x64_cond)(cond ^ 1), rd_32e, f);
 }
 
 EMITTER(CMP, CONSTRAINTS(NONE, NONE, IMM_I32, IMM_I32)) {
-  Xbyak::Reg rd = RES_REG;
   Xbyak::Reg ra = ARG0_REG;
 
   if (ir_is_constant(ARG1)) {
@@ -409,45 +690,15 @@ EMITTER(CMP, CONSTRAINTS(NONE, NONE, IMM_I32, IMM_I32)) {
     e.cmp(ra, rb);
   }
 
-  enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
-  switch (cmp) {
-    case CMP_EQ:
-      e.sete(rd);
-      break;
-    case CMP_NE:
-      e.setne(rd);
-      break;
-    case CMP_SGE:
-      e.setge(rd);
-      break;
-    case CMP_SGT:
-      e.setg(rd);
-      break;
-    case CMP_UGE:
-      e.setae(rd);
-      break;
-    case CMP_UGT:
-      e.seta(rd);
-      break;
-    case CMP_SLE:
-      e.setle(rd);
-      break;
-    case CMP_SLT:
-      e.setl(rd);
-      break;
-    case CMP_ULE:
-      e.setbe(rd);
-      break;
-    case CMP_ULT:
-      e.setb(rd);
-      break;
-    default:
-      LOG_FATAL("unexpected comparison type");
+  if (x64_cmp_fully_fused(instr)) {
+    return;
   }
+
+  Xbyak::Reg rd = RES_REG;
+  x64_emit_setcc(e, x64_cmp_cond(instr), rd);
 }
 
 EMITTER(FCMP, CONSTRAINTS(NONE, NONE, NONE, IMM_I32)) {
-  Xbyak::Reg rd = RES_REG;
   Xbyak::Xmm ra = ARG0_XMM;
   Xbyak::Xmm rb = ARG1_XMM;
 
@@ -457,29 +708,12 @@ EMITTER(FCMP, CONSTRAINTS(NONE, NONE, NONE, IMM_I32)) {
     e.comisd(ra, rb);
   }
 
-  enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
-  switch (cmp) {
-    case CMP_EQ:
-      e.sete(rd);
-      break;
-    case CMP_NE:
-      e.setne(rd);
-      break;
-    case CMP_SGE:
-      e.setae(rd);
-      break;
-    case CMP_SGT:
-      e.seta(rd);
-      break;
-    case CMP_SLE:
-      e.setbe(rd);
-      break;
-    case CMP_SLT:
-      e.setb(rd);
-      break;
-    default:
-      LOG_FATAL("unexpected comparison type");
+  if (x64_cmp_fully_fused(instr)) {
+    return;
   }
+
+  Xbyak::Reg rd = RES_REG;
+  x64_emit_setcc(e, x64_cmp_cond(instr), rd);
 }
 
 EMITTER(ADD, CONSTRAINTS(RES_HAS_ARG0, NONE, IMM_I32)) {
@@ -922,8 +1156,13 @@ EMITTER(LSHD, CONSTRAINTS(RES_HAS_ARG0)) {
   e.outLocalLabel();
 }
 
-EMITTER(BRANCH, CONSTRAINTS(NONE, IMM_I32)) {
+EMITTER(BRANCH, CONSTRAINTS(NONE, IMM_I32, IMM_I32, IMM_I32)) {
   struct jit_guest *guest = backend->base.jit->guest;
+  int type = ARG1 ? ARG1->i32 : BRANCH_JUMP;
+
+  if (type == BRANCH_CALL) {
+    x64_dispatch_emit_call(backend, ARG2->i32);
+  }
 
   if (ir_is_constant(ARG0)) {
     uint32_t addr = ARG0->i32;
@@ -932,7 +1171,12 @@ EMITTER(BRANCH, CONSTRAINTS(NONE, IMM_I32)) {
   } else {
     Xbyak::Reg addr = ARG0_REG;
     e.mov(e.dword[guestctx + guest->offset_pc], addr);
-    e.jmp(backend->dispatch_dynamic);
+
+    if (type == BRANCH_RETURN) {
+      x64_dispatch_emit_return(backend, addr);
+    } else {
+      x64_dispatch_emit_indirect(backend, addr);
+    }
   }
 }
 
@@ -941,9 +1185,15 @@ EMITTER(BRANCH_FALSE, CONSTRAINTS(NONE, IMM_I32)) {
 
   e.inLocalLabel();
 
-  Xbyak::Reg cond = ARG1_REG;
-  e.test(cond, cond);
-  e.jnz(".next");
+  const struct ir_instr *cmp = x64_fused_cmp(instr, ARG1);
+
+  if (cmp) {
+    x64_emit_jcc(e, x64_cmp_cond(cmp), ".next");
+  } else {
+    Xbyak::Reg cond = ARG1_REG;
+    e.test(cond, cond);
+    e.jnz(".next");
+  }
 
   if (ir_is_constant(ARG0)) {
     uint32_t addr = ARG0->i32;
@@ -965,9 +1215,16 @@ EMITTER(BRANCH_TRUE, CONSTRAINTS(NONE, IMM_I32)) {
 
   e.inLocalLabel();
 
-  const Xbyak::Reg cond = ARG1_REG;
-  e.test(cond, cond);
-  e.jz(".next");
+  const struct ir_instr *cmp = x64_fused_cmp(instr, ARG1);
+
+  if (cmp) {
+    enum x64_cond cond = x64_cmp_cond(cmp);
+    x64_emit_jcc(e, (enum x64_cond)(cond ^ 1), ".next");
+  } else {
+    const Xbyak::Reg cond = ARG1_REG;
+    e.test(cond, cond);
+    e.jz(".next");
+  }
 
   if (ir_is_constant(ARG0)) {
     uint32_t addr = ARG0->i32;
@@ -20,22 +20,83 @@ enum xmm_constant {
   NUM_XMM_CONST,
 };
 
+/* number of entries in the return address stack, must be a power of two */
+#define X64_RAS_SIZE 16
+
+/* each call pushes the address being returned to, along with the code cache
+   entry it maps to. the entry is stored instead of the host code itself so the
+   prediction remains valid when the block is invalidated or recompiled */
+struct x64_ras_entry {
+  uint32_t guest_addr;
+  void **code;
+};
+
+/* number of inline cache entries, must be a power of two. entries are handed
+   out to dynamic branch sites in order, wrapping around once exhausted. sites
+   which end up sharing an entry only hurt each other's predictions */
+#define X64_IC_SIZE 4096
+
+/* inline cache for each dynamic branch, holding the destination the branch
+   last went to */
+struct x64_inline_cache {
+  uint32_t guest_addr;
+  void **code;
+};
+
+/* state for predicting the destination of dynamic branches. the generated code
+   writes to this frequently, so it's kept outside of the code buffer where
+   writes would be treated as self-modifying code by the processor */
+struct x64_predict {
+  struct x64_ras_entry ras[X64_RAS_SIZE];
+  uint32_t ras_top;
+
+  struct x64_inline_cache ic[X64_IC_SIZE];
+  uint32_t ic_next;
+
+  /* hit / miss counts, flushed to the profiler after each run */
+  uint64_t ras_hits;
+  uint64_t ras_misses;
+  uint64_t ic_hits;
+  uint64_t ic_misses;
+};
+
+/* code generator whose limit can be moved, so code is only ever emitted into
+   the region of the code buffer currently being filled */
+struct x64_codegen : public Xbyak::CodeGenerator {
+  x64_codegen(size_t size, void *code) : Xbyak::CodeGenerator(size, code) {}
+
+  void set_limit(size_t limit) {
+    maxSize_ = limit;
+  }
+};
+
 struct x64_backend {
   struct jit_backend base;
 
+  /* code buffer, divided into regions which are filled in order */
+  uint8_t *code;
+  int code_size;
+  int num_regions;
+  int region;
+
   /* code cache */
   uint32_t cache_mask;
   int cache_shift;
   int cache_size;
   void **cache;
 
+  /* dynamic branch prediction */
+  struct x64_predict *predict;
+
   /* codegen state */
-  Xbyak::CodeGenerator *codegen;
+  struct x64_codegen *codegen;
   int use_avx;
   Xbyak::Label xmm_const[NUM_XMM_CONST];
   void *dispatch_dynamic;
+  void *dispatch_ic_miss;
   void *dispatch_static;
   void *dispatch_compile;
+  void *dispatch_promote;
   void *dispatch_interrupt;
   void (*dispatch_enter)(int32_t);
   void *dispatch_exit;
@@ -50,6 +111,7 @@ struct x64_backend {
  * backend functionality used by emitters
  */
 #define X64_THUNK_SIZE 1024
+#define X64_REGION_SIZE 0x100000
 
 #if PLATFORM_WINDOWS
 #define X64_STACK_SHADOW_SPACE 32
@@ -101,6 +163,11 @@ void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr);
 void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst);
 void x64_dispatch_restore_edge(struct jit_backend *base, void *code,
                                uint32_t dst);
+void x64_dispatch_emit_call(struct x64_backend *backend, uint32_t ret_addr);
+void x64_dispatch_emit_return(struct x64_backend *backend,
+                              const Xbyak::Reg &dst);
+void x64_dispatch_emit_indirect(struct x64_backend *backend,
+                                const Xbyak::Reg &dst);
 
 /*
  * emitters
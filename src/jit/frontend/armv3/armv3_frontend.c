@@ -3,6 +3,7 @@
 #include "jit/frontend/armv3/armv3_disasm.h"
 #include "jit/frontend/armv3/armv3_fallback.h"
 #include "jit/frontend/armv3/armv3_guest.h"
+#include "jit/frontend/armv3/armv3_translate.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
 
@@ -44,6 +45,23 @@ static void armv3_analyze_block(const struct armv3_guest *guest,
   }
 }
 
+static int armv3_frontend_translate_flags(struct jit_frontend *base,
+                                          const struct jit_block *block) {
+  int flags = 0;
+  if (block->fastmem) {
+    flags |= ARMV3_FASTMEM;
+  }
+  return flags;
+}
+
+static void armv3_frontend_analyze_code(struct jit_frontend *base,
+                                          struct jit_block *block) {
+  struct armv3_frontend *frontend = (struct armv3_frontend *)base;
+  struct armv3_guest *guest = (struct armv3_guest *)frontend->jit->guest;
+
+  armv3_analyze_block(guest, block);
+}
+
 static const struct jit_opdef *armv3_frontend_lookup_op(
     struct jit_frontend *base, const void *instr) {
   return armv3_get_opdef(*(const uint32_t *)instr);
@@ -67,21 +85,73 @@ static void armv3_frontend_dump_code(struct jit_frontend *base,
   }
 }
 
+static int armv3_frontend_decode_code(struct jit_frontend *base,
+                                      const struct jit_block *block,
+                                      struct jit_instr *instrs) {
+  struct armv3_frontend *frontend = (struct armv3_frontend *)base;
+  struct jit_guest *guest = frontend->jit->guest;
+
+  int n = 0;
+
+  for (int offset = 0; offset < block->guest_size; offset += 4) {
+    uint32_t addr = block->guest_addr + offset;
+    uint32_t data = guest->r32(guest->space, addr);
+    struct jit_opdef *def = armv3_get_opdef(data);
+    struct jit_instr *instr = &instrs[n++];
+
+    instr->fallback = def->fallback;
+    instr->addr = addr;
+    instr->data = data;
+    instr->cycles = 12;
+  }
+
+  return n;
+}
+
 static void armv3_frontend_translate_code(struct jit_frontend *base,
                                           struct jit_block *block,
                                           struct ir *ir) {
   struct armv3_frontend *frontend = (struct armv3_frontend *)base;
   struct armv3_guest *guest = (struct armv3_guest *)frontend->jit->guest;
 
+  int flags = armv3_frontend_translate_flags(base, block);
+
   armv3_analyze_block(guest, block);
 
+  /* translated instructions don't maintain the pc as they go like the
+     fallbacks do, it's only written out before falling back and at the end of
+     the block */
+  int native = 0;
+
   for (int offset = 0; offset < block->guest_size; offset += 4) {
     uint32_t addr = block->guest_addr + offset;
     uint32_t data = guest->r32(guest->space, addr);
+    union armv3_instr i = {data};
     struct jit_opdef *def = armv3_get_opdef(data);
+    armv3_translate_cb cb = armv3_get_translator(data);
+
+    if (cb && cb(guest, ir, flags, addr, i)) {
+      native = 1;
+      continue;
+    }
+
+    if (native) {
+      ir_store_context(ir, offsetof(struct armv3_context, r[15]),
+                       ir_alloc_i32(ir, addr));
+      native = 0;
+    }
 
     ir_fallback(ir, def->fallback, addr, data);
   }
+
+  /* branch translators end the block themselves */
+  uint32_t last_addr = block->guest_addr + block->guest_size - 4;
+  uint32_t last_data = guest->r32(guest->space, last_addr);
+  struct jit_opdef *last_def = armv3_get_opdef(last_data);
+
+  if (native && !(last_def->flags & FLAG_SET_PC)) {
+    ir_branch(ir, ir_alloc_i32(ir, last_addr + 4));
+  }
 }
 
 void armv3_frontend_destroy(struct jit_frontend *base) {
@@ -97,8 +167,11 @@ struct jit_frontend *armv3_frontend_create() {
 
   frontend->init = &armv3_frontend_init;
   frontend->destroy = &armv3_frontend_destroy;
+  frontend->analyze_code = &armv3_frontend_analyze_code;
   frontend->translate_code = &armv3_frontend_translate_code;
+  frontend->translate_flags = &armv3_frontend_translate_flags;
   frontend->dump_code = &armv3_frontend_dump_code;
+  frontend->decode_code = &armv3_frontend_decode_code;
   frontend->lookup_op = &armv3_frontend_lookup_op;
 
   return (struct jit_frontend *)frontend;
@@ -5,6 +5,7 @@
 
 enum armv3_block_flags {
   PC_SET = 0x1,
+  ARMV3_FASTMEM = 0x2,
 };
 
 struct jit_frontend *armv3_frontend_create();
@@ -0,0 +1,684 @@
+#include "jit/frontend/armv3/armv3_translate.h"
+#include "core/assert.h"
+#include "core/math.h"
+#include "jit/frontend/armv3/armv3_context.h"
+#include "jit/frontend/armv3/armv3_frontend.h"
+#include "jit/frontend/armv3/armv3_guest.h"
+#include "jit/ir/ir.h"
+
+/* the translators mirror the fallbacks in armv3_fallback.c, including their
+   quirks, so code behaves the same whether it's compiled or interpreted */
+
+#define NZCV_MASK (N_MASK | Z_MASK | C_MASK | V_MASK)
+
+static struct ir_value *load_guest(struct ir *ir, int flags,
+                                   struct ir_value *addr, enum ir_type type) {
+  if (flags & ARMV3_FASTMEM) {
+    return ir_load_fast(ir, addr, type);
+  }
+  return ir_load_guest(ir, addr, type);
+}
+
+static void store_guest(struct ir *ir, int flags, struct ir_value *addr,
+                        struct ir_value *v) {
+  if (flags & ARMV3_FASTMEM) {
+    ir_store_fast(ir, addr, v);
+    return;
+  }
+  ir_store_guest(ir, addr, v);
+}
+
+static struct ir_value *load_reg(struct ir *ir, int n) {
+  size_t offset = offsetof(struct armv3_context, r) + n * sizeof(uint32_t);
+  return ir_load_context(ir, offset, VALUE_I32);
+}
+
+static void store_reg(struct ir *ir, int n, struct ir_value *v) {
+  size_t offset = offsetof(struct armv3_context, r) + n * sizeof(uint32_t);
+  ir_store_context(ir, offset, v);
+}
+
+static struct ir_value *load_rn(struct ir *ir, uint32_t addr, int rn) {
+  /* account for instruction prefetching if loading the pc */
+  if (rn == 15) {
+    return ir_alloc_i32(ir, addr + 8);
+  }
+  return load_reg(ir, rn);
+}
+
+static struct ir_value *load_rd(struct ir *ir, uint32_t addr, int rd) {
+  /* account for instruction prefetching if loading the pc */
+  if (rd == 15) {
+    return ir_alloc_i32(ir, addr + 12);
+  }
+  return load_reg(ir, rd);
+}
+
+/* evaluate a condition code against the cpsr, returning an i8 which is
+   non-zero when the condition passes */
+static struct ir_value *load_cond(struct ir *ir, uint32_t cond) {
+  struct ir_value *cpsr = load_reg(ir, CPSR);
+  struct ir_value *zero = ir_alloc_i32(ir, 0);
+
+  /* n != v, with the result in the n bit */
+  struct ir_value *nv = ir_and(ir, ir_xor(ir, cpsr, ir_shli(ir, cpsr, 3)),
+                               ir_alloc_i32(ir, N_MASK));
+
+  switch (cond) {
+    case COND_EQ:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, Z_MASK)), zero);
+    case COND_NE:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, Z_MASK)), zero);
+    case COND_CS:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK)), zero);
+    case COND_CC:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK)), zero);
+    case COND_MI:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, N_MASK)), zero);
+    case COND_PL:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, N_MASK)), zero);
+    case COND_VS:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, V_MASK)), zero);
+    case COND_VC:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, V_MASK)), zero);
+    case COND_HI:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK | Z_MASK)),
+                       ir_alloc_i32(ir, C_MASK));
+    case COND_LS:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK | Z_MASK)),
+                       ir_alloc_i32(ir, C_MASK));
+    case COND_GE:
+      return ir_cmp_eq(ir, nv, zero);
+    case COND_LT:
+      return ir_cmp_ne(ir, nv, zero);
+    case COND_GT:
+      return ir_cmp_eq(
+          ir, ir_or(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, Z_MASK)), nv), zero);
+    case COND_LE:
+      return ir_cmp_ne(
+          ir, ir_or(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, Z_MASK)), nv), zero);
+    default:
+      LOG_FATAL("unexpected condition code %d", cond);
+      return NULL;
+  }
+}
+
+/* conditionally executed instructions compute their results unconditionally,
+   selecting between the new and old values once done */
+static void store_reg_cond(struct ir *ir, struct ir_value *cond, int n,
+                           struct ir_value *v) {
+  if (cond) {
+    v = ir_select(ir, cond, v, load_reg(ir, n));
+  }
+  store_reg(ir, n, v);
+}
+
+/* move bit from of v to bit to, masking off the rest */
+static struct ir_value *move_bit(struct ir *ir, struct ir_value *v, int from,
+                                 int to) {
+  if (from > to) {
+    v = ir_lshri(ir, v, from - to);
+  } else if (from < to) {
+    v = ir_shli(ir, v, to - from);
+  }
+  return ir_and(ir, v, ir_alloc_i32(ir, 1u << to));
+}
+
+static struct ir_value *carry_from_bit(struct ir *ir, struct ir_value *v,
+                                       int n) {
+  return move_bit(ir, v, n, C_BIT);
+}
+
+static struct ir_value *flags_nz(struct ir *ir, struct ir_value *res) {
+  struct ir_value *n = ir_and(ir, res, ir_alloc_i32(ir, N_MASK));
+  struct ir_value *z = ir_zext(ir, ir_cmp_eq(ir, res, ir_alloc_i32(ir, 0)),
+                               VALUE_I32);
+  return ir_or(ir, n, ir_shli(ir, z, Z_BIT));
+}
+
+static struct ir_value *flags_logical(struct ir *ir, struct ir_value *cpsr,
+                                      struct ir_value *res,
+                                      struct ir_value *carry) {
+  /* v is cleared, the same as the fallbacks */
+  cpsr = ir_and(ir, cpsr, ir_alloc_i32(ir, ~NZCV_MASK));
+  cpsr = ir_or(ir, cpsr, flags_nz(ir, res));
+  return ir_or(ir, cpsr, carry);
+}
+
+static struct ir_value *flags_sub(struct ir *ir, struct ir_value *cpsr,
+                                  struct ir_value *lhs, struct ir_value *rhs,
+                                  struct ir_value *res) {
+  /* c = ~((~lhs & rhs) | ((~lhs | rhs) & res)) >> 31 */
+  struct ir_value *not_lhs = ir_not(ir, lhs);
+  struct ir_value *c = ir_not(
+      ir, ir_or(ir, ir_and(ir, not_lhs, rhs),
+                ir_and(ir, ir_or(ir, not_lhs, rhs), res)));
+
+  /* v = ((lhs ^ rhs) & (res ^ lhs)) >> 31 */
+  struct ir_value *v =
+      ir_and(ir, ir_xor(ir, lhs, rhs), ir_xor(ir, res, lhs));
+
+  cpsr = ir_and(ir, cpsr, ir_alloc_i32(ir, ~NZCV_MASK));
+  cpsr = ir_or(ir, cpsr, flags_nz(ir, res));
+  cpsr = ir_or(ir, cpsr, carry_from_bit(ir, c, 31));
+  cpsr = ir_or(ir, cpsr, move_bit(ir, v, 31, V_BIT));
+  return cpsr;
+}
+
+static struct ir_value *flags_add(struct ir *ir, struct ir_value *cpsr,
+                                  struct ir_value *lhs, struct ir_value *rhs,
+                                  struct ir_value *res) {
+  /* c = ((lhs & rhs) | ((lhs | rhs) & ~res)) >> 31 */
+  struct ir_value *c =
+      ir_or(ir, ir_and(ir, lhs, rhs),
+            ir_and(ir, ir_or(ir, lhs, rhs), ir_not(ir, res)));
+
+  /* v = ((res ^ lhs) & (res ^ rhs)) >> 31 */
+  struct ir_value *v =
+      ir_and(ir, ir_xor(ir, res, lhs), ir_xor(ir, res, rhs));
+
+  cpsr = ir_and(ir, cpsr, ir_alloc_i32(ir, ~NZCV_MASK));
+  cpsr = ir_or(ir, cpsr, flags_nz(ir, res));
+  cpsr = ir_or(ir, cpsr, carry_from_bit(ir, c, 31));
+  cpsr = ir_or(ir, cpsr, move_bit(ir, v, 31, V_BIT));
+  return cpsr;
+}
+
+/* shifts whose amount is specified by a register, as well as rrx, are left to
+   the fallbacks */
+static int can_translate_shift(uint32_t shift) {
+  enum armv3_shift_source src;
+  enum armv3_shift_type type;
+  uint32_t n;
+  armv3_disasm_shift(shift, &src, &type, &n);
+
+  return src == SHIFT_IMM && type != SHIFT_RRX;
+}
+
+/* translate an immediate shift of a register, returning the shifter's carry
+   out in the carry flag's position */
+static struct ir_value *translate_shift(struct ir *ir, uint32_t addr,
+                                        int rm, uint32_t shift,
+                                        struct ir_value **carry) {
+  enum armv3_shift_source src;
+  enum armv3_shift_type type;
+  uint32_t n;
+  armv3_disasm_shift(shift, &src, &type, &n);
+  CHECK_EQ(src, SHIFT_IMM);
+
+  struct ir_value *in = load_rn(ir, addr, rm);
+
+  if (!n) {
+    *carry = ir_and(ir, load_reg(ir, CPSR), ir_alloc_i32(ir, C_MASK));
+    return in;
+  }
+
+  switch (type) {
+    case SHIFT_LSL:
+      *carry = carry_from_bit(ir, in, 32 - n);
+      return ir_shli(ir, in, n);
+    case SHIFT_LSR:
+      *carry = carry_from_bit(ir, in, n - 1);
+      return n == 32 ? ir_alloc_i32(ir, 0) : ir_lshri(ir, in, n);
+    case SHIFT_ASR:
+      *carry = carry_from_bit(ir, in, n - 1);
+      return ir_ashri(ir, in, MIN(n, 31));
+    case SHIFT_ROR: {
+      struct ir_value *out =
+          ir_or(ir, ir_lshri(ir, in, n), ir_shli(ir, in, 32 - n));
+      *carry = carry_from_bit(ir, out, 31);
+      return out;
+    }
+    default:
+      LOG_FATAL("unexpected shift type %d", type);
+      return NULL;
+  }
+}
+
+/*
+ * branch and branch with link
+ */
+static int translate_branch(struct ir *ir, uint32_t addr, union armv3_instr i,
+                            int link) {
+  uint32_t cond = i.branch.cond;
+
+  if (cond == COND_NV) {
+    return 0;
+  }
+
+  uint32_t dest_addr = addr + 8 + armv3_disasm_offset(i.branch.offset);
+  uint32_t next_addr = addr + 4;
+
+  if (cond == COND_AL) {
+    if (link) {
+      store_reg(ir, 14, ir_alloc_i32(ir, next_addr));
+    }
+    ir_branch(ir, ir_alloc_i32(ir, dest_addr));
+    return 1;
+  }
+
+  struct ir_value *pass = load_cond(ir, cond);
+
+  if (link) {
+    store_reg_cond(ir, pass, 14, ir_alloc_i32(ir, next_addr));
+  }
+
+  ir_branch_true(ir, pass, ir_alloc_i32(ir, dest_addr));
+  ir_branch(ir, ir_alloc_i32(ir, next_addr));
+  return 1;
+}
+
+static int armv3_translate_B(struct armv3_guest *guest, struct ir *ir,
+                             int flags, uint32_t addr, union armv3_instr i) {
+  return translate_branch(ir, addr, i, 0);
+}
+
+static int armv3_translate_BL(struct armv3_guest *guest, struct ir *ir,
+                              int flags, uint32_t addr, union armv3_instr i) {
+  return translate_branch(ir, addr, i, 1);
+}
+
+/*
+ * data processing
+ */
+static int translate_data(struct ir *ir, uint32_t addr, union armv3_instr i,
+                          enum armv3_op op) {
+  uint32_t cond = i.data.cond;
+
+  /* writes to the pc end the block and possibly restore the cpsr, leave them
+     to the fallbacks */
+  if (cond == COND_NV || i.data.rd == 15) {
+    return 0;
+  }
+
+  if (!i.data.i && !can_translate_shift(i.data_reg.shift)) {
+    return 0;
+  }
+
+  struct ir_value *pass = NULL;
+  if (cond != COND_AL) {
+    pass = load_cond(ir, cond);
+  }
+
+  /* parse op2 */
+  struct ir_value *op2 = NULL;
+  struct ir_value *carry = NULL;
+
+  if (i.data.i) {
+    uint32_t n = i.data_imm.rot << 1;
+    uint32_t imm = i.data_imm.imm;
+
+    if (n) {
+      imm = (imm >> n) | (imm << (32 - n));
+      carry = ir_alloc_i32(ir, (imm & 0x80000000) ? C_MASK : 0);
+    } else {
+      carry = ir_and(ir, load_reg(ir, CPSR), ir_alloc_i32(ir, C_MASK));
+    }
+
+    op2 = ir_alloc_i32(ir, imm);
+  } else {
+    op2 = translate_shift(ir, addr, i.data_reg.rm, i.data_reg.shift, &carry);
+  }
+
+  struct ir_value *cpsr = load_reg(ir, CPSR);
+  struct ir_value *carry_in =
+      ir_lshri(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK)), C_BIT);
+  struct ir_value *lhs = NULL;
+  struct ir_value *rhs = NULL;
+  struct ir_value *res = NULL;
+  struct ir_value *flags = NULL;
+  int write_rd = 1;
+
+  switch (op) {
+    case ARMV3_OP_AND:
+    case ARMV3_OP_TST:
+      res = ir_and(ir, load_rn(ir, addr, i.data.rn), op2);
+      flags = flags_logical(ir, cpsr, res, carry);
+      write_rd = op != ARMV3_OP_TST;
+      break;
+    case ARMV3_OP_EOR:
+    case ARMV3_OP_TEQ:
+      res = ir_xor(ir, load_rn(ir, addr, i.data.rn), op2);
+      flags = flags_logical(ir, cpsr, res, carry);
+      write_rd = op != ARMV3_OP_TEQ;
+      break;
+    case ARMV3_OP_ORR:
+      res = ir_or(ir, load_rn(ir, addr, i.data.rn), op2);
+      flags = flags_logical(ir, cpsr, res, carry);
+      break;
+    case ARMV3_OP_BIC:
+      res = ir_and(ir, load_rn(ir, addr, i.data.rn), ir_not(ir, op2));
+      flags = flags_logical(ir, cpsr, res, carry);
+      break;
+    case ARMV3_OP_MOV:
+      res = op2;
+      flags = flags_logical(ir, cpsr, res, carry);
+      break;
+    case ARMV3_OP_MVN:
+      res = ir_not(ir, op2);
+      flags = flags_logical(ir, cpsr, res, carry);
+      break;
+    case ARMV3_OP_SUB:
+    case ARMV3_OP_CMP:
+      lhs = load_rn(ir, addr, i.data.rn);
+      rhs = op2;
+      res = ir_sub(ir, lhs, rhs);
+      flags = flags_sub(ir, cpsr, lhs, rhs, res);
+      write_rd = op != ARMV3_OP_CMP;
+      break;
+    case ARMV3_OP_RSB:
+      lhs = op2;
+      rhs = load_rn(ir, addr, i.data.rn);
+      res = ir_sub(ir, lhs, rhs);
+      flags = flags_sub(ir, cpsr, lhs, rhs, res);
+      break;
+    case ARMV3_OP_ADD:
+    case ARMV3_OP_CMN:
+      lhs = load_rn(ir, addr, i.data.rn);
+      rhs = op2;
+      res = ir_add(ir, lhs, rhs);
+      flags = flags_add(ir, cpsr, lhs, rhs, res);
+      write_rd = op != ARMV3_OP_CMN;
+      break;
+    case ARMV3_OP_ADC:
+      lhs = load_rn(ir, addr, i.data.rn);
+      rhs = op2;
+      res = ir_add(ir, ir_add(ir, lhs, rhs), carry_in);
+      flags = flags_add(ir, cpsr, lhs, rhs, res);
+      break;
+    case ARMV3_OP_SBC:
+      lhs = load_rn(ir, addr, i.data.rn);
+      rhs = op2;
+      res = ir_sub(ir, ir_add(ir, ir_sub(ir, lhs, rhs), carry_in),
+                   ir_alloc_i32(ir, 1));
+      flags = flags_sub(ir, cpsr, lhs, rhs, res);
+      break;
+    case ARMV3_OP_RSC:
+      lhs = op2;
+      rhs = load_rn(ir, addr, i.data.rn);
+      res = ir_sub(ir, ir_add(ir, ir_sub(ir, lhs, rhs), carry_in),
+                   ir_alloc_i32(ir, 1));
+      flags = flags_sub(ir, cpsr, lhs, rhs, res);
+      break;
+    default:
+      LOG_FATAL("unexpected data processing op %d", op);
+      break;
+  }
+
+  if (write_rd) {
+    store_reg_cond(ir, pass, i.data.rd, res);
+  }
+
+  if (i.data.s) {
+    store_reg_cond(ir, pass, CPSR, flags);
+  }
+
+  return 1;
+}
+
+#define DATA_INSTR(name)                                                   \
+  static int armv3_translate_##name(struct armv3_guest *guest,             \
+                                    struct ir *ir, int flags,              \
+                                    uint32_t addr, union armv3_instr i) {  \
+    return translate_data(ir, addr, i, ARMV3_OP_##name);                   \
+  }
+
+DATA_INSTR(AND)
+DATA_INSTR(EOR)
+DATA_INSTR(SUB)
+DATA_INSTR(RSB)
+DATA_INSTR(ADD)
+DATA_INSTR(ADC)
+DATA_INSTR(SBC)
+DATA_INSTR(RSC)
+DATA_INSTR(TST)
+DATA_INSTR(TEQ)
+DATA_INSTR(CMP)
+DATA_INSTR(CMN)
+DATA_INSTR(ORR)
+DATA_INSTR(MOV)
+DATA_INSTR(BIC)
+DATA_INSTR(MVN)
+
+/*
+ * multiply and multiply-accumulate
+ */
+static int translate_mul(struct ir *ir, union armv3_instr i, int accumulate) {
+  uint32_t cond = i.mul.cond;
+
+  /* the fallbacks read the pc directly from the context, which isn't kept up
+     to date by translated code */
+  if (cond == COND_NV || i.mul.rd == 15 || i.mul.rm == 15 || i.mul.rs == 15 ||
+      (accumulate && i.mul.rn == 15)) {
+    return 0;
+  }
+
+  struct ir_value *pass = NULL;
+  if (cond != COND_AL) {
+    pass = load_cond(ir, cond);
+  }
+
+  struct ir_value *res =
+      ir_umul(ir, load_reg(ir, i.mul.rm), load_reg(ir, i.mul.rs));
+
+  if (accumulate) {
+    res = ir_add(ir, res, load_reg(ir, i.mul.rn));
+  }
+
+  store_reg_cond(ir, pass, i.mul.rd, res);
+
+  if (i.mul.s) {
+    struct ir_value *cpsr = load_reg(ir, CPSR);
+    cpsr = ir_and(ir, cpsr, ir_alloc_i32(ir, ~(N_MASK | Z_MASK)));
+    cpsr = ir_or(ir, cpsr, flags_nz(ir, res));
+    store_reg_cond(ir, pass, CPSR, cpsr);
+  }
+
+  return 1;
+}
+
+static int armv3_translate_MUL(struct armv3_guest *guest, struct ir *ir,
+                               int flags, uint32_t addr, union armv3_instr i) {
+  return translate_mul(ir, i, 0);
+}
+
+static int armv3_translate_MLA(struct armv3_guest *guest, struct ir *ir,
+                               int flags, uint32_t addr, union armv3_instr i) {
+  return translate_mul(ir, i, 1);
+}
+
+/*
+ * single data transfer
+ */
+static int translate_memop(struct ir *ir, int flags, uint32_t addr,
+                           union armv3_instr i) {
+  int writeback = i.xfr.w || !i.xfr.p;
+
+  /* memory accesses can't be conditionally executed without branching around
+     them, leave conditional transfers to the fallbacks. in addition, loads to
+     the pc end the block and writing back to the pc is a branch */
+  if (i.xfr.cond != COND_AL || (i.xfr.l && i.xfr.rd == 15) ||
+      (writeback && i.xfr.rn == 15)) {
+    return 0;
+  }
+
+  if (i.xfr.i && !can_translate_shift(i.xfr_reg.shift)) {
+    return 0;
+  }
+
+  /* parse offset */
+  struct ir_value *offset = NULL;
+
+  if (i.xfr.i) {
+    struct ir_value *carry;
+    offset = translate_shift(ir, addr, i.xfr_reg.rm, i.xfr_reg.shift, &carry);
+  } else {
+    offset = ir_alloc_i32(ir, i.xfr_imm.imm);
+  }
+
+  struct ir_value *base = load_rn(ir, addr, i.xfr.rn);
+  struct ir_value *final =
+      i.xfr.u ? ir_add(ir, base, offset) : ir_sub(ir, base, offset);
+  struct ir_value *ea = i.xfr.p ? final : base;
+
+  /* writeback is applied in pipeline before memory is read. note,
+     post-increment mode always writes back */
+  if (writeback) {
+    store_reg(ir, i.xfr.rn, final);
+  }
+
+  if (i.xfr.l) {
+    struct ir_value *data = NULL;
+
+    if (i.xfr.b) {
+      data = ir_zext(ir, load_guest(ir, flags, ea, VALUE_I8), VALUE_I32);
+    } else {
+      data = load_guest(ir, flags, ea, VALUE_I32);
+    }
+
+    store_reg(ir, i.xfr.rd, data);
+  } else {
+    struct ir_value *data = load_rd(ir, addr, i.xfr.rd);
+
+    if (i.xfr.b) {
+      store_guest(ir, flags, ea, ir_trunc(ir, data, VALUE_I8));
+    } else {
+      store_guest(ir, flags, ea, data);
+    }
+  }
+
+  return 1;
+}
+
+static int armv3_translate_LDR(struct armv3_guest *guest, struct ir *ir,
+                               int flags, uint32_t addr, union armv3_instr i) {
+  return translate_memop(ir, flags, addr, i);
+}
+
+static int armv3_translate_STR(struct armv3_guest *guest, struct ir *ir,
+                               int flags, uint32_t addr, union armv3_instr i) {
+  return translate_memop(ir, flags, addr, i);
+}
+
+/*
+ * block data transfer
+ */
+static int can_translate_blk(union armv3_instr i) {
+  /* user bank transfers and mode restores are left to the fallbacks, as are
+     conditional transfers and transfers relative to the pc */
+  return i.blk.cond == COND_AL && !i.blk.s && i.blk.rn != 15 && i.blk.rlist;
+}
+
+static int armv3_translate_LDM(struct armv3_guest *guest, struct ir *ir,
+                               int flags, uint32_t addr, union armv3_instr i) {
+  /* loads to the pc end the block */
+  if (!can_translate_blk(i) || (i.blk.rlist & (1 << 15))) {
+    return 0;
+  }
+
+  struct ir_value *base = load_reg(ir, i.blk.rn);
+  int32_t size = popcnt32(i.blk.rlist) * 4;
+  int32_t step = i.blk.u ? 4 : -4;
+
+  /* writeback is applied in pipeline before memory is read */
+  if (i.blk.w) {
+    store_reg(ir, i.blk.rn,
+              ir_add(ir, base, ir_alloc_i32(ir, i.blk.u ? size : -size)));
+  }
+
+  int32_t offset = 0;
+
+  for (int bit = 0; bit < 16; bit++) {
+    int reg = i.blk.u ? bit : 15 - bit;
+
+    if (!(i.blk.rlist & (1 << reg))) {
+      continue;
+    }
+
+    /* pre-increment */
+    if (i.blk.p) {
+      offset += step;
+    }
+
+    struct ir_value *ea = ir_add(ir, base, ir_alloc_i32(ir, offset));
+    store_reg(ir, reg, load_guest(ir, flags, ea, VALUE_I32));
+
+    /* post-increment */
+    if (!i.blk.p) {
+      offset += step;
+    }
+  }
+
+  return 1;
+}
+
+static int armv3_translate_STM(struct armv3_guest *guest, struct ir *ir,
+                               int flags, uint32_t addr, union armv3_instr i) {
+  if (!can_translate_blk(i)) {
+    return 0;
+  }
+
+  struct ir_value *base = load_reg(ir, i.blk.rn);
+  int32_t size = popcnt32(i.blk.rlist) * 4;
+  int32_t step = i.blk.u ? 4 : -4;
+  int32_t offset = 0;
+  int wrote = 0;
+
+  for (int bit = 0; bit < 16; bit++) {
+    int reg = i.blk.u ? bit : 15 - bit;
+
+    if (!(i.blk.rlist & (1 << reg))) {
+      continue;
+    }
+
+    /* pre-increment */
+    if (i.blk.p) {
+      offset += step;
+    }
+
+    struct ir_value *ea = ir_add(ir, base, ir_alloc_i32(ir, offset));
+    store_guest(ir, flags, ea, load_rd(ir, addr, reg));
+
+    /* post-increment */
+    if (!i.blk.p) {
+      offset += step;
+    }
+
+    /* the base is written back after the first register is stored, see the
+       STM fallback */
+    if (i.blk.w && !wrote) {
+      store_reg(ir, i.blk.rn,
+                ir_add(ir, base, ir_alloc_i32(ir, i.blk.u ? size : -size)));
+      wrote = 1;
+    }
+  }
+
+  return 1;
+}
+
+armv3_translate_cb armv3_translators[NUM_ARMV3_OPS] = {
+    [ARMV3_OP_B] = &armv3_translate_B,
+    [ARMV3_OP_BL] = &armv3_translate_BL,
+    [ARMV3_OP_AND] = &armv3_translate_AND,
+    [ARMV3_OP_EOR] = &armv3_translate_EOR,
+    [ARMV3_OP_SUB] = &armv3_translate_SUB,
+    [ARMV3_OP_RSB] = &armv3_translate_RSB,
+    [ARMV3_OP_ADD] = &armv3_translate_ADD,
+    [ARMV3_OP_ADC] = &armv3_translate_ADC,
+    [ARMV3_OP_SBC] = &armv3_translate_SBC,
+    [ARMV3_OP_RSC] = &armv3_translate_RSC,
+    [ARMV3_OP_TST] = &armv3_translate_TST,
+    [ARMV3_OP_TEQ] = &armv3_translate_TEQ,
+    [ARMV3_OP_CMP] = &armv3_translate_CMP,
+    [ARMV3_OP_CMN] = &armv3_translate_CMN,
+    [ARMV3_OP_ORR] = &armv3_translate_ORR,
+    [ARMV3_OP_MOV] = &armv3_translate_MOV,
+    [ARMV3_OP_BIC] = &armv3_translate_BIC,
+    [ARMV3_OP_MVN] = &armv3_translate_MVN,
+    [ARMV3_OP_MUL] = &armv3_translate_MUL,
+    [ARMV3_OP_MLA] = &armv3_translate_MLA,
+    [ARMV3_OP_LDR] = &armv3_translate_LDR,
+    [ARMV3_OP_STR] = &armv3_translate_STR,
+    [ARMV3_OP_LDM] = &armv3_translate_LDM,
+    [ARMV3_OP_STM] = &armv3_translate_STM,
+};
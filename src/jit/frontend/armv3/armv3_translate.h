@@ -0,0 +1,21 @@
+#ifndef ARMV3_TRANSLATE_H
+#define ARMV3_TRANSLATE_H
+
+#include "jit/frontend/armv3/armv3_disasm.h"
+
+struct armv3_guest;
+struct ir;
+
+/* translators return 0 without emitting any ir when the particular form of
+   an instruction isn't supported, in which case the frontend falls back to
+   calling the interpreter for it */
+typedef int (*armv3_translate_cb)(struct armv3_guest *, struct ir *, int,
+                                  uint32_t, union armv3_instr);
+
+extern armv3_translate_cb armv3_translators[NUM_ARMV3_OPS];
+
+static inline armv3_translate_cb armv3_get_translator(uint32_t instr) {
+  return armv3_translators[armv3_get_op(instr)];
+}
+
+#endif
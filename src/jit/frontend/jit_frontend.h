@@ -20,16 +20,39 @@ struct jit_opdef {
   jit_fallback fallback;
 };
 
+/* guest instruction decoded ahead of time, for backends which run blocks
+   through the fallbacks rather than compiling them */
+struct jit_instr {
+  jit_fallback fallback;
+  uint32_t addr;
+  uint32_t data;
+  int cycles;
+};
+
 struct jit_frontend {
   struct jit *jit;
 
   void (*init)(struct jit_frontend *);
   void (*destroy)(struct jit_frontend *);
 
+  /* determine the extent of the block beginning at the block's guest address,
+     filling in its size, instruction and cycle counts */
+  void (*analyze_code)(struct jit_frontend *, struct jit_block *);
   void (*translate_code)(struct jit_frontend *, struct jit_block *,
                          struct ir *);
+
+  /* flags describing the guest state a block's translation depends on, used
+     to key blocks in the jit's code cache. optional */
+  int (*translate_flags)(struct jit_frontend *, const struct jit_block *);
   void (*dump_code)(struct jit_frontend *, const struct jit_block *);
 
+  /* decode the block's instructions in the order they're ran when falling
+     through the block, returning the number decoded. instructions ran by
+     another's fallback (e.g. delay slots) aren't decoded on their own, so at
+     most the block's instruction count are */
+  int (*decode_code)(struct jit_frontend *, const struct jit_block *,
+                     struct jit_instr *);
+
   const struct jit_opdef *(*lookup_op)(struct jit_frontend *, const void *);
 };
 
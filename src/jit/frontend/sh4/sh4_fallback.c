@@ -248,6 +248,7 @@ typedef int32_t int128_t[4];
 #define ADD_IMM_I16                 ADD_I8
 #define ADD_IMM_I32                 ADD_I8
 #define ADD_IMM_I64                 ADD_I8
+#define ADD_IMM_PTR(a, b)           ((a) + (intptr_t)(b))
 
 #define SUB_I8(a, b)                ((a) - (b))
 #define SUB_I16                     SUB_I8
@@ -378,6 +379,9 @@ typedef int32_t int128_t[4];
 
 #define BRANCH_I32(d)               (CTX->pc = d)
 #define BRANCH_IMM_I32              BRANCH_I32
+#define BRANCH_CALL_I32(d, r)       BRANCH_I32(d)
+#define BRANCH_CALL_IMM_I32(d, r)   BRANCH_I32(d)
+#define BRANCH_RETURN_I32(d)        BRANCH_I32(d)
 #define BRANCH_TRUE_IMM_I32(c, d)   if (c) { CTX->pc = d; return; }
 #define BRANCH_FALSE_IMM_I32(c, d)  if (!c) { CTX->pc = d; return; }
 
@@ -1,4 +1,5 @@
 #include "jit/frontend/sh4/sh4_frontend.h"
+#include "core/option.h"
 #include "core/profiler.h"
 #include "jit/frontend/jit_frontend.h"
 #include "jit/frontend/sh4/sh4_context.h"
@@ -9,6 +10,12 @@
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
 
+DEFINE_OPTION_INT(sh4_traces, 1,
+                  "Form blocks which extend across static branches");
+DEFINE_OPTION_INT(sh4_idle_loops, 1,
+                  "Skip ahead to the next scheduled event when spinning in "
+                  "an idle loop");
+
 /*
  * fsca estimate lookup table, used by the jit and interpreter
  */
@@ -20,29 +27,274 @@ struct sh4_frontend {
   struct jit_frontend;
 };
 
-static void sh4_analyze_block(const struct sh4_guest *guest,
+/* traces are formed by following static branches forward through the guest
+   code, up to a limit on both the number of instructions translated and the
+   span of guest code covered. as a trace only ever moves forward, the block
+   still covers a single contiguous range of guest memory */
+#define SH4_MAX_TRACE_INSTRS 128
+#define SH4_MAX_TRACE_SIZE 512
+
+/* idle loops are short loops which spin on a value in memory, waiting for it
+   to be changed by another device or an interrupt handler */
+#define SH4_MAX_IDLE_INSTRS 8
+
+#define SH4_IDLE_T (1 << 16)
+
+/* static destination of a pc-relative branch */
+static uint32_t sh4_branch_dest(uint32_t addr, uint16_t data,
+                                const struct jit_opdef *def) {
+  union sh4_instr i = {data};
+  int32_t disp;
+
+  if (def->op == SH4_OP_BRA || def->op == SH4_OP_BSR) {
+    /* 12-bit displacement must be sign extended */
+    disp = (((int32_t)i.disp_12.disp & 0xfff) << 20) >> 20;
+  } else {
+    /* 8-bit displacement must be sign extended */
+    disp = (int32_t)(int8_t)i.disp_8.disp;
+  }
+
+  return (disp * 2) + addr + 4;
+}
+
+/* fetch the registers read and written by an instruction which may appear in
+   an idle loop, returning 0 if the instruction has side effects that rule the
+   loop out */
+static int sh4_idle_regs(uint16_t data, uint32_t *reads, uint32_t *writes) {
+  struct jit_opdef *def = sh4_get_opdef(data);
+  union sh4_instr i = {data};
+  uint32_t rm = 1 << i.def.rm;
+  uint32_t rn = 1 << i.def.rn;
+  uint32_t r0 = 1 << 0;
+
+  switch (def->op) {
+    case SH4_OP_NOP:
+    case SH4_OP_BRA:
+      *reads = 0;
+      *writes = 0;
+      return 1;
+    case SH4_OP_MOVI:
+    case SH4_OP_MOVWLPC:
+    case SH4_OP_MOVLLPC:
+      *reads = 0;
+      *writes = rn;
+      return 1;
+    case SH4_OP_MOV:
+    case SH4_OP_MOVBL:
+    case SH4_OP_MOVWL:
+    case SH4_OP_MOVLL:
+    case SH4_OP_MOVLLDN:
+    case SH4_OP_EXTSB:
+    case SH4_OP_EXTSW:
+    case SH4_OP_EXTUB:
+    case SH4_OP_EXTUW:
+    case SH4_OP_SWAPB:
+    case SH4_OP_SWAPW:
+      *reads = rm;
+      *writes = rn;
+      return 1;
+    case SH4_OP_MOVBL0:
+    case SH4_OP_MOVWL0:
+    case SH4_OP_MOVLL0:
+      *reads = r0 | rm;
+      *writes = rn;
+      return 1;
+    case SH4_OP_MOVBLD0:
+    case SH4_OP_MOVWLD0:
+      *reads = rm;
+      *writes = r0;
+      return 1;
+    case SH4_OP_MOVBLG0:
+    case SH4_OP_MOVWLG0:
+    case SH4_OP_MOVLLG0:
+      *reads = 0;
+      *writes = r0;
+      return 1;
+    case SH4_OP_MOVT:
+      *reads = SH4_IDLE_T;
+      *writes = rn;
+      return 1;
+    case SH4_OP_AND:
+      *reads = rm | rn;
+      *writes = rn;
+      return 1;
+    case SH4_OP_ANDI:
+      *reads = r0;
+      *writes = r0;
+      return 1;
+    case SH4_OP_CMPEQI:
+    case SH4_OP_TSTI:
+      *reads = r0;
+      *writes = SH4_IDLE_T;
+      return 1;
+    case SH4_OP_CMPEQ:
+    case SH4_OP_CMPHS:
+    case SH4_OP_CMPGE:
+    case SH4_OP_CMPHI:
+    case SH4_OP_CMPGT:
+    case SH4_OP_CMPSTR:
+    case SH4_OP_TST:
+      *reads = rm | rn;
+      *writes = SH4_IDLE_T;
+      return 1;
+    case SH4_OP_CMPPZ:
+    case SH4_OP_CMPPL:
+      *reads = rn;
+      *writes = SH4_IDLE_T;
+      return 1;
+    case SH4_OP_BT:
+    case SH4_OP_BF:
+    case SH4_OP_BTS:
+    case SH4_OP_BFS:
+      *reads = SH4_IDLE_T;
+      *writes = 0;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* look for a short loop at the start of the block which only loads and
+   compares values. as long as no register written by the loop is also read
+   before being written, each iteration is identical until the memory being
+   polled changes. returns 1 and the address of the branch back to the start
+   of the loop if the block begins with an idle loop */
+static int sh4_analyze_idle_loop(const struct sh4_guest *guest,
+                                 const struct jit_block *block,
+                                 uint32_t *branch_addr) {
+  uint32_t addr = block->guest_addr;
+  uint32_t live_in = 0;
+  uint32_t written = 0;
+
+  for (int n = 0; n < SH4_MAX_IDLE_INSTRS; n++) {
+    uint16_t data = guest->r16(guest->space, addr);
+    struct jit_opdef *def = sh4_get_opdef(data);
+    uint32_t reads, writes;
+
+    if (!sh4_idle_regs(data, &reads, &writes)) {
+      return 0;
+    }
+
+    live_in |= reads & ~written;
+    written |= writes;
+
+    if (def->flags & SH4_FLAG_DELAYED) {
+      uint16_t delay_data = guest->r16(guest->space, addr + 2);
+
+      if (!sh4_idle_regs(delay_data, &reads, &writes)) {
+        return 0;
+      }
+
+      live_in |= reads & ~written;
+      written |= writes;
+    }
+
+    if (def->flags & SH4_FLAG_SET_PC) {
+      uint32_t dest_addr = sh4_branch_dest(addr, data, def);
+
+      if (dest_addr == block->guest_addr) {
+        *branch_addr = addr;
+        return !(live_in & written);
+      }
+
+      /* branches out of the loop are fine, but it must still be closed by
+         falling through them */
+      if (!(def->flags & SH4_FLAG_COND)) {
+        return 0;
+      }
+    }
+
+    addr += (def->flags & SH4_FLAG_DELAYED) ? 4 : 2;
+  }
+
+  return 0;
+}
+
+/* determine the address execution continues at after the instruction at addr,
+   returning 0 if the block should end with it */
+static int sh4_trace_next(const struct sh4_guest *guest,
+                          const struct jit_block *block, int flags,
+                          uint32_t addr, uint16_t data, int num_instrs,
+                          uint32_t *next) {
+  struct jit_opdef *def = sh4_get_opdef(data);
+  int traces = flags & SH4_TRACES;
+
+  *next = addr + ((def->flags & SH4_FLAG_DELAYED) ? 4 : 2);
+
+  /* stop emitting if fpscr has changed, since the fpu state is invalidated.
+     also, if sr has changed, stop emitting as there are interrupts that
+     possibly need to be handled */
+  if (def->flags & (SH4_FLAG_SET_FPSCR | SH4_FLAG_SET_SR)) {
+    return 0;
+  }
+
+  /* the same goes for a followed branch whose delay slot changes them */
+  if (def->flags & SH4_FLAG_DELAYED) {
+    uint16_t delay_data = guest->r16(guest->space, addr + 2);
+    struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
+
+    if (delay_def->flags & (SH4_FLAG_SET_FPSCR | SH4_FLAG_SET_SR)) {
+      return 0;
+    }
+  }
+
+  /* stop emitting once a branch has been hit, unless it can be followed. a
+     conditional branch is followed by continuing along its fallthrough path,
+     leaving the block through a side exit when taken. bra is followed when it
+     jumps forward. bsr isn't followed, as dropping its branch would skip the
+     return address push the callee's rts expects */
+  if (def->flags & SH4_FLAG_SET_PC) {
+    if (!traces) {
+      return 0;
+    }
+
+    if (def->flags & SH4_FLAG_COND) {
+      /* continue on fallthrough path */
+    } else if (def->op == SH4_OP_BRA) {
+      uint32_t dest_addr = sh4_branch_dest(addr, data, def);
+
+      if (dest_addr < *next) {
+        return 0;
+      }
+
+      *next = dest_addr;
+    } else {
+      return 0;
+    }
+  }
+
+  if (traces) {
+    /* leave room for the next instruction and its delay slot */
+    uint32_t size = *next + 4 - block->guest_addr;
+
+    if (num_instrs >= SH4_MAX_TRACE_INSTRS || size > SH4_MAX_TRACE_SIZE) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void sh4_analyze_block(const struct sh4_guest *guest, int flags,
                               struct jit_block *block) {
   uint32_t addr = block->guest_addr;
+  uint32_t next = addr;
 
   block->guest_size = 0;
   block->num_cycles = 0;
   block->num_instrs = 0;
 
   while (1) {
-    uint32_t data = guest->r16(guest->space, addr);
+    uint16_t data = guest->r16(guest->space, addr);
     struct jit_opdef *def = sh4_get_opdef(data);
 
-    addr += 2;
-    block->guest_size += 2;
     block->num_cycles += def->cycles;
     block->num_instrs++;
 
     if (def->flags & SH4_FLAG_DELAYED) {
-      uint32_t delay_data = guest->r16(guest->space, addr);
+      uint32_t delay_data = guest->r16(guest->space, addr + 2);
       struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
 
-      addr += 2;
-      block->guest_size += 2;
       block->num_cycles += delay_def->cycles;
       block->num_instrs++;
 
@@ -50,16 +302,56 @@ static void sh4_analyze_block(const struct sh4_guest *guest,
       CHECK(!(delay_def->flags & SH4_FLAG_DELAYED));
     }
 
-    /* stop emitting once a branch has been hit. in addition, if fpscr has
-       changed, stop emitting since the fpu state is invalidated. also, if
-       sr has changed, stop emitting as there are interrupts that possibly
-       need to be handled */
-    if (def->flags & (SH4_FLAG_SET_PC | SH4_FLAG_SET_FPSCR | SH4_FLAG_SET_SR)) {
+    int more = sh4_trace_next(guest, block, flags, addr, data,
+                              block->num_instrs, &next);
+
+    /* the block spans up to the end of the final instruction, which is always
+       the furthest along as traces only move forward */
+    if (!more) {
+      block->guest_size =
+          addr + ((def->flags & SH4_FLAG_DELAYED) ? 4 : 2) - block->guest_addr;
       break;
     }
+
+    addr = next;
   }
 }
 
+static int sh4_frontend_translate_flags(struct jit_frontend *base,
+                                        const struct jit_block *block) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->jit->guest;
+  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
+
+  int flags = 0;
+  if (block->fastmem) {
+    flags |= SH4_FASTMEM;
+  }
+  if (ctx->fpscr & PR_MASK) {
+    flags |= SH4_DOUBLE_PR;
+  }
+  if (ctx->fpscr & SZ_MASK) {
+    flags |= SH4_DOUBLE_SZ;
+  }
+  if (OPTION_sh4_traces) {
+    flags |= SH4_TRACES;
+  }
+  if (OPTION_sh4_idle_loops) {
+    flags |= SH4_IDLE_LOOPS;
+  }
+  return flags;
+}
+
+static void sh4_frontend_analyze_code(struct jit_frontend *base,
+                                        struct jit_block *block) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->jit->guest;
+
+  int flags = sh4_frontend_translate_flags(base, block);
+
+  sh4_analyze_block(guest, flags, block);
+}
+
 static const struct jit_opdef *sh4_frontend_lookup_op(struct jit_frontend *base,
                                                       const void *instr) {
   return sh4_get_opdef(*(const uint16_t *)instr);
@@ -68,29 +360,160 @@ static const struct jit_opdef *sh4_frontend_lookup_op(struct jit_frontend *base,
 static void sh4_frontend_dump_code(struct jit_frontend *base,
                                    const struct jit_block *block) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
-  struct jit_guest *guest = frontend->jit->guest;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->jit->guest;
 
+  int flags = sh4_frontend_translate_flags(base, block);
+  uint32_t addr = block->guest_addr;
+  uint32_t next = addr;
+  int num_instrs = 0;
   char buffer[128];
 
-  for (int offset = 0; offset < block->guest_size; offset += 2) {
-    uint32_t addr = block->guest_addr + offset;
+  while (1) {
     uint16_t data = guest->r16(guest->space, addr);
     union sh4_instr instr = {data};
     struct jit_opdef *def = sh4_get_opdef(data);
 
     sh4_format(addr, instr, buffer, sizeof(buffer));
     LOG_INFO(buffer);
+    num_instrs++;
 
     if (def->flags & SH4_FLAG_DELAYED) {
       uint32_t delay_addr = addr + 2;
       uint16_t delay_data = guest->r16(guest->space, delay_addr);
       union sh4_instr delay_instr = {delay_data};
 
-      sh4_format(addr, delay_instr, buffer, sizeof(buffer));
+      sh4_format(delay_addr, delay_instr, buffer, sizeof(buffer));
       LOG_INFO(buffer);
+      num_instrs++;
+    }
+
+    if (!sh4_trace_next(guest, block, flags, addr, data, num_instrs, &next)) {
+      break;
+    }
+
+    addr = next;
+  }
+}
+
+static int sh4_frontend_decode_code(struct jit_frontend *base,
+                                    const struct jit_block *block,
+                                    struct jit_instr *instrs) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->jit->guest;
+
+  int flags = sh4_frontend_translate_flags(base, block);
+  uint32_t addr = block->guest_addr;
+  uint32_t next = addr;
+  int num_instrs = 0;
+  int n = 0;
+
+  while (1) {
+    uint16_t data = guest->r16(guest->space, addr);
+    struct jit_opdef *def = sh4_get_opdef(data);
+    struct jit_instr *instr = &instrs[n++];
 
-      offset += 2;
+    instr->fallback = def->fallback;
+    instr->addr = addr;
+    instr->data = data;
+    instr->cycles = def->cycles;
+    num_instrs++;
+
+    /* the delay slot is ran by the branch's fallback */
+    if (def->flags & SH4_FLAG_DELAYED) {
+      uint16_t delay_data = guest->r16(guest->space, addr + 2);
+      struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
+
+      instr->cycles += delay_def->cycles;
+      num_instrs++;
+    }
+
+    if (!sh4_trace_next(guest, block, flags, addr, data, num_instrs, &next)) {
+      break;
     }
+
+    addr = next;
+  }
+
+  return n;
+}
+
+static struct ir_value *sh4_select_branch_taken(
+    struct ir *ir, const struct jit_opdef *def, struct ir_value *if_taken,
+    struct ir_value *if_not_taken) {
+  /* the branch condition is loaded before any delay slot is translated, the
+     same as the branch itself. T is always tested against zero and the values
+     swapped for bf, so the test folds away when T was just set by a
+     comparison */
+  struct ir_value *t = ir_load_context(ir, offsetof(struct sh4_context, sr_t),
+                                       VALUE_I32);
+  struct ir_value *cond = ir_cmp_ne(ir, t, ir_alloc_i32(ir, 0));
+
+  if (def->op == SH4_OP_BT || def->op == SH4_OP_BTS) {
+    return ir_select(ir, cond, if_taken, if_not_taken);
+  }
+  return ir_select(ir, cond, if_not_taken, if_taken);
+}
+
+static void sh4_emit_side_exit_refund(const struct sh4_guest *guest,
+                                      struct ir *ir,
+                                      const struct jit_opdef *def,
+                                      int num_cycles, int num_instrs) {
+  if (!num_cycles && !num_instrs) {
+    return;
+  }
+
+  struct ir_value *zero = ir_alloc_i32(ir, 0);
+
+  struct ir_value *cycles_refund =
+      sh4_select_branch_taken(ir, def, ir_alloc_i32(ir, num_cycles), zero);
+  struct ir_value *instrs_refund =
+      sh4_select_branch_taken(ir, def, ir_alloc_i32(ir, -num_instrs), zero);
+
+  struct ir_value *cycles =
+      ir_load_context(ir, guest->offset_cycles, VALUE_I32);
+  ir_store_context(ir, guest->offset_cycles,
+                   ir_add(ir, cycles, cycles_refund));
+
+  struct ir_value *instrs =
+      ir_load_context(ir, guest->offset_instrs, VALUE_I32);
+  ir_store_context(ir, guest->offset_instrs,
+                   ir_add(ir, instrs, instrs_refund));
+}
+
+/* once an idle loop branches back to its start, nothing will change until
+   another device or an interrupt intervenes. rather than spinning through the
+   rest of the time slice, exhaust the remaining cycles so the run loop yields
+   up to the next scheduled event */
+static void sh4_emit_idle_skip(const struct sh4_guest *guest, struct ir *ir,
+                               const struct jit_opdef *def) {
+  struct ir_value *exhausted = ir_alloc_i32(ir, -1);
+
+  if (!(def->flags & SH4_FLAG_COND)) {
+    ir_store_context(ir, guest->offset_cycles, exhausted);
+    return;
+  }
+
+  struct ir_value *cycles =
+      ir_load_context(ir, guest->offset_cycles, VALUE_I32);
+  ir_store_context(ir, guest->offset_cycles,
+                   sh4_select_branch_taken(ir, def, exhausted, cycles));
+}
+
+static void sh4_remove_branch(struct ir *ir) {
+  struct ir_block *tail_block =
+      list_last_entry(&ir->blocks, struct ir_block, it);
+  struct ir_instr *tail_instr =
+      list_last_entry(&tail_block->instrs, struct ir_instr, it);
+  CHECK_EQ(tail_instr->op, OP_BRANCH);
+
+  struct ir_instr *prev_instr =
+      list_prev_entry(tail_instr, struct ir_instr, it);
+  ir_remove_instr(ir, tail_instr);
+
+  if (prev_instr) {
+    ir_set_current_instr(ir, prev_instr);
+  } else {
+    ir_set_current_block(ir, tail_block);
   }
 }
 
@@ -99,34 +522,57 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
                                         struct ir *ir) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
   struct sh4_guest *guest = (struct sh4_guest *)frontend->jit->guest;
-  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
 
   PROF_ENTER("cpu", "sh4_frontend_translate_code");
 
-  int flags = 0;
-  if (block->fastmem) {
-    flags |= SH4_FASTMEM;
-  }
-  if (ctx->fpscr & PR_MASK) {
-    flags |= SH4_DOUBLE_PR;
-  }
-  if (ctx->fpscr & SZ_MASK) {
-    flags |= SH4_DOUBLE_SZ;
-  }
+  int flags = sh4_frontend_translate_flags(base, block);
+
+  sh4_analyze_block(guest, flags, block);
 
-  sh4_analyze_block(guest, block);
+  uint32_t idle_addr = 0;
+  int idle = (flags & SH4_IDLE_LOOPS) &&
+             sh4_analyze_idle_loop(guest, block, &idle_addr);
 
   /* translate the actual block */
+  uint32_t addr = block->guest_addr;
+  uint32_t next = addr;
+  int num_cycles = 0;
+  int num_instrs = 0;
   int end_flags = 0;
 
-  for (int offset = 0; offset < block->guest_size; offset += 2) {
-    uint32_t addr = block->guest_addr + offset;
+  while (1) {
     uint16_t data = guest->r16(guest->space, addr);
     struct jit_opdef *def = sh4_get_opdef(data);
 
+    num_cycles += def->cycles;
+    num_instrs++;
+
+    if (def->flags & SH4_FLAG_DELAYED) {
+      uint16_t delay_data = guest->r16(guest->space, addr + 2);
+      struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
+
+      num_cycles += delay_def->cycles;
+      num_instrs++;
+    }
+
+    int more =
+        sh4_trace_next(guest, block, flags, addr, data, num_instrs, &next);
+
+    /* the prologue charges the cycles and instructions for the entire block
+       up front, refund those which won't run if a side exit is taken */
+    if (more && (def->flags & SH4_FLAG_COND)) {
+      sh4_emit_side_exit_refund(guest, ir, def, block->num_cycles - num_cycles,
+                                block->num_instrs - num_instrs);
+    }
+
+    if (idle && addr == idle_addr) {
+      sh4_emit_idle_skip(guest, ir, def);
+    }
+
 #if 0
     /* emit a call to the interpreter fallback for each instruction. this can
-       be used to bisect and find bad ir op implementations */
+       be used to bisect and find bad ir op implementations. note, traces must
+       be disabled for this to work */
     ir_fallback(ir, def->fallback, addr, data);
     end_flags = SH4_FLAG_SET_PC;
 #else
@@ -136,9 +582,17 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     end_flags = def->flags;
 #endif
 
-    if (def->flags & SH4_FLAG_DELAYED) {
-      offset += 2;
+    if (!more) {
+      break;
+    }
+
+    /* when following an unconditional branch, drop the branch out of the
+       block and continue translating at its destination */
+    if (!(def->flags & SH4_FLAG_COND) && (def->flags & SH4_FLAG_SET_PC)) {
+      sh4_remove_branch(ir);
     }
+
+    addr = next;
   }
 
   /* there are 3 possible block endings:
@@ -161,7 +615,7 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     struct ir_instr *tail_instr =
         list_last_entry(&tail_block->instrs, struct ir_instr, it);
     ir_set_current_instr(ir, tail_instr);
-    ir_branch(ir, ir_alloc_i32(ir, block->guest_addr + block->guest_size));
+    ir_branch(ir, ir_alloc_i32(ir, next));
   }
 
   PROF_LEAVE();
@@ -180,8 +634,11 @@ struct jit_frontend *sh4_frontend_create() {
 
   frontend->init = &sh4_frontend_init;
   frontend->destroy = &sh4_frontend_destroy;
+  frontend->analyze_code = &sh4_frontend_analyze_code;
   frontend->translate_code = &sh4_frontend_translate_code;
+  frontend->translate_flags = &sh4_frontend_translate_flags;
   frontend->dump_code = &sh4_frontend_dump_code;
+  frontend->decode_code = &sh4_frontend_decode_code;
   frontend->lookup_op = &sh4_frontend_lookup_op;
 
   return (struct jit_frontend *)frontend;
@@ -7,6 +7,8 @@ enum {
   SH4_FASTMEM = 0x1,
   SH4_DOUBLE_PR = 0x2,
   SH4_DOUBLE_SZ = 0x4,
+  SH4_TRACES = 0x8,
+  SH4_IDLE_LOOPS = 0x10,
 };
 
 extern uint32_t sh4_fsca_table[];
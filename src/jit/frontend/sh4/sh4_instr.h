@@ -660,12 +660,66 @@ INSTR(EXTUW) {
 
 /* MAC.L   @Rm+,@Rn+ */
 INSTR(MACL) {
-  LOG_FATAL("MACL not implemented");
+  /* rn is read and incremented first, if rm == rn the second operand is read
+     from the following long */
+  I32 ea_n = LOAD_GPR_I32(i.def.rn);
+  I64 vn = SEXT_I32_I64(LOAD_I32(ea_n));
+  STORE_GPR_I32(i.def.rn, ADD_IMM_I32(ea_n, 4));
+
+  I32 ea_m = LOAD_GPR_I32(i.def.rm);
+  I64 vm = SEXT_I32_I64(LOAD_I32(ea_m));
+  STORE_GPR_I32(i.def.rm, ADD_IMM_I32(ea_m, 4));
+
+  I64 mach = SHL_IMM_I64(ZEXT_I32_I64(LOAD_MACH_I32()), 32);
+  I64 macl = ZEXT_I32_I64(LOAD_MACL_I32());
+  I64 mac = ADD_I64(OR_I64(mach, macl), SMUL_I64(vn, vm));
+
+  /* when S is set, the result saturates to 48-bits. it's in range if the bits
+     above bit 47 all match the sign bit */
+  I64 sign = ASHR_IMM_I64(mac, 63);
+  I8 in_range = CMPEQ_I64(ASHR_IMM_I64(mac, 47), sign);
+  I64 sat = XOR_IMM_I64(sign, 0x00007fffffffffffll);
+  I64 clamped = SELECT_I64(in_range, mac, sat);
+  mac = SELECT_I64(LOAD_S_I32(), clamped, mac);
+
+  STORE_MACL_I32(TRUNC_I64_I32(mac));
+  STORE_MACH_I32(TRUNC_I64_I32(LSHR_IMM_I64(mac, 32)));
+  NEXT_INSTR();
 }
 
 /* MAC.W   @Rm+,@Rn+ */
 INSTR(MACW) {
-  LOG_FATAL("MACW not implemented");
+  I32 ea_n = LOAD_GPR_I32(i.def.rn);
+  I32 vn = SEXT_I16_I32(LOAD_I16(ea_n));
+  STORE_GPR_I32(i.def.rn, ADD_IMM_I32(ea_n, 2));
+
+  I32 ea_m = LOAD_GPR_I32(i.def.rm);
+  I32 vm = SEXT_I16_I32(LOAD_I16(ea_m));
+  STORE_GPR_I32(i.def.rm, ADD_IMM_I32(ea_m, 2));
+
+  I64 p = SEXT_I32_I64(SMUL_I32(vn, vm));
+  I32 mach = LOAD_MACH_I32();
+  I32 macl = LOAD_MACL_I32();
+
+  /* when S is clear, the product is added to the full 64-bit mac */
+  I64 mac = OR_I64(SHL_IMM_I64(ZEXT_I32_I64(mach), 32), ZEXT_I32_I64(macl));
+  mac = ADD_I64(mac, p);
+
+  /* when S is set, the product is added to macl only, saturating to 32-bits.
+     on overflow, the lsb of mach is set */
+  I64 sum = ADD_I64(SEXT_I32_I64(macl), p);
+  I64 sign = ASHR_IMM_I64(sum, 63);
+  I8 in_range = CMPEQ_I64(ASHR_IMM_I64(sum, 31), sign);
+  I64 sat = XOR_IMM_I64(sign, 0x7fffffffll);
+  I32 sat_macl = TRUNC_I64_I32(SELECT_I64(in_range, sum, sat));
+  I32 sat_mach = SELECT_I32(in_range, mach, OR_IMM_I32(mach, 1));
+
+  I32 s = LOAD_S_I32();
+  I32 lo = TRUNC_I64_I32(mac);
+  I32 hi = TRUNC_I64_I32(LSHR_IMM_I64(mac, 32));
+  STORE_MACL_I32(SELECT_I32(s, sat_macl, lo));
+  STORE_MACH_I32(SELECT_I32(s, sat_mach, hi));
+  NEXT_INSTR();
 }
 
 /* MUL.L   Rm,Rn */
@@ -1098,7 +1152,7 @@ INSTR(BSR) {
   uint32_t dest_addr = ret_addr + disp * 2;
   DELAY_INSTR();
   STORE_PR_IMM_I32(ret_addr);
-  BRANCH_IMM_I32(dest_addr);
+  BRANCH_CALL_IMM_I32(dest_addr, ret_addr);
 }
 
 /* BSRF    Rn */
@@ -1108,7 +1162,7 @@ INSTR(BSRF) {
   I32 dest_addr = ADD_IMM_I32(rn, ret_addr);
   DELAY_INSTR();
   STORE_PR_IMM_I32(ret_addr);
-  BRANCH_I32(dest_addr);
+  BRANCH_CALL_I32(dest_addr, ret_addr);
 }
 
 /* JMP     @Rm */
@@ -1124,14 +1178,14 @@ INSTR(JSR) {
   uint32_t ret_addr = addr + 4;
   DELAY_INSTR();
   STORE_PR_IMM_I32(ret_addr);
-  BRANCH_I32(dest_addr);
+  BRANCH_CALL_I32(dest_addr, ret_addr);
 }
 
 /* RTS */
 INSTR(RTS) {
   I32 dest_addr = LOAD_PR_I32();
   DELAY_INSTR();
-  BRANCH_I32(dest_addr);
+  BRANCH_RETURN_I32(dest_addr);
 }
 
 /* CLRMAC */
@@ -2105,7 +2159,7 @@ INSTR(FSCA) {
   I64 fsca_offset = ZEXT_I16_I64(LOAD_FPUL_I16());
   fsca_offset = SHL_IMM_I64(fsca_offset, 3);
 
-  I64 ea = ADD_IMM_I64(fsca_offset, (int64_t)sh4_fsca_table);
+  I64 ea = ADD_IMM_PTR(fsca_offset, sh4_fsca_table);
   STORE_FPR_F32(i.def.rn, LOAD_HOST_F32(ea));
   STORE_FPR_F32(i.def.rn + 1, LOAD_HOST_F32(ADD_IMM_I64(ea, 4)));
   NEXT_INSTR();
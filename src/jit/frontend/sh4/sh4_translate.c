@@ -33,9 +33,17 @@ static struct ir_value *load_sr(struct ir *ir) {
       ir_load_context(ir, offsetof(struct sh4_context, sr_t), VALUE_I32);
   struct ir_value *sr_s =
       ir_load_context(ir, offsetof(struct sh4_context, sr_s), VALUE_I32);
-  sr = ir_and(ir, sr, ir_alloc_i32(ir, ~(S_MASK | T_MASK)));
+  struct ir_value *sr_m =
+      ir_load_context(ir, offsetof(struct sh4_context, sr_m), VALUE_I32);
+  struct ir_value *sr_qm =
+      ir_load_context(ir, offsetof(struct sh4_context, sr_qm), VALUE_I32);
+  struct ir_value *sr_q = ir_xor(ir, ir_xor(ir, ir_lshri(ir, sr_qm, 31), sr_m),
+                                 ir_alloc_i32(ir, 1));
+  sr = ir_and(ir, sr, ir_alloc_i32(ir, ~(M_MASK | Q_MASK | S_MASK | T_MASK)));
   sr = ir_or(ir, sr, sr_t);
   sr = ir_or(ir, sr, ir_shli(ir, sr_s, S_BIT));
+  sr = ir_or(ir, sr, ir_shli(ir, sr_m, M_BIT));
+  sr = ir_or(ir, sr, ir_shli(ir, sr_q, Q_BIT));
 
   return sr;
 }
@@ -55,8 +63,16 @@ static void store_sr(struct sh4_guest *guest, struct ir *ir,
   struct ir_value *sr_t = ir_and(ir, v, ir_alloc_i32(ir, T_MASK));
   struct ir_value *sr_s =
       ir_lshri(ir, ir_and(ir, v, ir_alloc_i32(ir, S_MASK)), S_BIT);
+  struct ir_value *sr_m =
+      ir_lshri(ir, ir_and(ir, v, ir_alloc_i32(ir, M_MASK)), M_BIT);
+  struct ir_value *sr_q =
+      ir_lshri(ir, ir_and(ir, v, ir_alloc_i32(ir, Q_MASK)), Q_BIT);
+  struct ir_value *sr_qm =
+      ir_shli(ir, ir_xor(ir, ir_xor(ir, sr_q, sr_m), ir_alloc_i32(ir, 1)), 31);
   ir_store_context(ir, offsetof(struct sh4_context, sr_t), sr_t);
   ir_store_context(ir, offsetof(struct sh4_context, sr_s), sr_s);
+  ir_store_context(ir, offsetof(struct sh4_context, sr_m), sr_m);
+  ir_store_context(ir, offsetof(struct sh4_context, sr_qm), sr_qm);
 
   ir_call_2(ir, sr_updated, data, old_sr);
 }
@@ -296,6 +312,7 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 #define ADD_IMM_I16(a, b)           ADD_I8(a, ir_alloc_i16(ir, b))
 #define ADD_IMM_I32(a, b)           ADD_I8(a, ir_alloc_i32(ir, b))
 #define ADD_IMM_I64(a, b)           ADD_I8(a, ir_alloc_i64(ir, b))
+#define ADD_IMM_PTR(a, b)           ADD_I8(a, ir_alloc_ptr(ir, b))
 
 #define SUB_I8(a, b)                ir_sub(ir, a, b)
 #define SUB_I16                     SUB_I8
@@ -421,25 +438,28 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 
 #define BRANCH_I32(d)               ir_branch(ir, d)
 #define BRANCH_IMM_I32(d)           BRANCH_I32(ir_alloc_i32(ir, d))
+#define BRANCH_CALL_I32(d, r)       ir_branch_call(ir, d, r)
+#define BRANCH_CALL_IMM_I32(d, r)   BRANCH_CALL_I32(ir_alloc_i32(ir, d), r)
+#define BRANCH_RETURN_I32(d)        ir_branch_return(ir, d)
 #define BRANCH_TRUE_IMM_I32(c, d)   ir_branch_true(ir, c, ir_alloc_i32(ir, d))
 #define BRANCH_FALSE_IMM_I32(c, d)  ir_branch_false(ir, c, ir_alloc_i32(ir, d))
 
-#define INVALID_INSTR()             {                                                                                    \
-                                      struct ir_value *invalid_instr = ir_alloc_i64(ir, (uint64_t)guest->invalid_instr); \
-                                      struct ir_value *data = ir_alloc_i64(ir, (uint64_t)guest->data);                   \
-                                      ir_call_1(ir, invalid_instr, data);                                                \
+#define INVALID_INSTR()             {                                                                          \
+                                      struct ir_value *invalid_instr = ir_alloc_ptr(ir, guest->invalid_instr); \
+                                      struct ir_value *data = ir_alloc_ptr(ir, guest->data);                   \
+                                      ir_call_1(ir, invalid_instr, data);                                      \
                                     }
 
-#define PREF_SQ_COND(c, addr)       {                                                                                \
-                                      struct ir_value *sq_prefetch = ir_alloc_i64(ir, (uint64_t)guest->sq_prefetch); \
-                                      struct ir_value *data = ir_alloc_i64(ir, (uint64_t)guest->data);               \
-                                      ir_call_cond_2(ir, c, sq_prefetch, data, addr);                                \
+#define PREF_SQ_COND(c, addr)       {                                                                      \
+                                      struct ir_value *sq_prefetch = ir_alloc_ptr(ir, guest->sq_prefetch); \
+                                      struct ir_value *data = ir_alloc_ptr(ir, guest->data);               \
+                                      ir_call_cond_2(ir, c, sq_prefetch, data, addr);                      \
                                     }
 
-#define SLEEP()                     {                                                                    \
-                                      struct ir_value *sleep = ir_alloc_i64(ir, (uint64_t)guest->sleep); \
-                                      struct ir_value *data = ir_alloc_i64(ir, (uint64_t)guest->data);   \
-                                      ir_call_1(ir, sleep, data);                                        \
+#define SLEEP()                     {                                                          \
+                                      struct ir_value *sleep = ir_alloc_ptr(ir, guest->sleep); \
+                                      struct ir_value *data = ir_alloc_ptr(ir, guest->data);   \
+                                      ir_call_1(ir, sleep, data);                              \
                                     }
 
 /* clang-format on */
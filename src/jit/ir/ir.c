@@ -285,7 +285,9 @@ struct ir_value *ir_alloc_str(struct ir *ir, const char *format, ...) {
 }
 
 struct ir_value *ir_alloc_ptr(struct ir *ir, void *c) {
-  return ir_alloc_i64(ir, (uint64_t)c);
+  struct ir_value *v = ir_alloc_i64(ir, (uint64_t)c);
+  v->host_ptr = 1;
+  return v;
 }
 
 struct ir_value *ir_alloc_block(struct ir *ir, struct ir_block *block) {
@@ -911,6 +913,23 @@ void ir_branch(struct ir *ir, struct ir_value *dst) {
   ir_set_arg0(ir, instr, dst);
 }
 
+void ir_branch_call(struct ir *ir, struct ir_value *dst, uint32_t ret_addr) {
+  CHECK(dst->type == VALUE_I32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_BRANCH, VALUE_V);
+  ir_set_arg0(ir, instr, dst);
+  ir_set_arg1(ir, instr, ir_alloc_i32(ir, BRANCH_CALL));
+  ir_set_arg2(ir, instr, ir_alloc_i32(ir, ret_addr));
+}
+
+void ir_branch_return(struct ir *ir, struct ir_value *dst) {
+  CHECK(dst->type == VALUE_I32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_BRANCH, VALUE_V);
+  ir_set_arg0(ir, instr, dst);
+  ir_set_arg1(ir, instr, ir_alloc_i32(ir, BRANCH_RETURN));
+}
+
 void ir_branch_false(struct ir *ir, struct ir_value *cond,
                      struct ir_value *dst) {
   CHECK(dst->type == VALUE_I32);
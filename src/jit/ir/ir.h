@@ -46,6 +46,14 @@ enum ir_cmp {
   CMP_ULT
 };
 
+/* hints describing the purpose of an unconditional branch, used by backends
+   to predict the destination of dynamic branches */
+enum ir_branch_type {
+  BRANCH_JUMP,
+  BRANCH_CALL,
+  BRANCH_RETURN,
+};
+
 struct ir_block;
 struct ir_instr;
 struct ir_value;
@@ -90,6 +98,10 @@ struct ir_value {
   /* instructions that use this value as an argument */
   struct list uses;
 
+  /* constant is a host pointer, which must be relocated if the ir is loaded
+     by a later run */
+  int host_ptr;
+
   /* host register allocated for this value */
   int reg;
 
@@ -398,6 +410,8 @@ struct ir_value *ir_lshd(struct ir *ir, struct ir_value *a, struct ir_value *n);
 
 /* branches */
 void ir_branch(struct ir *ir, struct ir_value *dst);
+void ir_branch_call(struct ir *ir, struct ir_value *dst, uint32_t ret_addr);
+void ir_branch_return(struct ir *ir, struct ir_value *dst);
 void ir_branch_false(struct ir *ir, struct ir_value *cond,
                      struct ir_value *dst);
 void ir_branch_true(struct ir *ir, struct ir_value *cond, struct ir_value *dst);
@@ -3,11 +3,16 @@
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/filesystem.h"
+#include "core/math.h"
 #include "core/option.h"
 #include "core/profiler.h"
+#include "core/thread.h"
+#include "core/time.h"
 #include "jit/backend/jit_backend.h"
 #include "jit/frontend/jit_frontend.h"
 #include "jit/ir/ir.h"
+#include "jit/jit_cache.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/passes/dead_code_elimination_pass.h"
 #include "jit/passes/expression_simplification_pass.h"
@@ -19,79 +24,224 @@
 #endif
 
 DEFINE_OPTION_INT(perf, 0, "Create maps for compiled code for use with perf");
+DEFINE_OPTION_INT(async_jit, 0,
+                  "Compile blocks on a background thread, interpreting them "
+                  "until the compiled code is ready");
+DEFINE_OPTION_INT(jit_cache, 0,
+                  "Cache optimized blocks to disk, reusing them on later runs");
+DEFINE_OPTION_INT(tiered_jit, 0,
+                  "Compile blocks with minimal optimizations at first, "
+                  "recompiling them with all optimizations once they're hot");
+
+/* number of compiled blocks resident across all guests */
+DEFINE_COUNTER(jit_blocks);
+DEFINE_AGGREGATE_COUNTER(jit_blocks_evicted);
+/* blocks invalidated by writes to their guest code */
+DEFINE_AGGREGATE_COUNTER(jit_blocks_modified);
+DEFINE_COUNTER(jit_queue_depth);
+/* time in microseconds between the most recently published block being queued
+   and its native code becoming available */
+DEFINE_COUNTER(jit_time_to_native);
+
+/* maximum number of blocks that can be queued for background compilation */
+#define JIT_MAX_JOBS 8
+
+/* number of runs before a baseline block is recompiled with all
+   optimizations */
+#define JIT_HOT_BLOCK_RUNS 1000
+
+/* number of blocks listed when dumping hot blocks */
+#define JIT_MAX_HOT_BLOCKS 64
+
+/* jit currently running compiled code on this thread. with the guests running
+   on separate threads, an exception is only serviced by the jit which raised
+   it, as any other jit's blocks may be in the middle of being modified */
+static _Thread_local struct jit *jit_running;
+
+/* the address of a thread local uniquely identifies the current thread */
+static _Thread_local int jit_thread;
+
+enum {
+  JOB_FREE,
+  JOB_PENDING,
+  JOB_COMPILING,
+  JOB_FINISHED,
+};
 
-static int block_map_cmp(const struct rb_node *rb_lhs,
-                         const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, it);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, it);
+struct jit_job {
+  int state;
 
-  if (lhs->guest_addr < rhs->guest_addr) {
-    return -1;
-  } else if (lhs->guest_addr > rhs->guest_addr) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
+  /* generation of the cache the job was queued for. if the cache is
+     invalidated or freed while the job is in flight, its result is thrown
+     away */
+  int generation;
+  int64_t queue_time;
 
-static int reverse_block_map_cmp(const struct rb_node *rb_lhs,
-                                 const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, rit);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, rit);
+  struct jit_block *block;
+  struct ir ir;
+  uint8_t *ir_buffer;
+  int assembled;
 
-  if ((uint8_t *)lhs->host_addr < (uint8_t *)rhs->host_addr) {
-    return -1;
-  } else if ((uint8_t *)lhs->host_addr > (uint8_t *)rhs->host_addr) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
+  /* blocks loaded from the code cache are already optimized */
+  int cached;
+  struct jit_cache_key key;
 
-static struct rb_callbacks block_map_cb = {
-    &block_map_cmp, NULL, NULL,
+  struct list_node it;
 };
 
-static struct rb_callbacks reverse_block_map_cb = {
-    &reverse_block_map_cmp, NULL, NULL,
+struct jit_queue {
+  struct jit_job jobs[JIT_MAX_JOBS];
+  struct list pending;
+  struct list finished;
+  int generation;
+
+  thread_t thread;
+  volatile int running;
+
+  /* guards the job lists and states */
+  mutex_t mutex;
+  cond_t cond;
+
+  /* held by the worker while running the passes and backend, and by the
+     emulation thread while resetting the backend */
+  mutex_t compile_mutex;
 };
 
+static inline struct jit_block **jit_block_ptr(struct jit *jit,
+                                               uint32_t guest_addr) {
+  return &jit->block_map[(guest_addr & jit->guest->addr_mask) >>
+                         jit->block_shift];
+}
+
+static inline struct jit_code_page *jit_code_page(struct jit *jit,
+                                                  uint32_t guest_addr) {
+  return &jit->code_pages[(guest_addr & jit->guest->addr_mask) >>
+                          JIT_CODE_PAGE_SHIFT];
+}
+
+static inline struct list *jit_reverse_bucket(struct jit *jit,
+                                              uintptr_t page) {
+  return &jit->reverse_map[page & (JIT_REVERSE_BUCKETS - 1)];
+}
+
 static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr) {
-  struct jit_block search;
-  search.guest_addr = guest_addr;
+  struct jit_block *block = *jit_block_ptr(jit, guest_addr);
+
+  /* multiple guest addresses can map to the same entry, make sure this is the
+     block that was actually requested */
+  if (!block || block->guest_addr != guest_addr) {
+    return NULL;
+  }
 
-  return rb_find_entry(&jit->blocks, &search, struct jit_block, it,
-                       &block_map_cb);
+  return block;
 }
 
 static struct jit_block *jit_lookup_block_reverse(struct jit *jit,
                                                   void *host_addr) {
-  struct jit_block search;
-  search.host_addr = host_addr;
+  uintptr_t page = (uintptr_t)host_addr >> JIT_REVERSE_PAGE_SHIFT;
+
+  /* blocks are bucketed by the page their code begins in, so walk back through
+     the previous pages in case the address is inside of a block spanning
+     multiple pages */
+  for (int i = 0; i <= jit->max_block_pages && i <= (int)page; i++) {
+    struct list *bucket = jit_reverse_bucket(jit, page - i);
+
+    list_for_each_entry(block, bucket, struct jit_block, rit) {
+      uint8_t *begin = (uint8_t *)block->host_addr;
+      uint8_t *end = begin + block->host_size;
+
+      /* buckets are sorted by host address, nothing else can match */
+      if ((uint8_t *)host_addr < begin) {
+        break;
+      }
+
+      if ((uint8_t *)host_addr < end) {
+        return block;
+      }
+    }
+  }
 
-  struct rb_node *first = rb_first(&jit->reverse_blocks);
-  struct rb_node *last = rb_last(&jit->reverse_blocks);
-  struct rb_node *rit =
-      rb_upper_bound(&jit->reverse_blocks, &search.rit, &reverse_block_map_cb);
+  return NULL;
+}
 
-  if (rit == first) {
-    return NULL;
+static void jit_block_pages(struct jit_block *block, uint32_t *first,
+                            uint32_t *last) {
+  uint32_t end = block->guest_addr + MAX(block->guest_size, 1) - 1;
+  *first = block->guest_addr >> JIT_CODE_PAGE_SHIFT;
+  *last = end >> JIT_CODE_PAGE_SHIFT;
+}
+
+static void jit_link_pages(struct jit *jit, struct jit_block *block) {
+  uint32_t first, last;
+  jit_block_pages(block, &first, &last);
+
+  block->num_page_refs = (int)(last - first) + 1;
+  block->page_refs =
+      calloc(block->num_page_refs, sizeof(struct jit_page_ref));
+
+  for (int i = 0; i < block->num_page_refs; i++) {
+    struct jit_code_page *page =
+        jit_code_page(jit, (first + i) << JIT_CODE_PAGE_SHIFT);
+    struct jit_page_ref *ref = &block->page_refs[i];
+    ref->block = block;
+    list_add(&page->blocks, &ref->it);
   }
+}
 
-  rit = rit ? rb_prev(rit) : last;
+static void jit_unlink_pages(struct jit *jit, struct jit_block *block) {
+  uint32_t first = block->guest_addr >> JIT_CODE_PAGE_SHIFT;
 
-  struct jit_block *block = container_of(rit, struct jit_block, rit);
-  if ((uint8_t *)host_addr < (uint8_t *)block->host_addr ||
-      (uint8_t *)host_addr >=
-          ((uint8_t *)block->host_addr + block->host_size)) {
-    return NULL;
+  for (int i = 0; i < block->num_page_refs; i++) {
+    struct jit_code_page *page =
+        jit_code_page(jit, (first + i) << JIT_CODE_PAGE_SHIFT);
+    list_remove(&page->blocks, &block->page_refs[i].it);
   }
 
-  return block;
+  free(block->page_refs);
+  block->page_refs = NULL;
+  block->num_page_refs = 0;
+}
+
+static void jit_link_block(struct jit *jit, struct jit_block *block) {
+  struct jit_block **entry = jit_block_ptr(jit, block->guest_addr);
+  CHECK(!*entry, "block was already inserted in lookup map");
+  *entry = block;
+
+  uintptr_t begin = (uintptr_t)block->host_addr;
+  uintptr_t end = begin + MAX(block->host_size, 1) - 1;
+  uintptr_t page = begin >> JIT_REVERSE_PAGE_SHIFT;
+  int num_pages = (int)((end >> JIT_REVERSE_PAGE_SHIFT) - page);
+  jit->max_block_pages = MAX(jit->max_block_pages, num_pages);
+
+  /* code is emitted linearly, so in the common case the block belongs at the
+     end of the bucket */
+  struct list *bucket = jit_reverse_bucket(jit, page);
+  struct jit_block *after = list_last_entry(bucket, struct jit_block, rit);
+  while (after && (uint8_t *)after->host_addr > (uint8_t *)block->host_addr) {
+    after = list_prev_entry(after, struct jit_block, rit);
+  }
+  list_add_after_entry(bucket, after, block, rit);
+
+  jit_link_pages(jit, block);
+
+  list_add(&jit->blocks, &block->it);
+
+  prof_counter_add(COUNTER_jit_blocks, 1);
+}
+
+static void jit_unlink_block(struct jit *jit, struct jit_block *block) {
+  struct jit_block **entry = jit_block_ptr(jit, block->guest_addr);
+  CHECK_EQ(*entry, block);
+  *entry = NULL;
+
+  uintptr_t page = (uintptr_t)block->host_addr >> JIT_REVERSE_PAGE_SHIFT;
+  list_remove(jit_reverse_bucket(jit, page), &block->rit);
+
+  jit_unlink_pages(jit, block);
+
+  list_remove(&jit->blocks, &block->it);
+
+  prof_counter_add(COUNTER_jit_blocks, -1);
 }
 
 static int jit_is_stale(struct jit *jit, struct jit_block *block) {
@@ -157,6 +307,88 @@ static void jit_invalidate_block(struct jit *jit, struct jit_block *block) {
   }
 }
 
+static int jit_is_protected(struct jit *jit, struct jit_block *block) {
+  uint32_t first, last;
+  jit_block_pages(block, &first, &last);
+
+  for (uint32_t i = first; i <= last; i++) {
+    struct jit_code_page *page =
+        jit_code_page(jit, i << JIT_CODE_PAGE_SHIFT);
+
+    if (!page->protect) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void jit_protect_block(struct jit *jit, struct jit_block *block) {
+  struct jit_guest *guest = jit->guest;
+
+  if (!guest->protect_code) {
+    return;
+  }
+
+  /* write protect each page the block was translated from, so a write to any
+     of them invalidates it */
+  uint32_t first, last;
+  jit_block_pages(block, &first, &last);
+
+  for (uint32_t i = first; i <= last; i++) {
+    uint32_t addr = i << JIT_CODE_PAGE_SHIFT;
+    struct jit_code_page *page = jit_code_page(jit, addr);
+
+    if (page->protect || page->writes >= JIT_MAX_CODE_PAGE_WRITES) {
+      continue;
+    }
+
+    if (guest->protect_code(guest->data, addr, JIT_CODE_PAGE_SIZE, 1)) {
+      page->addr = addr;
+      page->protect = 1;
+    }
+  }
+}
+
+static void jit_unprotect_pages(struct jit *jit) {
+  struct jit_guest *guest = jit->guest;
+
+  if (!guest->protect_code) {
+    return;
+  }
+
+  int num_pages = (guest->addr_mask >> JIT_CODE_PAGE_SHIFT) + 1;
+
+  for (int i = 0; i < num_pages; i++) {
+    struct jit_code_page *page = &jit->code_pages[i];
+
+    if (page->protect) {
+      guest->protect_code(guest->data, page->addr, JIT_CODE_PAGE_SIZE, 0);
+    }
+  }
+
+  memset(jit->code_pages, 0, num_pages * sizeof(struct jit_code_page));
+}
+
+static void jit_unprotect_empty_pages(struct jit *jit, uint32_t first,
+                                      uint32_t last) {
+  struct jit_guest *guest = jit->guest;
+
+  if (!guest->protect_code) {
+    return;
+  }
+
+  /* stop watching pages once no block has been translated from them */
+  for (uint32_t i = first; i <= last; i++) {
+    struct jit_code_page *page = jit_code_page(jit, i << JIT_CODE_PAGE_SHIFT);
+
+    if (page->protect && list_empty(&page->blocks)) {
+      guest->protect_code(guest->data, page->addr, JIT_CODE_PAGE_SIZE, 0);
+      page->protect = 0;
+    }
+  }
+}
+
 static void jit_cache_block(struct jit *jit, struct jit_block *block) {
   jit->backend->cache_code(jit->backend, block->guest_addr, block->host_addr);
 
@@ -167,8 +399,7 @@ static void jit_cache_block(struct jit *jit, struct jit_block *block) {
 static void jit_free_block(struct jit *jit, struct jit_block *block) {
   jit_invalidate_block(jit, block);
 
-  rb_unlink(&jit->blocks, &block->it, &block_map_cb);
-  rb_unlink(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  jit_unlink_block(jit, block);
 
   free(block);
 }
@@ -176,13 +407,10 @@ static void jit_free_block(struct jit *jit, struct jit_block *block) {
 static void jit_finalize_block(struct jit *jit, struct jit_block *block) {
   CHECK(list_empty(&block->in_edges) && list_empty(&block->out_edges),
         "code shouldn't have any existing edges");
-  CHECK(rb_empty_node(&block->it) && rb_empty_node(&block->rit),
-        "code was already inserted in lookup tables");
 
   jit_cache_block(jit, block);
 
-  rb_insert(&jit->blocks, &block->it, &block_map_cb);
-  rb_insert(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  jit_link_block(jit, block);
 
   /* write out to perf map if enabled */
   if (OPTION_perf) {
@@ -192,44 +420,186 @@ static void jit_finalize_block(struct jit *jit, struct jit_block *block) {
   }
 }
 
-static struct jit_block *jit_alloc_block(struct jit *jit) {
+static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr) {
+  /* for debug builds, fastmem can be troublesome when running under gdb or
+     lldb. when doing so, SIGSEGV handling can be completely disabled with:
+     handle SIGSEGV nostop noprint pass
+     however, then legitimate SIGSEGV will also not be handled by the debugger.
+     as of this writing, there is no way to configure the debugger to ignore the
+     signal initially, letting us try to handle it, and then handling it in the
+     case that we do not (e.g. because it was not a fastmem-related segfault).
+     because of this, fastmem is default disabled for debug builds to cause less
+     headaches */
+  int fastmem = 1;
+#ifndef NDEBUG
+  fastmem = 0;
+#endif
+
+  int tier = OPTION_tiered_jit ? JIT_TIER_BASELINE : JIT_TIER_OPTIMIZED;
+  int num_runs = 0;
+
+  /* if the block had previously been invalidated by a fastmem exception,
+     disable fastmem opts. if it was invalidated to be promoted, compile it
+     at the next tier */
+  struct jit_block *existing = jit_get_block(jit, guest_addr);
+  if (existing) {
+    fastmem = existing->fastmem;
+    tier = existing->tier;
+    num_runs = existing->num_runs;
+  }
+
   struct jit_block *block = calloc(1, sizeof(struct jit_block));
+  block->guest_addr = guest_addr;
+  block->fastmem = fastmem;
+  block->tier = tier;
+  block->num_runs = num_runs;
   return block;
 }
 
+static void jit_update_queue_depth(struct jit_queue *queue) {
+  int depth = 0;
+
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    struct jit_job *job = &queue->jobs[i];
+    if (job->state == JOB_PENDING || job->state == JOB_COMPILING) {
+      depth++;
+    }
+  }
+
+  prof_counter_set(COUNTER_jit_queue_depth, depth);
+}
+
+static void jit_release_job(struct jit_queue *queue, struct jit_job *job) {
+  /* free the block if it was never published */
+  free(job->block);
+  job->block = NULL;
+  job->state = JOB_FREE;
+}
+
+static void jit_discard_jobs(struct jit *jit) {
+  struct jit_queue *queue = jit->queue;
+
+  mutex_lock(queue->mutex);
+
+  /* any job currently being compiled will be discarded once it's finished */
+  queue->generation++;
+
+  list_for_each_entry_safe(job, &queue->pending, struct jit_job, it) {
+    list_remove(&queue->pending, &job->it);
+    jit_release_job(queue, job);
+  }
+
+  list_for_each_entry_safe(job, &queue->finished, struct jit_job, it) {
+    list_remove(&queue->finished, &job->it);
+    jit_release_job(queue, job);
+  }
+
+  jit_update_queue_depth(queue);
+
+  mutex_unlock(queue->mutex);
+}
+
 void jit_free_blocks(struct jit *jit) {
+  /* wait for any in-progress background compile to finish before resetting
+     the backend's code buffers out from under it */
+  if (jit->queue) {
+    mutex_lock(jit->queue->compile_mutex);
+    jit_discard_jobs(jit);
+  }
+
   /* invalidate code pointers and remove block entries from lookup maps. this
      is only safe to use when no code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
-
-  while (it) {
-    struct rb_node *next = rb_next(it);
-
-    struct jit_block *block = container_of(it, struct jit_block, it);
+  list_for_each_entry_safe(block, &jit->blocks, struct jit_block, it) {
     jit_free_block(jit, block);
-
-    it = next;
   }
 
+  jit->max_block_pages = 0;
+
+  jit_unprotect_pages(jit);
+
   /* have the backend reset its code buffers */
   jit->backend->reset(jit->backend);
+
+  if (jit->queue) {
+    mutex_unlock(jit->queue->compile_mutex);
+  }
+}
+
+static void jit_evict_region(struct jit *jit) {
+  PROF_ENTER("cpu", "jit_evict_region");
+
+  /* wait for any in-progress background compile to finish before moving the
+     backend on to the next region. jobs which have already been assembled may
+     be in the region being evicted, so they're discarded as well */
+  if (jit->queue) {
+    mutex_lock(jit->queue->compile_mutex);
+    jit_discard_jobs(jit);
+  }
+
+  void *begin, *end;
+  jit->backend->next_region(jit->backend, &begin, &end);
+
+  /* free only the blocks whose code lives in the region. freeing a block
+     restores the edges patched to jump into it from the remaining blocks.
+     the guest pages left without any blocks are unprotected, as no queued
+     block can still be waiting on them */
+  int num_evicted = 0;
+
+  list_for_each_entry_safe(block, &jit->blocks, struct jit_block, it) {
+    uint8_t *host_addr = block->host_addr;
+
+    if (host_addr >= (uint8_t *)begin && host_addr < (uint8_t *)end) {
+      uint32_t first, last;
+      jit_block_pages(block, &first, &last);
+
+      jit_free_block(jit, block);
+      jit_unprotect_empty_pages(jit, first, last);
+      num_evicted++;
+    }
+  }
+
+  prof_counter_add(COUNTER_jit_blocks_evicted, num_evicted);
+
+  if (jit->queue) {
+    mutex_unlock(jit->queue->compile_mutex);
+  }
+
+  PROF_LEAVE();
 }
 
 void jit_invalidate_blocks(struct jit *jit) {
+  /* blocks being compiled in the background were translated from what is now
+     stale code */
+  if (jit->queue) {
+    jit_discard_jobs(jit);
+  }
+
   /* invalidate code pointers, but don't remove block entries from lookup maps.
      this is used when clearing the jit while code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    jit_invalidate_block(jit, block);
+  }
+
+  /* don't reset backend code buffers, code is still running */
+}
 
-  while (it) {
-    struct rb_node *next = rb_next(it);
+void jit_invalidate_unprotected_blocks(struct jit *jit) {
+  PROF_ENTER("cpu", "jit_invalidate_unprotected_blocks");
 
-    struct jit_block *block = container_of(it, struct jit_block, it);
-    jit_invalidate_block(jit, block);
+  if (jit->queue) {
+    jit_discard_jobs(jit);
+  }
 
-    it = next;
+  /* blocks on write protected pages are invalidated as soon as their code is
+     written to, only the blocks whose code may have changed unnoticed need to
+     be invalidated */
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    if (!jit_is_protected(jit, block)) {
+      jit_invalidate_block(jit, block);
+    }
   }
 
-  /* don't reset backend code buffers, code is still running */
+  PROF_LEAVE();
 }
 
 void jit_add_edge(struct jit *jit, void *branch, uint32_t addr) {
@@ -268,6 +638,301 @@ static void jit_dump_block(struct jit *jit, uint32_t guest_addr,
   fclose(file);
 }
 
+static void jit_translate_block(struct jit *jit, struct jit_block *block,
+                                struct ir *ir) {
+  /* translate the source machine code into ir */
+  jit->frontend->translate_code(jit->frontend, block, ir);
+
+#if 0
+  jit->frontend->dump_code(jit->frontend, block);
+#endif
+
+  /* dump unoptimized block */
+  if (jit->dump_blocks) {
+    jit_dump_block(jit, block->guest_addr, ir);
+  }
+}
+
+static void jit_optimize_block(struct jit *jit, struct jit_block *block,
+                               struct ir *ir) {
+  if (block->tier >= JIT_TIER_OPTIMIZED) {
+    lse_run(jit->lse, ir);
+    cprop_run(jit->cprop, ir);
+    esimp_run(jit->esimp, ir);
+    cse_run(jit->cse, ir);
+    dce_run(jit->dce, ir);
+  }
+
+  ra_run(jit->ra, ir);
+}
+
+static void jit_profile_block(struct jit *jit, struct jit_block *block) {
+  /* baseline blocks always count their runs, in order to be promoted once
+     they become hot */
+  block->profile = jit->profile_blocks || block->tier < JIT_TIER_OPTIMIZED;
+  block->promote_runs =
+      block->tier < JIT_TIER_OPTIMIZED ? JIT_HOT_BLOCK_RUNS : 0;
+}
+
+static int jit_load_cached_block(struct jit *jit, struct jit_block *block,
+                                 struct ir *ir) {
+  /* when dumping, blocks always need to be translated */
+  if (!jit->cache || jit->dump_blocks) {
+    return 0;
+  }
+
+  if (!jit_cache_load(jit->cache, block, ir)) {
+    return 0;
+  }
+
+  /* only optimized blocks are cached */
+  block->tier = JIT_TIER_OPTIMIZED;
+
+  return 1;
+}
+
+static void jit_interpret_block(struct jit *jit, uint32_t guest_addr) {
+  PROF_ENTER("cpu", "jit_interpret_block");
+
+  struct jit_guest *guest = jit->guest;
+  uint8_t *ctx = guest->ctx;
+  uint32_t *pc = (uint32_t *)(ctx + guest->offset_pc);
+  int32_t *run_cycles = (int32_t *)(ctx + guest->offset_cycles);
+  int32_t *ran_instrs = (int32_t *)(ctx + guest->offset_instrs);
+
+  struct jit_block block = {0};
+  block.guest_addr = guest_addr;
+  jit->frontend->analyze_code(jit->frontend, &block);
+
+  uint32_t end = guest_addr + block.guest_size;
+  uint32_t addr = 0;
+  int cycles = 0;
+  int instrs = 0;
+
+  /* run each instruction through its fallback until the pc leaves the block.
+     stop early on a backwards branch within the block as well, giving dispatch
+     a chance to check the remaining cycles and pending interrupts */
+  do {
+    addr = *pc;
+    uint32_t data = guest->r32(guest->space, addr);
+    const struct jit_opdef *def =
+        jit->frontend->lookup_op(jit->frontend, &data);
+    def->fallback(guest, addr, data);
+    cycles += def->cycles;
+    instrs++;
+  } while (*pc > addr && *pc < end);
+
+  *run_cycles -= cycles;
+  *ran_instrs += instrs;
+
+  PROF_LEAVE();
+}
+
+static int jit_publish_jobs(struct jit *jit) {
+  struct jit_queue *queue = jit->queue;
+  int overflow = 0;
+
+  list_for_each_entry_safe(job, &queue->finished, struct jit_job, it) {
+    list_remove(&queue->finished, &job->it);
+
+    struct jit_block *block = job->block;
+
+    if (job->generation != queue->generation) {
+      /* the cache was invalidated while the block was being compiled */
+    } else if (!job->assembled) {
+      /* the backend overflowed, a region needs to be evicted once the lock
+         has been released */
+      overflow = 1;
+    } else {
+      /* free the existing block for this entry, be it a block invalidated by a
+         fastmem exception, or a stale block for another guest address which
+         maps to the same entry. note, if the entry is still live, another
+         address mapping to the same entry beat this block to it */
+      struct jit_block *existing = *jit_block_ptr(jit, block->guest_addr);
+
+      if (!existing || jit_is_stale(jit, existing)) {
+        if (existing) {
+          jit_free_block(jit, existing);
+        }
+
+        if (jit->cache && !job->cached &&
+            block->tier >= JIT_TIER_OPTIMIZED) {
+          jit_cache_save(jit->cache, block, &job->key, &job->ir);
+        }
+
+        jit_finalize_block(jit, block);
+        job->block = NULL;
+
+        int64_t now = time_nanoseconds();
+        prof_counter_set(COUNTER_jit_time_to_native,
+                         (now - job->queue_time) / 1000);
+      }
+    }
+
+    jit_release_job(queue, job);
+  }
+
+  return overflow;
+}
+
+static void jit_queue_block(struct jit *jit, uint32_t guest_addr) {
+  struct jit_queue *queue = jit->queue;
+
+  mutex_lock(queue->mutex);
+
+  int overflow = jit_publish_jobs(jit);
+
+  if (overflow) {
+    mutex_unlock(queue->mutex);
+
+    /* make room in the code buffer and let dispatch try to compile again */
+    jit_evict_region(jit);
+    return;
+  }
+
+  /* if the block just finished compiling, let dispatch run it */
+  struct jit_block *existing = jit_get_block(jit, guest_addr);
+  if (existing && !jit_is_stale(jit, existing)) {
+    mutex_unlock(queue->mutex);
+    return;
+  }
+
+  /* queue up the block if it isn't already in flight and there's room */
+  struct jit_job *job = NULL;
+
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    struct jit_job *it = &queue->jobs[i];
+
+    if (it->state == JOB_FREE) {
+      job = job ? job : it;
+    } else if (it->block->guest_addr == guest_addr) {
+      job = NULL;
+      break;
+    }
+  }
+
+  if (job) {
+    job->block = jit_alloc_block(jit, guest_addr);
+    memset(&job->ir, 0, sizeof(job->ir));
+    job->ir.buffer = job->ir_buffer;
+    job->ir.capacity = sizeof(jit->ir_buffer);
+    job->cached = jit_load_cached_block(jit, job->block, &job->ir);
+
+    if (!job->cached) {
+      jit_translate_block(jit, job->block, &job->ir);
+
+      /* key the block by the guest code it was translated from, which may
+         change before the block is published */
+      if (jit->cache) {
+        jit_cache_key(jit->cache, job->block, &job->key);
+      }
+    }
+
+    jit_protect_block(jit, job->block);
+
+    jit_profile_block(jit, job->block);
+
+    job->state = JOB_PENDING;
+    job->generation = queue->generation;
+    job->queue_time = time_nanoseconds();
+    list_add(&queue->pending, &job->it);
+    jit_update_queue_depth(queue);
+
+    cond_signal(queue->cond);
+  }
+
+  mutex_unlock(queue->mutex);
+
+  /* run the block through the interpreter until its code is ready */
+  jit_interpret_block(jit, guest_addr);
+}
+
+static void *jit_queue_thread(void *data) {
+  struct jit *jit = data;
+  struct jit_queue *queue = jit->queue;
+
+  while (1) {
+    mutex_lock(queue->mutex);
+
+    while (queue->running && list_empty(&queue->pending)) {
+      cond_wait(queue->cond, queue->mutex);
+    }
+
+    if (!queue->running) {
+      mutex_unlock(queue->mutex);
+      break;
+    }
+
+    struct jit_job *job =
+        list_first_entry(&queue->pending, struct jit_job, it);
+    list_remove(&queue->pending, &job->it);
+    job->state = JOB_COMPILING;
+
+    mutex_unlock(queue->mutex);
+
+    mutex_lock(queue->compile_mutex);
+    if (!job->cached) {
+      jit_optimize_block(jit, job->block, &job->ir);
+    }
+    job->assembled =
+        jit->backend->assemble_code(jit->backend, job->block, &job->ir);
+    mutex_unlock(queue->compile_mutex);
+
+    mutex_lock(queue->mutex);
+    job->state = JOB_FINISHED;
+    list_add(&queue->finished, &job->it);
+    jit_update_queue_depth(queue);
+    mutex_unlock(queue->mutex);
+  }
+
+  return NULL;
+}
+
+static void jit_destroy_queue(struct jit *jit) {
+  struct jit_queue *queue = jit->queue;
+
+  if (queue->thread) {
+    mutex_lock(queue->mutex);
+    queue->running = 0;
+    cond_signal(queue->cond);
+    mutex_unlock(queue->mutex);
+
+    void *result;
+    thread_join(queue->thread, &result);
+  }
+
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    struct jit_job *job = &queue->jobs[i];
+    free(job->block);
+    free(job->ir_buffer);
+  }
+
+  cond_destroy(queue->cond);
+  mutex_destroy(queue->compile_mutex);
+  mutex_destroy(queue->mutex);
+
+  free(queue);
+  jit->queue = NULL;
+}
+
+static void jit_create_queue(struct jit *jit) {
+  struct jit_queue *queue = calloc(1, sizeof(struct jit_queue));
+  jit->queue = queue;
+
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    struct jit_job *job = &queue->jobs[i];
+    job->ir_buffer = malloc(sizeof(jit->ir_buffer));
+  }
+
+  queue->mutex = mutex_create();
+  queue->cond = cond_create();
+  queue->compile_mutex = mutex_create();
+
+  queue->running = 1;
+  queue->thread = thread_create(&jit_queue_thread, "jit", jit);
+  CHECK_NOTNULL(queue->thread);
+}
+
 void jit_compile_block(struct jit *jit, uint32_t guest_addr) {
   PROF_ENTER("cpu", "jit_compile_block");
 
@@ -275,53 +940,47 @@ void jit_compile_block(struct jit *jit, uint32_t guest_addr) {
   LOG_INFO("jit_compile_block %s 0x%08x", jit->tag, guest_addr);
 #endif
 
-  /* for debug builds, fastmem can be troublesome when running under gdb or
-     lldb. when doing so, SIGSEGV handling can be completely disabled with:
-     handle SIGSEGV nostop noprint pass
-     however, then legitimate SIGSEGV will also not be handled by the debugger.
-     as of this writing, there is no way to configure the debugger to ignore the
-     signal initially, letting us try to handle it, and then handling it in the
-     case that we do not (e.g. because it was not a fastmem-related segfault).
-     because of this, fastmem is default disabled for debug builds to cause less
-     headaches */
-  int fastmem = 1;
-#ifndef NDEBUG
-  fastmem = 0;
-#endif
+  /* when compiling in the background, queue the block up and interpret it in
+     the meantime */
+  if (jit->queue) {
+    jit_queue_block(jit, guest_addr);
+    PROF_LEAVE();
+    return;
+  }
 
-  /* if the block being compiled had previously been invalidated by a fastmem
-     exception, finish removing it at this time and disable fastmem opts */
-  struct jit_block *existing = jit_get_block(jit, guest_addr);
+  struct jit_block *block = jit_alloc_block(jit, guest_addr);
+
+  /* if the block being compiled had previously been invalidated, finish
+     removing it at this time. note, the existing entry may also be a stale
+     block for a different guest address which maps to the same entry */
+  struct jit_block *existing = *jit_block_ptr(jit, guest_addr);
   if (existing) {
-    fastmem = existing->fastmem;
     jit_free_block(jit, existing);
   }
 
-  struct jit_block *block = jit_alloc_block(jit);
-  block->guest_addr = guest_addr;
-  block->fastmem = fastmem;
-
-  /* translate the source machine code into ir */
   struct ir ir = {0};
   ir.buffer = jit->ir_buffer;
   ir.capacity = sizeof(jit->ir_buffer);
-  jit->frontend->translate_code(jit->frontend, block, &ir);
-
-#if 0
-  jit->frontend->dump_code(jit->frontend, block);
-#endif
-
-  /* dump unoptimized block */
-  if (jit->dump_blocks) {
-    jit_dump_block(jit, guest_addr, &ir);
+  if (jit->backend->decodes_code) {
+    /* the backend decodes the guest code itself, only the block's extent is
+       needed */
+    jit->frontend->analyze_code(jit->frontend, block);
+  } else if (!jit_load_cached_block(jit, block, &ir)) {
+    jit_translate_block(jit, block, &ir);
+
+    /* run optimization passes */
+    jit_optimize_block(jit, block, &ir);
+
+    if (jit->cache && block->tier >= JIT_TIER_OPTIMIZED) {
+      struct jit_cache_key key;
+      jit_cache_key(jit->cache, block, &key);
+      jit_cache_save(jit->cache, block, &key, &ir);
+    }
   }
 
-  /* run optimization passes */
-  lse_run(jit->lse, &ir);
-  cprop_run(jit->cprop, &ir);
-  esimp_run(jit->esimp, &ir);
-  dce_run(jit->dce, &ir);
-  ra_run(jit->ra, &ir);
+  jit_protect_block(jit, block);
+
+  jit_profile_block(jit, block);
 
   /* assemble the ir into native code */
   int res = jit->backend->assemble_code(jit->backend, block, &ir);
@@ -333,18 +992,153 @@ void jit_compile_block(struct jit *jit, uint32_t guest_addr) {
 
     jit_finalize_block(jit, block);
   } else {
-    /* if the backend overflowed, completely free the cache and let dispatch
-       try to compile again */
-    LOG_INFO("backend overflow, resetting code cache");
-    jit_free_blocks(jit);
+    /* if the backend's current region is full, evict the next one and let
+       dispatch try to compile again */
+    free(block);
+    jit_evict_region(jit);
   }
 
   PROF_LEAVE();
 }
 
+void jit_promote_block(struct jit *jit, uint32_t guest_addr) {
+  struct jit_block *block = jit_get_block(jit, guest_addr);
+  CHECK_NOTNULL(block);
+
+  /* invalidate the block so it's recompiled at the next tier on its next
+     run */
+  block->tier++;
+  jit_invalidate_block(jit, block);
+}
+
+int jit_get_hot_blocks(struct jit *jit, struct jit_block **blocks, int max) {
+  int n = 0;
+
+  /* insertion sort the most ran blocks */
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    if (!block->num_runs) {
+      continue;
+    }
+
+    int i = MIN(n, max - 1);
+
+    if (i < 0 || (n == max && blocks[i]->num_runs >= block->num_runs)) {
+      continue;
+    }
+
+    while (i > 0 && blocks[i - 1]->num_runs < block->num_runs) {
+      blocks[i] = blocks[i - 1];
+      i--;
+    }
+
+    blocks[i] = block;
+    n = MIN(n + 1, max);
+  }
+
+  return n;
+}
+
+void jit_dump_hot_blocks(struct jit *jit) {
+  struct jit_block *blocks[JIT_MAX_HOT_BLOCKS];
+  int n = jit_get_hot_blocks(jit, blocks, JIT_MAX_HOT_BLOCKS);
+
+  const char *appdir = fs_appdir();
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s_hot_blocks.txt",
+           appdir, jit->tag);
+
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("jit_dump_hot_blocks failed to open %s", filename);
+    return;
+  }
+
+  fprintf(file, "# guest_addr runs instrs cycles tier\n");
+
+  for (int i = 0; i < n; i++) {
+    struct jit_block *block = blocks[i];
+    fprintf(file, "0x%08x %d %d %d %d\n", block->guest_addr, block->num_runs,
+            block->num_instrs, block->num_cycles, block->tier);
+  }
+
+  fclose(file);
+
+  LOG_INFO("jit_dump_hot_blocks wrote %d blocks to %s", n, filename);
+}
+
+static int jit_handle_code_write(struct jit *jit, struct exception_state *ex) {
+  struct jit_guest *guest = jit->guest;
+
+  if (!guest->protect_code) {
+    return 0;
+  }
+
+  /* make sure the fault was for an address inside of the guest's memory */
+  uintptr_t mem = (uintptr_t)guest->mem;
+  if (ex->fault_addr < mem || ex->fault_addr - mem > UINT32_MAX) {
+    return 0;
+  }
+
+  uint32_t addr = (uint32_t)(ex->fault_addr - mem) & ~(JIT_CODE_PAGE_SIZE - 1);
+  struct jit_code_page *page = jit_code_page(jit, addr);
+
+  if (!page->protect) {
+    return 0;
+  }
+
+  /* multiple guest addresses map to the same page entry, the guest will
+     refuse to unprotect the page if it's not backed by the protected memory */
+  if (!guest->protect_code(guest->data, addr, JIT_CODE_PAGE_SIZE, 0)) {
+    return 0;
+  }
+
+  page->protect = 0;
+  page->writes = MIN(page->writes + 1, JIT_MAX_CODE_PAGE_WRITES);
+
+  /* blocks being compiled in the background may have been translated from
+     the page */
+  if (jit->queue) {
+    jit_discard_jobs(jit);
+  }
+
+  /* invalidate each block translated from the page. note, as with fastmem
+     exceptions, the blocks can't be removed from the lookup maps as one of
+     them may be what's currently executing */
+  int num_modified = 0;
+
+  list_for_each_entry(ref, &page->blocks, struct jit_page_ref, it) {
+    struct jit_block *block = ref->block;
+
+    if (!jit_is_stale(jit, block)) {
+      jit_invalidate_block(jit, block);
+      num_modified++;
+    }
+  }
+
+  prof_counter_add(COUNTER_jit_blocks_modified, num_modified);
+
+  return 1;
+}
+
 static int jit_handle_exception(void *data, struct exception_state *ex) {
   struct jit *jit = data;
 
+  /* the blocks can only be modified by the thread running them */
+  if (jit->thread != &jit_thread) {
+    return 0;
+  }
+
+  /* writes to protected code can come from anywhere on that thread, not just
+     compiled code */
+  if (jit_handle_code_write(jit, ex)) {
+    return 1;
+  }
+
+  if (jit_running != jit) {
+    return 0;
+  }
+
   /* see if there is a cached block corresponding to the current pc */
   struct jit_block *block = jit_lookup_block_reverse(jit, (void *)ex->pc);
 
@@ -368,10 +1162,61 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
 }
 
 void jit_run(struct jit *jit, int cycles) {
+  jit->thread = &jit_thread;
+  jit_running = jit;
   jit->backend->run_code(jit->backend, cycles);
+  jit_running = NULL;
+}
+
+void jit_close_cache(struct jit *jit) {
+  if (!jit->cache) {
+    return;
+  }
+
+  jit_cache_destroy(jit->cache);
+  jit->cache = NULL;
+}
+
+void jit_open_cache(struct jit *jit, const char *name) {
+  jit_close_cache(jit);
+
+  if (!OPTION_jit_cache) {
+    return;
+  }
+
+  /* blocks in flight weren't keyed for the new cache */
+  if (jit->queue) {
+    jit_discard_jobs(jit);
+  }
+
+  const char *appdir = fs_appdir();
+
+  /* the cache is only an optimization, run without it if it can't be stored */
+  char cachedir[PATH_MAX];
+  snprintf(cachedir, sizeof(cachedir), "%s" PATH_SEPARATOR "cache", appdir);
+  if (!fs_mkdir(cachedir)) {
+    LOG_WARNING("jit_open_cache failed to create %s", cachedir);
+    return;
+  }
+
+  char filename[PATH_MAX];
+  int n = snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s_%s.bin",
+                   cachedir, name, jit->tag);
+  if (n < 0 || n >= (int)sizeof(filename)) {
+    LOG_WARNING("jit_open_cache path for %s is too long", name);
+    return;
+  }
+
+  jit->cache = jit_cache_create(jit, filename);
 }
 
 void jit_destroy(struct jit *jit) {
+  if (jit->queue) {
+    jit_destroy_queue(jit);
+  }
+
+  jit_close_cache(jit);
+
   if (OPTION_perf) {
     if (jit->perf_map) {
       fclose(jit->perf_map);
@@ -386,6 +1231,10 @@ void jit_destroy(struct jit *jit) {
     dce_destroy(jit->dce);
   }
 
+  if (jit->cse) {
+    cse_destroy(jit->cse);
+  }
+
   if (jit->esimp) {
     esimp_destroy(jit->esimp);
   }
@@ -402,6 +1251,9 @@ void jit_destroy(struct jit *jit) {
     exception_handler_remove(jit->exc_handler);
   }
 
+  free(jit->code_pages);
+  free(jit->block_map);
+
   free(jit);
 }
 
@@ -419,6 +1271,14 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
 
   jit->guest = guest;
 
+  /* initialize block map, one entry per possible block begin */
+  jit->block_shift = ctz32(guest->addr_mask);
+  int num_entries = (guest->addr_mask >> jit->block_shift) + 1;
+  jit->block_map = calloc(num_entries, sizeof(struct jit_block *));
+
+  int num_pages = (guest->addr_mask >> JIT_CODE_PAGE_SHIFT) + 1;
+  jit->code_pages = calloc(num_pages, sizeof(struct jit_code_page));
+
   /* setup exception handler to deal with self-modifying code and fastmem
      related exceptions */
   jit->exc_handler = exception_handler_add(jit, &jit_handle_exception);
@@ -426,6 +1286,7 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
   jit->lse = lse_create();
   jit->cprop = cprop_create();
   jit->esimp = esimp_create();
+  jit->cse = cse_create();
   jit->dce = dce_create();
   jit->ra = ra_create(jit->backend->registers, jit->backend->num_registers,
                       jit->backend->emitters, jit->backend->num_emitters);
@@ -444,5 +1305,10 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
   jit->frontend->init(jit->frontend);
   jit->backend->init(jit->backend);
 
+  /* only backends compiling ir have anything worth queueing up */
+  if (OPTION_async_jit && !jit->backend->decodes_code) {
+    jit_create_queue(jit);
+  }
+
   return jit;
 }
@@ -3,13 +3,16 @@
 
 #include <stdio.h>
 #include "core/list.h"
-#include "core/rb_tree.h"
+#include "jit/backend/jit_backend.h"
 
 struct address_space;
 struct cfa;
 struct cprop;
+struct cse;
 struct dce;
 struct ir;
+struct jit_cache;
+struct jit_queue;
 struct lse;
 struct ra;
 struct val;
@@ -17,6 +20,14 @@ struct val;
 typedef uint32_t (*mem_read_cb)(void *, uint32_t, uint32_t);
 typedef void (*mem_write_cb)(void *, uint32_t, uint32_t, uint32_t);
 
+/* optimization tiers blocks are compiled at */
+enum {
+  /* only the passes required to generate code are ran */
+  JIT_TIER_BASELINE,
+  /* all passes are ran */
+  JIT_TIER_OPTIMIZED,
+};
+
 struct jit_block {
   /* address of source block in guest memory */
   uint32_t guest_addr;
@@ -35,13 +46,28 @@ struct jit_block {
   /* estimated number of guest cycles to execute block */
   int num_cycles;
 
+  /* optimization tier the block was compiled at */
+  int tier;
+
+  /* number of times the block has been ran. this is only counted by the
+     block's prologue when profile is set. once promote_runs is reached, the
+     block is recompiled at the next tier */
+  int num_runs;
+  int profile;
+  int promote_runs;
+
   /* edges to other blocks */
   struct list in_edges;
   struct list out_edges;
 
+  /* links into the block list of each page of guest code the block was
+     translated from */
+  struct jit_page_ref *page_refs;
+  int num_page_refs;
+
   /* lookup map iterators */
-  struct rb_node it;
-  struct rb_node rit;
+  struct list_node it;
+  struct list_node rit;
 };
 
 struct jit_edge {
@@ -78,6 +104,9 @@ struct jit_guest {
   struct address_space *space;
   void (*lookup)(struct address_space *, uint32_t, void **, void **,
                  mem_read_cb *, mem_write_cb *, uint32_t *);
+  /* optional, returns the host memory backing a side-effect free 32-bit mmio
+     register, letting constant address accesses to it bypass the callbacks */
+  void *(*lookup_storage)(struct address_space *, uint32_t, int);
   uint8_t (*r8)(struct address_space *, uint32_t);
   uint16_t (*r16)(struct address_space *, uint32_t);
   uint32_t (*r32)(struct address_space *, uint32_t);
@@ -86,8 +115,43 @@ struct jit_guest {
   void (*w16)(struct address_space *, uint32_t, uint16_t);
   void (*w32)(struct address_space *, uint32_t, uint32_t);
   void (*w64)(struct address_space *, uint32_t, uint64_t);
+
+  /* write protect or unprotect a page of guest code, used to detect
+     self-modifying code. returns 0 if the memory backing the address can't be
+     protected */
+  int (*protect_code)(void *, uint32_t, uint32_t, int);
 };
 
+/* guest code is tracked per page in order to invalidate only the blocks
+   affected by a write to it */
+#define JIT_CODE_PAGE_SHIFT 12
+#define JIT_CODE_PAGE_SIZE (1 << JIT_CODE_PAGE_SHIFT)
+
+/* number of writes a page of guest code can take before it's left
+   unprotected, avoiding constant exceptions for pages mixing code and data */
+#define JIT_MAX_CODE_PAGE_WRITES 16
+
+struct jit_code_page {
+  /* guest address the page was protected through */
+  uint32_t addr;
+  uint8_t protect;
+  uint8_t writes;
+
+  /* blocks translated from the page */
+  struct list blocks;
+};
+
+struct jit_page_ref {
+  struct jit_block *block;
+  struct list_node it;
+};
+
+/* host code is bucketed by page for reverse lookups. there is a bucket for each
+   page of the code buffer the native backends are given, so none of its pages
+   share a bucket */
+#define JIT_REVERSE_PAGE_SHIFT 12
+#define JIT_REVERSE_BUCKETS (JIT_CODE_BUFFER_SIZE >> JIT_REVERSE_PAGE_SHIFT)
+
 struct jit {
   char tag[32];
 
@@ -96,11 +160,16 @@ struct jit {
   struct jit_guest *guest;
   struct exception_handler *exc_handler;
 
+  /* thread running the compiled code, the only one allowed to service its
+     exceptions */
+  void *thread;
+
   /* passes */
   struct cfa *cfa;
   struct lse *lse;
   struct cprop *cprop;
   struct esimp *esimp;
+  struct cse *cse;
   struct dce *dce;
   struct ra *ra;
 
@@ -108,14 +177,36 @@ struct jit {
   uint8_t ir_buffer[1024 * 1024 * 2];
 
   /* compiled blocks */
-  struct rb_tree blocks;
-  struct rb_tree reverse_blocks;
+  struct list blocks;
+
+  /* compiled blocks directly mapped by guest address, using the same mapping
+     as the backend's code cache */
+  struct jit_block **block_map;
+  int block_shift;
+
+  /* protection state of each page of guest code, indexed by the masked guest
+     address */
+  struct jit_code_page *code_pages;
+
+  /* compiled blocks bucketed by the host page their code begins in. each
+     bucket is kept sorted by host address */
+  struct list reverse_map[JIT_REVERSE_BUCKETS];
+  int max_block_pages;
+
+  /* background compilation queue, only created when enabled */
+  struct jit_queue *queue;
+
+  /* persistent cache of optimized blocks, only created once opened */
+  struct jit_cache *cache;
 
   /* compiled block perf map */
   FILE *perf_map;
 
   /* dump ir to application directory as blocks compile */
   int dump_blocks;
+
+  /* count the runs of every block, not only those waiting to be promoted */
+  int profile_blocks;
 };
 
 struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
@@ -125,9 +216,17 @@ void jit_destroy(struct jit *jit);
 void jit_run(struct jit *jit, int cycles);
 
 void jit_compile_block(struct jit *jit, uint32_t guest_addr);
+void jit_promote_block(struct jit *jit, uint32_t guest_addr);
 void jit_add_edge(struct jit *jit, void *code, uint32_t dst);
 
 void jit_invalidate_blocks(struct jit *jit);
+void jit_invalidate_unprotected_blocks(struct jit *jit);
 void jit_free_blocks(struct jit *jit);
 
+int jit_get_hot_blocks(struct jit *jit, struct jit_block **blocks, int max);
+void jit_dump_hot_blocks(struct jit *jit);
+
+void jit_open_cache(struct jit *jit, const char *name);
+void jit_close_cache(struct jit *jit);
+
 #endif
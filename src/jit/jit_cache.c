@@ -0,0 +1,741 @@
+#include "jit/jit_cache.h"
+#include "core/assert.h"
+#include "core/filesystem.h"
+#include "core/math.h"
+#include "core/md5.h"
+#include "core/profiler.h"
+#include "jit/backend/jit_backend.h"
+#include "jit/frontend/jit_frontend.h"
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+
+#define JIT_CACHE_MAGIC 0x4354494a
+#define JIT_CACHE_VERSION 2
+#define JIT_CACHE_BUCKETS 0x10000
+
+/* argument encodings */
+enum {
+  ARG_NONE,
+  ARG_INSTR,
+  ARG_BLOCK,
+  ARG_CONST,
+  /* fallback function pointers are looked up again from the raw instruction
+     when loaded */
+  ARG_FALLBACK,
+};
+
+/* host pointers embedded in the ir as i64 constants need to be relocated when
+   loaded by a later run, as the executable and heap will likely be mapped to
+   different addresses. these constants are marked by the frontends, and must
+   either be the guest's runtime data, or reference code / static data in the
+   executable */
+enum {
+  RELOC_NONE,
+  RELOC_IMAGE,
+  RELOC_DATA,
+};
+
+struct jit_cache_header {
+  uint32_t magic;
+  uint32_t version;
+  char layout[JIT_CACHE_HASH_SIZE];
+  int num_entries;
+};
+
+struct jit_cache_entry {
+  uint32_t guest_addr;
+  int guest_size;
+  int num_instrs;
+  int num_cycles;
+  int flags;
+  char hash[JIT_CACHE_HASH_SIZE];
+
+  /* serialized ir */
+  int num_blocks;
+  int num_ir_instrs;
+  int locals_size;
+  int offset;
+  int size;
+
+  /* next entry in the same bucket */
+  int next;
+};
+
+struct jit_cache_reader {
+  const uint8_t *ptr;
+  const uint8_t *end;
+  int error;
+};
+
+struct jit_cache {
+  struct jit *jit;
+  char path[PATH_MAX];
+  char layout[JIT_CACHE_HASH_SIZE];
+  int dirty;
+
+  /* relocation bases */
+  int64_t image;
+  int64_t data;
+
+  /* cached blocks, hashed by guest address */
+  struct jit_cache_entry *entries;
+  int num_entries;
+  int max_entries;
+  int buckets[JIT_CACHE_BUCKETS];
+
+  /* serialized ir for all cached blocks */
+  uint8_t *buffer;
+  int buffer_size;
+  int buffer_capacity;
+
+  /* scratch space used to resolve references while loading */
+  struct ir_block **blocks;
+  int max_blocks;
+  struct ir_instr **instrs;
+  int max_instrs;
+};
+
+static int jit_cache_bucket(uint32_t guest_addr) {
+  return (guest_addr >> 1) & (JIT_CACHE_BUCKETS - 1);
+}
+
+static struct jit_cache_entry *jit_cache_find(struct jit_cache *cache,
+                                              uint32_t guest_addr, int flags) {
+  int i = cache->buckets[jit_cache_bucket(guest_addr)];
+
+  while (i != -1) {
+    struct jit_cache_entry *entry = &cache->entries[i];
+
+    if (entry->guest_addr == guest_addr && entry->flags == flags) {
+      return entry;
+    }
+
+    i = entry->next;
+  }
+
+  return NULL;
+}
+
+static struct jit_cache_entry *jit_cache_alloc_entry(struct jit_cache *cache,
+                                                     uint32_t guest_addr,
+                                                     int flags) {
+  /* replace any existing entry for the same block */
+  struct jit_cache_entry *entry = jit_cache_find(cache, guest_addr, flags);
+
+  if (entry) {
+    return entry;
+  }
+
+  if (cache->num_entries >= cache->max_entries) {
+    cache->max_entries = MAX(cache->max_entries * 2, 1024);
+    cache->entries = realloc(cache->entries, cache->max_entries *
+                                                 sizeof(struct jit_cache_entry));
+  }
+
+  int bucket = jit_cache_bucket(guest_addr);
+  int i = cache->num_entries++;
+
+  entry = &cache->entries[i];
+  memset(entry, 0, sizeof(*entry));
+  entry->guest_addr = guest_addr;
+  entry->flags = flags;
+  entry->next = cache->buckets[bucket];
+  cache->buckets[bucket] = i;
+
+  return entry;
+}
+
+static uint8_t *jit_cache_reserve(struct jit_cache *cache, int size) {
+  int required = cache->buffer_size + size;
+
+  if (required > cache->buffer_capacity) {
+    int capacity = MAX(cache->buffer_capacity, 0x10000);
+    while (capacity < required) {
+      capacity *= 2;
+    }
+    cache->buffer = realloc(cache->buffer, capacity);
+    cache->buffer_capacity = capacity;
+  }
+
+  uint8_t *ptr = cache->buffer + cache->buffer_size;
+  cache->buffer_size += size;
+  return ptr;
+}
+
+static void jit_cache_write(struct jit_cache *cache, const void *ptr,
+                            int size) {
+  uint8_t *dst = jit_cache_reserve(cache, size);
+  memcpy(dst, ptr, size);
+}
+
+static void jit_cache_write_u8(struct jit_cache *cache, uint8_t v) {
+  jit_cache_write(cache, &v, sizeof(v));
+}
+
+static void jit_cache_write_i32(struct jit_cache *cache, int32_t v) {
+  jit_cache_write(cache, &v, sizeof(v));
+}
+
+static void jit_cache_read(struct jit_cache_reader *r, void *ptr, int size) {
+  if (r->ptr + size > r->end) {
+    memset(ptr, 0, size);
+    r->error = 1;
+    return;
+  }
+
+  memcpy(ptr, r->ptr, size);
+  r->ptr += size;
+}
+
+static uint8_t jit_cache_read_u8(struct jit_cache_reader *r) {
+  uint8_t v;
+  jit_cache_read(r, &v, sizeof(v));
+  return v;
+}
+
+static int32_t jit_cache_read_i32(struct jit_cache_reader *r) {
+  int32_t v;
+  jit_cache_read(r, &v, sizeof(v));
+  return v;
+}
+
+static int jit_cache_flags(struct jit_cache *cache,
+                           const struct jit_block *block) {
+  struct jit_frontend *frontend = cache->jit->frontend;
+
+  int flags = 0;
+  if (frontend->translate_flags) {
+    flags = frontend->translate_flags(frontend, block);
+  }
+
+  return (flags << 1) | (block->fastmem ? 1 : 0);
+}
+
+static void jit_cache_hash(struct jit_cache *cache, uint32_t guest_addr,
+                           int guest_size, char *hash) {
+  struct jit_guest *guest = cache->jit->guest;
+
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+
+  uint8_t data[256];
+  int offset = 0;
+
+  while (offset < guest_size) {
+    int n = MIN(guest_size - offset, (int)sizeof(data));
+
+    for (int i = 0; i < n; i++) {
+      data[i] = guest->r8(guest->space, guest_addr + offset + i);
+    }
+
+    MD5_Update(&md5_ctx, data, n);
+    offset += n;
+  }
+
+  MD5_Final(hash, &md5_ctx);
+}
+
+static int jit_cache_write_const(struct jit_cache *cache,
+                                 const struct ir_value *v) {
+  jit_cache_write_u8(cache, v->type);
+
+  switch (v->type) {
+    case VALUE_I8:
+      jit_cache_write(cache, &v->i8, sizeof(v->i8));
+      break;
+    case VALUE_I16:
+      jit_cache_write(cache, &v->i16, sizeof(v->i16));
+      break;
+    case VALUE_I32:
+      jit_cache_write(cache, &v->i32, sizeof(v->i32));
+      break;
+    case VALUE_I64: {
+      int64_t i64 = v->i64;
+      int reloc = RELOC_NONE;
+
+      if (v->host_ptr) {
+        if (i64 == cache->data) {
+          reloc = RELOC_DATA;
+          i64 = 0;
+        } else if (i64 - cache->image >= INT32_MIN &&
+                   i64 - cache->image <= INT32_MAX) {
+          reloc = RELOC_IMAGE;
+          i64 -= cache->image;
+        } else {
+          return 0;
+        }
+      }
+
+      jit_cache_write_u8(cache, reloc);
+      jit_cache_write(cache, &i64, sizeof(i64));
+    } break;
+    case VALUE_F32:
+      jit_cache_write(cache, &v->f32, sizeof(v->f32));
+      break;
+    case VALUE_F64:
+      jit_cache_write(cache, &v->f64, sizeof(v->f64));
+      break;
+    case VALUE_STRING: {
+      int len = (int)strlen(v->str);
+      jit_cache_write_i32(cache, len);
+      jit_cache_write(cache, v->str, len);
+    } break;
+    default:
+      LOG_FATAL("Unexpected value type");
+      break;
+  }
+
+  return 1;
+}
+
+static struct ir_value *jit_cache_read_const(struct jit_cache *cache,
+                                             struct jit_cache_reader *r,
+                                             struct ir *ir) {
+  enum ir_type type = jit_cache_read_u8(r);
+
+  switch (type) {
+    case VALUE_I8: {
+      int8_t v;
+      jit_cache_read(r, &v, sizeof(v));
+      return ir_alloc_i8(ir, v);
+    }
+    case VALUE_I16: {
+      int16_t v;
+      jit_cache_read(r, &v, sizeof(v));
+      return ir_alloc_i16(ir, v);
+    }
+    case VALUE_I32: {
+      int32_t v;
+      jit_cache_read(r, &v, sizeof(v));
+      return ir_alloc_i32(ir, v);
+    }
+    case VALUE_I64: {
+      int reloc = jit_cache_read_u8(r);
+      int64_t v;
+      jit_cache_read(r, &v, sizeof(v));
+      if (reloc == RELOC_DATA) {
+        return ir_alloc_ptr(ir, (void *)(intptr_t)(v + cache->data));
+      } else if (reloc == RELOC_IMAGE) {
+        return ir_alloc_ptr(ir, (void *)(intptr_t)(v + cache->image));
+      }
+      return ir_alloc_i64(ir, v);
+    }
+    case VALUE_F32: {
+      float v;
+      jit_cache_read(r, &v, sizeof(v));
+      return ir_alloc_f32(ir, v);
+    }
+    case VALUE_F64: {
+      double v;
+      jit_cache_read(r, &v, sizeof(v));
+      return ir_alloc_f64(ir, v);
+    }
+    case VALUE_STRING: {
+      char str[IR_MAX_LABEL];
+      int len = jit_cache_read_i32(r);
+      if (len < 0 || len >= (int)sizeof(str)) {
+        r->error = 1;
+        return NULL;
+      }
+      jit_cache_read(r, str, len);
+      str[len] = 0;
+      return ir_alloc_str(ir, "%s", str);
+    }
+    default:
+      r->error = 1;
+      return NULL;
+  }
+}
+
+static int jit_cache_write_instr(struct jit_cache *cache,
+                                 const struct ir_instr *instr) {
+  const struct ir_value *result = instr->result;
+
+  jit_cache_write_u8(cache, instr->op);
+  jit_cache_write_u8(cache, result ? result->type : VALUE_V);
+  jit_cache_write_i32(cache, result ? result->reg : NO_REGISTER);
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    const struct ir_value *arg = instr->arg[i];
+
+    if (!arg) {
+      jit_cache_write_u8(cache, ARG_NONE);
+    } else if (instr->op == OP_FALLBACK && i == 0) {
+      jit_cache_write_u8(cache, ARG_FALLBACK);
+    } else if (!ir_is_constant(arg)) {
+      jit_cache_write_u8(cache, ARG_INSTR);
+      jit_cache_write_i32(cache, (int32_t)arg->def->tag);
+    } else if (arg->type == VALUE_BLOCK) {
+      jit_cache_write_u8(cache, ARG_BLOCK);
+      jit_cache_write_i32(cache, (int32_t)arg->blk->tag);
+    } else {
+      jit_cache_write_u8(cache, ARG_CONST);
+
+      if (!jit_cache_write_const(cache, arg)) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+static int jit_cache_read_instr(struct jit_cache *cache,
+                                struct jit_cache_reader *r, struct ir *ir,
+                                int num_blocks, int index) {
+  struct jit_frontend *frontend = cache->jit->frontend;
+
+  enum ir_op op = jit_cache_read_u8(r);
+  enum ir_type type = jit_cache_read_u8(r);
+  int reg = jit_cache_read_i32(r);
+
+  if (r->error || op >= IR_NUM_OPS || type >= VALUE_NUM) {
+    return 0;
+  }
+
+  struct ir_instr *instr = ir_append_instr(ir, op, type);
+  if (instr->result) {
+    instr->result->reg = reg;
+  }
+  cache->instrs[index] = instr;
+
+  int fallback = 0;
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    int kind = jit_cache_read_u8(r);
+    struct ir_value *arg = NULL;
+
+    switch (kind) {
+      case ARG_NONE:
+        break;
+      case ARG_INSTR: {
+        int n = jit_cache_read_i32(r);
+        if (n < 0 || n >= index || !cache->instrs[n]->result) {
+          return 0;
+        }
+        arg = cache->instrs[n]->result;
+      } break;
+      case ARG_BLOCK: {
+        int n = jit_cache_read_i32(r);
+        if (n < 0 || n >= num_blocks) {
+          return 0;
+        }
+        arg = ir_alloc_block(ir, cache->blocks[n]);
+      } break;
+      case ARG_CONST:
+        arg = jit_cache_read_const(cache, r, ir);
+        break;
+      case ARG_FALLBACK:
+        fallback = 1;
+        break;
+      default:
+        return 0;
+    }
+
+    if (r->error) {
+      return 0;
+    }
+
+    if (arg) {
+      ir_set_arg(ir, instr, i, arg);
+    }
+  }
+
+  if (fallback) {
+    const struct ir_value *raw_instr = instr->arg[2];
+    if (!raw_instr || raw_instr->type != VALUE_I32) {
+      return 0;
+    }
+
+    uint32_t data = raw_instr->i32;
+    const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
+    ir_set_arg0(ir, instr, ir_alloc_ptr(ir, def->fallback));
+  }
+
+  return 1;
+}
+
+static void jit_cache_reset_ir(struct ir *ir) {
+  uint8_t *buffer = ir->buffer;
+  int capacity = ir->capacity;
+
+  memset(ir, 0, sizeof(*ir));
+  ir->buffer = buffer;
+  ir->capacity = capacity;
+}
+
+void jit_cache_key(struct jit_cache *cache, const struct jit_block *block,
+                   struct jit_cache_key *key) {
+  key->flags = jit_cache_flags(cache, block);
+  jit_cache_hash(cache, block->guest_addr, block->guest_size, key->hash);
+}
+
+int jit_cache_load(struct jit_cache *cache, struct jit_block *block,
+                   struct ir *ir) {
+  PROF_ENTER("cpu", "jit_cache_load");
+
+  int flags = jit_cache_flags(cache, block);
+  struct jit_cache_entry *entry =
+      jit_cache_find(cache, block->guest_addr, flags);
+
+  if (!entry) {
+    PROF_LEAVE();
+    return 0;
+  }
+
+  /* make sure the guest code hasn't changed since the block was cached */
+  char hash[JIT_CACHE_HASH_SIZE];
+  jit_cache_hash(cache, entry->guest_addr, entry->guest_size, hash);
+
+  if (strcmp(hash, entry->hash)) {
+    PROF_LEAVE();
+    return 0;
+  }
+
+  if (entry->num_blocks > cache->max_blocks) {
+    cache->max_blocks = entry->num_blocks;
+    cache->blocks =
+        realloc(cache->blocks, cache->max_blocks * sizeof(struct ir_block *));
+  }
+
+  if (entry->num_ir_instrs > cache->max_instrs) {
+    cache->max_instrs = entry->num_ir_instrs;
+    cache->instrs =
+        realloc(cache->instrs, cache->max_instrs * sizeof(struct ir_instr *));
+  }
+
+  /* create all blocks up front so branches can reference blocks which haven't
+     been read yet */
+  for (int i = 0; i < entry->num_blocks; i++) {
+    cache->blocks[i] = ir_append_block(ir);
+  }
+
+  struct jit_cache_reader r = {0};
+  r.ptr = cache->buffer + entry->offset;
+  r.end = r.ptr + entry->size;
+
+  int index = 0;
+  int res = 1;
+
+  for (int i = 0; i < entry->num_blocks && res; i++) {
+    ir_set_current_block(ir, cache->blocks[i]);
+
+    int num_instrs = jit_cache_read_i32(&r);
+    if (r.error || num_instrs < 0 ||
+        index + num_instrs > entry->num_ir_instrs) {
+      res = 0;
+      break;
+    }
+
+    for (int j = 0; j < num_instrs && res; j++) {
+      res = jit_cache_read_instr(cache, &r, ir, entry->num_blocks, index++);
+    }
+  }
+
+  if (!res) {
+    LOG_WARNING("jit_cache_load failed to read block 0x%08x",
+                block->guest_addr);
+    jit_cache_reset_ir(ir);
+    PROF_LEAVE();
+    return 0;
+  }
+
+  ir->locals_size = entry->locals_size;
+
+  block->guest_size = entry->guest_size;
+  block->num_instrs = entry->num_instrs;
+  block->num_cycles = entry->num_cycles;
+
+  PROF_LEAVE();
+
+  return 1;
+}
+
+void jit_cache_save(struct jit_cache *cache, const struct jit_block *block,
+                    const struct jit_cache_key *key, struct ir *ir) {
+  PROF_ENTER("cpu", "jit_cache_save");
+
+  /* number each block and instruction, references between them are encoded
+     as indices */
+  int num_blocks = 0;
+  int num_instrs = 0;
+
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    blk->tag = num_blocks++;
+
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      instr->tag = num_instrs++;
+    }
+  }
+
+  int offset = cache->buffer_size;
+
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    int n = 0;
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      n++;
+    }
+
+    jit_cache_write_i32(cache, n);
+
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      /* blocks referencing host pointers which can't be relocated aren't
+         cached */
+      if (!jit_cache_write_instr(cache, instr)) {
+        cache->buffer_size = offset;
+        PROF_LEAVE();
+        return;
+      }
+    }
+  }
+
+  /* note, the serialized ir for a replaced entry is left in the buffer until
+     the cache is written out */
+  struct jit_cache_entry *entry =
+      jit_cache_alloc_entry(cache, block->guest_addr, key->flags);
+  entry->guest_size = block->guest_size;
+  entry->num_instrs = block->num_instrs;
+  entry->num_cycles = block->num_cycles;
+  strncpy(entry->hash, key->hash, sizeof(entry->hash) - 1);
+  entry->hash[sizeof(entry->hash) - 1] = 0;
+  entry->num_blocks = num_blocks;
+  entry->num_ir_instrs = num_instrs;
+  entry->locals_size = ir->locals_size;
+  entry->offset = offset;
+  entry->size = cache->buffer_size - offset;
+
+  cache->dirty = 1;
+
+  PROF_LEAVE();
+}
+
+void jit_cache_flush(struct jit_cache *cache) {
+  if (!cache->dirty) {
+    return;
+  }
+
+  FILE *file = fopen(cache->path, "wb");
+  if (!file) {
+    LOG_WARNING("jit_cache_flush failed to open %s", cache->path);
+    return;
+  }
+
+  struct jit_cache_header header = {0};
+  header.magic = JIT_CACHE_MAGIC;
+  header.version = JIT_CACHE_VERSION;
+  memcpy(header.layout, cache->layout, sizeof(header.layout));
+  header.num_entries = cache->num_entries;
+  fwrite(&header, sizeof(header), 1, file);
+
+  for (int i = 0; i < cache->num_entries; i++) {
+    struct jit_cache_entry *entry = &cache->entries[i];
+    fwrite(entry, sizeof(*entry), 1, file);
+    fwrite(cache->buffer + entry->offset, entry->size, 1, file);
+  }
+
+  fclose(file);
+
+  cache->dirty = 0;
+
+  LOG_INFO("jit_cache_flush wrote %d blocks to %s", cache->num_entries,
+           cache->path);
+}
+
+static void jit_cache_read_file(struct jit_cache *cache) {
+  FILE *file = fopen(cache->path, "rb");
+  if (!file) {
+    return;
+  }
+
+  struct jit_cache_header header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != JIT_CACHE_MAGIC ||
+      header.version != JIT_CACHE_VERSION ||
+      strncmp(header.layout, cache->layout, sizeof(header.layout))) {
+    LOG_INFO("jit_cache_read_file discarding stale cache %s", cache->path);
+    fclose(file);
+    return;
+  }
+
+  for (int i = 0; i < header.num_entries; i++) {
+    struct jit_cache_entry tmp;
+    if (fread(&tmp, sizeof(tmp), 1, file) != 1 || tmp.size < 0) {
+      break;
+    }
+
+    /* read the serialized ir directly into the buffer */
+    int offset = cache->buffer_size;
+    uint8_t *data = jit_cache_reserve(cache, tmp.size);
+    if (tmp.size && fread(data, tmp.size, 1, file) != 1) {
+      cache->buffer_size = offset;
+      break;
+    }
+
+    struct jit_cache_entry *entry =
+        jit_cache_alloc_entry(cache, tmp.guest_addr, tmp.flags);
+    int next = entry->next;
+    *entry = tmp;
+    entry->offset = offset;
+    entry->next = next;
+  }
+
+  fclose(file);
+
+  LOG_INFO("jit_cache_read_file read %d blocks from %s", cache->num_entries,
+           cache->path);
+}
+
+static void jit_cache_layout(struct jit_cache *cache) {
+  struct jit *jit = cache->jit;
+
+  /* image relocations are only valid for the executable which wrote the
+     cache. the offsets of a few functions from different parts of the
+     executable are used to identify it */
+  int64_t offsets[] = {
+      (int64_t)(intptr_t)&jit_compile_block,
+      (int64_t)(intptr_t)&ir_opdefs,
+      (int64_t)(intptr_t)jit->guest->interrupt_check,
+      (int64_t)(intptr_t)jit->guest->r8,
+      (int64_t)(intptr_t)jit->frontend->translate_code,
+      (int64_t)(intptr_t)jit->frontend->lookup_op,
+      (int64_t)(intptr_t)jit->backend->assemble_code,
+  };
+
+  for (int i = 0; i < (int)array_size(offsets); i++) {
+    offsets[i] -= cache->image;
+  }
+
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+  MD5_Update(&md5_ctx, offsets, sizeof(offsets));
+  MD5_Final(cache->layout, &md5_ctx);
+}
+
+void jit_cache_destroy(struct jit_cache *cache) {
+  jit_cache_flush(cache);
+
+  free(cache->instrs);
+  free(cache->blocks);
+  free(cache->buffer);
+  free(cache->entries);
+  free(cache);
+}
+
+struct jit_cache *jit_cache_create(struct jit *jit, const char *path) {
+  struct jit_cache *cache = calloc(1, sizeof(struct jit_cache));
+
+  cache->jit = jit;
+  strncpy(cache->path, path, sizeof(cache->path) - 1);
+  cache->path[sizeof(cache->path) - 1] = 0;
+  cache->image = (int64_t)(intptr_t)&jit_cache_create;
+  cache->data = (int64_t)(intptr_t)jit->guest->data;
+
+  for (int i = 0; i < JIT_CACHE_BUCKETS; i++) {
+    cache->buckets[i] = -1;
+  }
+
+  jit_cache_layout(cache);
+  jit_cache_read_file(cache);
+
+  return cache;
+}
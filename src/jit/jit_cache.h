@@ -0,0 +1,32 @@
+#ifndef JIT_CACHE_H
+#define JIT_CACHE_H
+
+/* persistent cache of optimized ir. blocks are keyed by their guest address,
+   the guest state their translation depended on and a hash of their guest
+   code, enabling blocks to be reused across runs without being retranslated
+   and reoptimized */
+
+#define JIT_CACHE_HASH_SIZE 33
+
+struct ir;
+struct jit;
+struct jit_block;
+struct jit_cache;
+
+struct jit_cache_key {
+  int flags;
+  char hash[JIT_CACHE_HASH_SIZE];
+};
+
+struct jit_cache *jit_cache_create(struct jit *jit, const char *path);
+void jit_cache_destroy(struct jit_cache *cache);
+
+void jit_cache_key(struct jit_cache *cache, const struct jit_block *block,
+                   struct jit_cache_key *key);
+int jit_cache_load(struct jit_cache *cache, struct jit_block *block,
+                   struct ir *ir);
+void jit_cache_save(struct jit_cache *cache, const struct jit_block *block,
+                    const struct jit_cache_key *key, struct ir *ir);
+void jit_cache_flush(struct jit_cache *cache);
+
+#endif
@@ -0,0 +1,256 @@
+#include "jit/passes/common_subexpression_elimination_pass.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+DEFINE_STAT(cse_removed, "common subexpressions eliminated");
+
+/* size of the value table, must be a power of two. once it's half full, new
+   expressions are no longer numbered for the rest of the block */
+#define CSE_TABLE_SIZE 8192
+#define CSE_MAX_ENTRIES (CSE_TABLE_SIZE / 2)
+
+struct cse_entry {
+  /* cache token when this entry was added */
+  uint64_t token;
+
+  uint32_t hash;
+  struct ir_instr *instr;
+};
+
+struct cse {
+  /* current cache token */
+  uint64_t token;
+  int num_entries;
+
+  struct cse_entry table[CSE_TABLE_SIZE];
+};
+
+static void cse_clear_table(struct cse *cse) {
+  do {
+    cse->token++;
+  } while (cse->token == 0);
+
+  cse->num_entries = 0;
+}
+
+/* only instructions whose result depends purely on their arguments can be
+   numbered, anything touching memory or the context is left to lse */
+static int cse_is_pure(const struct ir_instr *instr) {
+  switch (instr->op) {
+    case OP_FTOI:
+    case OP_ITOF:
+    case OP_TRUNC:
+    case OP_SEXT:
+    case OP_ZEXT:
+    case OP_FTRUNC:
+    case OP_FEXT:
+    case OP_SELECT:
+    case OP_CMP:
+    case OP_FCMP:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_DIV:
+    case OP_NEG:
+    case OP_ABS:
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+    case OP_FNEG:
+    case OP_FABS:
+    case OP_SQRT:
+    case OP_VBROADCAST:
+    case OP_VADD:
+    case OP_VDOT:
+    case OP_VMUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+    case OP_ASHD:
+    case OP_LSHD:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int cse_is_commutative(const struct ir_instr *instr) {
+  switch (instr->op) {
+    case OP_ADD:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_FADD:
+    case OP_FMUL:
+    case OP_VADD:
+    case OP_VMUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* constants are allocated each time they're referenced, so they're compared
+   by value instead of by identity */
+static uint32_t cse_hash_value(const struct ir_value *v) {
+  if (!v) {
+    return 0;
+  }
+
+  if (!ir_is_constant(v)) {
+    uintptr_t p = (uintptr_t)v;
+    return (uint32_t)(p ^ (p >> 32));
+  }
+
+  uint64_t bits = 0;
+  switch (v->type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+    case VALUE_I64:
+      bits = ir_zext_constant(v);
+      break;
+    case VALUE_F32:
+      memcpy(&bits, &v->f32, sizeof(v->f32));
+      break;
+    case VALUE_F64:
+      memcpy(&bits, &v->f64, sizeof(v->f64));
+      break;
+    default:
+      break;
+  }
+
+  return (uint32_t)(bits ^ (bits >> 32)) * 31 + v->type;
+}
+
+static int cse_value_equal(const struct ir_value *a, const struct ir_value *b) {
+  if (a == b) {
+    return 1;
+  }
+
+  if (!a || !b || !ir_is_constant(a) || !ir_is_constant(b) ||
+      a->type != b->type || a->host_ptr != b->host_ptr) {
+    return 0;
+  }
+
+  switch (a->type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+    case VALUE_I64:
+      return ir_zext_constant(a) == ir_zext_constant(b);
+    case VALUE_F32:
+      return !memcmp(&a->f32, &b->f32, sizeof(a->f32));
+    case VALUE_F64:
+      return !memcmp(&a->f64, &b->f64, sizeof(a->f64));
+    default:
+      return 0;
+  }
+}
+
+static uint32_t cse_hash_instr(const struct ir_instr *instr) {
+  uint32_t h = (uint32_t)instr->op * 0x9e3779b1 + instr->result->type;
+
+  if (cse_is_commutative(instr)) {
+    /* combine the arguments' hashes with an order independent operation */
+    uint32_t a = cse_hash_value(instr->arg[0]);
+    uint32_t b = cse_hash_value(instr->arg[1]);
+    h = h * 31 + (a + b);
+  } else {
+    for (int i = 0; i < IR_MAX_ARGS; i++) {
+      h = h * 31 + cse_hash_value(instr->arg[i]);
+    }
+  }
+
+  return h;
+}
+
+static int cse_instr_equal(const struct ir_instr *a, const struct ir_instr *b) {
+  if (a->op != b->op || a->result->type != b->result->type) {
+    return 0;
+  }
+
+  int same = 1;
+  for (int i = 0; i < IR_MAX_ARGS && same; i++) {
+    same = cse_value_equal(a->arg[i], b->arg[i]);
+  }
+
+  if (!same && cse_is_commutative(a)) {
+    same = cse_value_equal(a->arg[0], b->arg[1]) &&
+           cse_value_equal(a->arg[1], b->arg[0]);
+  }
+
+  return same;
+}
+
+static struct ir_instr *cse_lookup_or_insert(struct cse *cse,
+                                             struct ir_instr *instr) {
+  uint32_t hash = cse_hash_instr(instr);
+  uint32_t i = hash & (CSE_TABLE_SIZE - 1);
+
+  while (1) {
+    struct cse_entry *entry = &cse->table[i];
+
+    if (entry->token != cse->token) {
+      if (cse->num_entries < CSE_MAX_ENTRIES) {
+        entry->token = cse->token;
+        entry->hash = hash;
+        entry->instr = instr;
+        cse->num_entries++;
+      }
+      return NULL;
+    }
+
+    if (entry->hash == hash && cse_instr_equal(entry->instr, instr)) {
+      return entry->instr;
+    }
+
+    i = (i + 1) & (CSE_TABLE_SIZE - 1);
+  }
+}
+
+static void cse_run_block(struct cse *cse, struct ir *ir,
+                          struct ir_block *block) {
+  cse_clear_table(cse);
+
+  list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
+    if (!instr->result || !cse_is_pure(instr)) {
+      continue;
+    }
+
+    /* if an identical expression has already been computed, reuse its result
+       and remove this redundant instruction */
+    struct ir_instr *existing = cse_lookup_or_insert(cse, instr);
+
+    if (existing) {
+      ir_replace_uses(instr->result, existing->result);
+      ir_remove_instr(ir, instr);
+
+      STAT_cse_removed++;
+    }
+  }
+}
+
+void cse_run(struct cse *cse, struct ir *ir) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    cse_run_block(cse, ir, block);
+  }
+}
+
+void cse_destroy(struct cse *cse) {
+  free(cse);
+}
+
+struct cse *cse_create() {
+  struct cse *cse = calloc(1, sizeof(struct cse));
+
+  return cse;
+}
@@ -0,0 +1,11 @@
+#ifndef COMMON_SUBEXPRESSION_ELIMINATION_PASS_H
+#define COMMON_SUBEXPRESSION_ELIMINATION_PASS_H
+
+struct cse;
+struct ir;
+
+struct cse *cse_create();
+void cse_destroy(struct cse *cse);
+void cse_run(struct cse *cse, struct ir *ir);
+
+#endif
@@ -50,6 +50,10 @@ static void cprop_run_block(struct cprop *cprop, struct ir *ir,
       }
 
       if (folded) {
+        /* offsetting a host pointer yields another host pointer */
+        folded->host_ptr = (instr->op == OP_ADD || instr->op == OP_SUB) &&
+                           (instr->arg[0]->host_ptr || instr->arg[1]->host_ptr);
+
         ir_replace_uses(instr->result, folded);
         STAT_constants_folded++;
       }
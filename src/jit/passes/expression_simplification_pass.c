@@ -6,6 +6,12 @@ DEFINE_STAT(bitwise_identities_removed, "bitwise identities removed");
 DEFINE_STAT(zero_properties_removed, "zero properties removed");
 DEFINE_STAT(zero_identities_removed, "zero identities removed");
 DEFINE_STAT(one_identities_removed, "one identities removed");
+DEFINE_STAT(compare_identities_removed, "compare identities removed");
+
+static int esimp_is_cmp_result(const struct ir_value *v) {
+  return !ir_is_constant(v) &&
+         (v->def->op == OP_CMP || v->def->op == OP_FCMP);
+}
 
 static void esimp_run_block(struct esimp *esimp, struct ir *ir,
                             struct ir_block *block) {
@@ -47,6 +53,16 @@ static void esimp_run_block(struct esimp *esimp, struct ir *ir,
         STAT_zero_identities_removed++;
       }
 
+      /* simplify testing an extended comparison result against 0, the
+         result is already either 0 or 1 */
+      else if (instr->op == OP_CMP && rhs == 0 &&
+               instr->arg[2]->i32 == CMP_NE && !ir_is_constant(lhs) &&
+               lhs->def->op == OP_ZEXT &&
+               esimp_is_cmp_result(lhs->def->arg[0])) {
+        ir_replace_uses(instr->result, lhs->def->arg[0]);
+        STAT_compare_identities_removed++;
+      }
+
       /* simplify binary ops where 1 is an identity */
       else if ((instr->op == OP_UMUL || instr->op == OP_SMUL ||
                 instr->op == OP_DIV) &&
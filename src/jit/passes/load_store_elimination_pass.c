@@ -99,16 +99,11 @@ static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
   lse_clear_available(lse);
 
   list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
+    /* note, branches don't invalidate the available values. the context isn't
+       modified by them, so values loaded before a conditional exit are still
+       valid on the path falling through it */
     if (instr->op == OP_FALLBACK || instr->op == OP_CALL) {
       lse_clear_available(lse);
-    } else if (instr->op == OP_BRANCH) {
-      if (instr->arg[0]->type != VALUE_BLOCK) {
-        lse_clear_available(lse);
-      }
-    } else if (instr->op == OP_BRANCH_TRUE || instr->op == OP_BRANCH_FALSE) {
-      if (instr->arg[1]->type != VALUE_BLOCK) {
-        lse_clear_available(lse);
-      }
     } else if (instr->op == OP_LOAD_CONTEXT) {
       /* if there is already a value available for this offset, reuse it and
          remove this redundant load */;
@@ -146,7 +141,9 @@ static void lse_eliminate_stores(struct lse *lse, struct ir *ir,
         lse_clear_available(lse);
       }
     } else if (instr->op == OP_BRANCH_TRUE || instr->op == OP_BRANCH_FALSE) {
-      if (instr->arg[1]->type != VALUE_BLOCK) {
+      /* stores before an exit from the block must be kept, as the code being
+         branched to may read them */
+      if (instr->arg[0]->type != VALUE_BLOCK) {
         lse_clear_available(lse);
       }
     } else if (instr->op == OP_LOAD_CONTEXT) {
@@ -71,6 +71,11 @@ struct ra {
   struct ra_use *uses;
   int num_uses;
   int max_uses;
+
+  /* ordinals of the call sites in the current block, in ascending order */
+  int *calls;
+  int num_calls;
+  int max_calls;
 };
 
 #define NO_TMP -1
@@ -126,6 +131,40 @@ static void ra_add_use(struct ra *ra, struct ra_tmp *tmp, int ordinal) {
   ra->num_uses++;
 }
 
+static void ra_add_call(struct ra *ra, int ordinal) {
+  if (ra->num_calls >= ra->max_calls) {
+    /* grow array */
+    ra->max_calls = MAX(32, ra->max_calls * 2);
+    ra->calls = realloc(ra->calls, ra->max_calls * sizeof(int));
+  }
+
+  ra->calls[ra->num_calls++] = ordinal;
+}
+
+/* check if a call site lies strictly between the tmp's current value being
+   defined and its last use, meaning it would need to be spilled if allocated
+   to a caller-saved register */
+static int ra_spans_call(struct ra *ra, struct ra_tmp *tmp) {
+  int start = ra_get_ordinal(tmp->value->def);
+  int end = ra->uses[tmp->last_use_idx].ordinal;
+
+  /* find the first call after the start */
+  int lo = 0;
+  int hi = ra->num_calls;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+
+    if (ra->calls[mid] <= start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo < ra->num_calls && ra->calls[lo] < end;
+}
+
 static struct ra_tmp *ra_create_tmp(struct ra *ra, struct ir_value *value) {
   if (ra->num_tmps >= ra->max_tmps) {
     /* grow array */
@@ -317,10 +356,8 @@ static int ra_alloc_blocked_reg(struct ra *ra, struct ir *ir,
   return 1;
 }
 
-static int ra_alloc_free_reg(struct ra *ra, struct ir *ir, struct ra_tmp *tmp) {
-  /* find the first free register which can store the tmp's value */
-  struct ra_bin *alloc_bin = NULL;
-
+static struct ra_bin *ra_find_free_bin(struct ra *ra, struct ra_tmp *tmp,
+                                       int flags) {
   for (int i = 0; i < ra->num_registers; i++) {
     struct ra_bin *bin = ra_get_bin(i);
     struct ra_tmp *packed = ra_get_packed(bin);
@@ -333,8 +370,27 @@ static int ra_alloc_free_reg(struct ra *ra, struct ir *ir, struct ra_tmp *tmp) {
       continue;
     }
 
-    alloc_bin = bin;
-    break;
+    if (flags && !(bin->reg->flags & flags)) {
+      continue;
+    }
+
+    return bin;
+  }
+
+  return NULL;
+}
+
+static int ra_alloc_free_reg(struct ra *ra, struct ir *ir, struct ra_tmp *tmp) {
+  /* temporaries living across a call site prefer callee-saved registers, so
+     they don't have to be spilled around the call. the rest prefer
+     caller-saved registers, keeping the callee-saved registers available for
+     those that do */
+  int preferred = ra_spans_call(ra, tmp) ? JIT_CALLEE_SAVED : JIT_CALLER_SAVED;
+
+  struct ra_bin *alloc_bin = ra_find_free_bin(ra, tmp, preferred);
+
+  if (!alloc_bin) {
+    alloc_bin = ra_find_free_bin(ra, tmp, 0);
   }
 
   if (!alloc_bin) {
@@ -372,6 +428,13 @@ static int ra_reuse_arg_reg(struct ra *ra, struct ir *ir, struct ra_tmp *tmp) {
     return 0;
   }
 
+  /* if the tmp lives across a call, avoid reusing a caller-saved register
+     when a callee-saved register is available */
+  if ((reuse_bin->reg->flags & JIT_CALLER_SAVED) && ra_spans_call(ra, tmp) &&
+      ra_find_free_bin(ra, tmp, JIT_CALLEE_SAVED)) {
+    return 0;
+  }
+
   /* assign the new tmp to the register's bin */
   ra_pack_bin(ra, reuse_bin, tmp);
 
@@ -536,6 +599,12 @@ static void ra_assign_ordinals(struct ra *ra, struct ir *ir,
   list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
     ra_set_ordinal(instr, ordinal);
 
+    const struct ir_opdef *def = &ir_opdefs[instr->op];
+
+    if (def->flags & IR_FLAG_CALL) {
+      ra_add_call(ra, ordinal);
+    }
+
     /* each instruction could fill up to IR_MAX_ARGS, space out ordinals
        enough to allow for this */
     ordinal += 1 + IR_MAX_ARGS;
@@ -591,6 +660,7 @@ static void ra_reset(struct ra *ra, struct ir *ir) {
 
   ra->num_tmps = 0;
   ra->num_uses = 0;
+  ra->num_calls = 0;
 }
 
 void ra_run(struct ra *ra, struct ir *ir) {
@@ -609,6 +679,7 @@ void ra_run(struct ra *ra, struct ir *ir) {
 }
 
 void ra_destroy(struct ra *ra) {
+  free(ra->calls);
   free(ra->uses);
   free(ra->tmps);
   free(ra->bins);
@@ -0,0 +1,63 @@
+test_cmpbranch_unsigned_signed:
+  # REGISTER_IN r0 0xfffffff0
+  # REGISTER_IN r1 1
+  # REGISTER_IN r2 0
+  # REGISTER_IN r3 0
+  cmp/hs r1, r0
+  bt .L1
+  mov #1, r2
+.L1:
+  add #2, r2
+  cmp/gt r1, r0
+  bt .L2
+  mov #3, r3
+  rts
+  nop
+.L2:
+  mov #4, r3
+  rts
+  nop
+  # REGISTER_OUT r2 2
+  # REGISTER_OUT r3 3
+
+test_cmpbranch_loop:
+  # REGISTER_IN r0 0
+  # REGISTER_IN r1 10
+.L3:
+  add #1, r0
+  cmp/ge r1, r0
+  bf .L3
+  rts
+  nop
+  # REGISTER_OUT r0 10
+
+test_cmpbranch_tst:
+  # REGISTER_IN r0 0x10
+  # REGISTER_IN r1 0x01
+  # REGISTER_IN r2 0
+  tst r1, r0
+  bf .L4
+  add #1, r2
+.L4:
+  tst r0, r0
+  bt .L5
+  add #2, r2
+.L5:
+  rts
+  nop
+  # REGISTER_OUT r2 3
+
+test_cmpbranch_fcmp:
+  # REGISTER_IN fr0 0x40400000
+  # REGISTER_IN fr1 0xbf800000
+  # REGISTER_IN r0 0
+  fcmp/gt fr1, fr0
+  bt .L6
+  mov #1, r0
+  rts
+  nop
+.L6:
+  mov #2, r0
+  rts
+  nop
+  # REGISTER_OUT r0 2
@@ -16,3 +16,46 @@ _foobar:
 .align 4
 .L1:
   .long _foobar
+
+test_jsr_loop:
+  # REGISTER_IN r1 0
+  # REGISTER_IN r2 8
+  sts.l pr, @-r15
+  mov.l .L2, r4
+  mov.l .L3, r5
+.LOOP:
+  mov r4, r0
+  mov r5, r4
+  jsr @r0
+  mov r0, r5
+  mov.l .L2, r0
+  jsr @r0
+  nop
+  bsr _addtwo
+  nop
+  dt r2
+  bf .LOOP
+  lds.l @r15+, pr
+  rts
+  nop
+_addone:
+  rts
+  add #1, r1
+_addthree:
+  rts
+  add #3, r1
+_addtwo:
+  sts.l pr, @-r15
+  bsr _addone
+  add #1, r1
+  lds.l @r15+, pr
+  rts
+  nop
+  # REGISTER_OUT r1 40
+  # REGISTER_OUT r2 0
+
+.align 4
+.L2:
+  .long _addone
+.L3:
+  .long _addthree
@@ -0,0 +1,157 @@
+test_macl:
+  # MAC.L   @Rm+,@Rn+
+  clrs
+  clrmac
+  mova .LONGS, r0
+  mov r0, r4
+  mov r0, r1
+  add #8, r1
+  mac.l @r0+, @r1+
+  mac.l @r0+, @r1+
+  sts mach, r2
+  sts macl, r3
+  sub r4, r0
+  rts
+  nop
+  # REGISTER_OUT r0 8
+  # REGISTER_OUT r2 0
+  # REGISTER_OUT r3 7
+
+test_macl_carry:
+  # REGISTER_IN r2 0x00000001
+  # REGISTER_IN r3 0xfffffffe
+  clrs
+  lds r2, mach
+  lds r3, macl
+  mova .LONGS, r0
+  mov r0, r1
+  add #4, r1
+  mac.l @r0+, @r1+
+  sts mach, r2
+  sts macl, r3
+  rts
+  nop
+  # REGISTER_OUT r2 0x00000002
+  # REGISTER_OUT r3 0x00000004
+
+test_macl_same_reg:
+  clrs
+  clrmac
+  mova .LONGS, r0
+  mov r0, r4
+  mac.l @r0+, @r0+
+  sts mach, r2
+  sts macl, r3
+  sub r4, r0
+  rts
+  nop
+  # REGISTER_OUT r0 8
+  # REGISTER_OUT r2 0
+  # REGISTER_OUT r3 6
+
+test_macl_saturate_max:
+  # REGISTER_IN r2 0x00007fff
+  # REGISTER_IN r3 0xfffffffe
+  sets
+  lds r2, mach
+  lds r3, macl
+  mova .LONGS, r0
+  mov r0, r1
+  add #4, r1
+  mac.l @r0+, @r1+
+  sts mach, r2
+  sts macl, r3
+  clrs
+  rts
+  nop
+  # REGISTER_OUT r2 0x00007fff
+  # REGISTER_OUT r3 0xffffffff
+
+test_macl_saturate_min:
+  # REGISTER_IN r2 0xffff8000
+  # REGISTER_IN r3 0x00000004
+  sets
+  lds r2, mach
+  lds r3, macl
+  mova .LONGS, r0
+  mov r0, r1
+  add #8, r1
+  mac.l @r0+, @r1+
+  sts mach, r2
+  sts macl, r3
+  clrs
+  rts
+  nop
+  # REGISTER_OUT r2 0xffff8000
+  # REGISTER_OUT r3 0x00000000
+
+test_macw:
+  # MAC.W   @Rm+,@Rn+
+  # REGISTER_IN r2 0x00000001
+  # REGISTER_IN r3 0xffffffff
+  clrs
+  lds r2, mach
+  lds r3, macl
+  mova .WORDS, r0
+  mov r0, r4
+  mov r0, r1
+  add #4, r1
+  mac.w @r0+, @r1+
+  mac.w @r0+, @r1+
+  sts mach, r2
+  sts macl, r3
+  sub r4, r0
+  rts
+  nop
+  # REGISTER_OUT r0 4
+  # REGISTER_OUT r2 0x00000002
+  # REGISTER_OUT r3 0x001e846a
+
+test_macw_saturate:
+  # REGISTER_IN r2 0x00000010
+  # REGISTER_IN r3 0x7ffffff0
+  sets
+  lds r2, mach
+  lds r3, macl
+  mova .WORDS, r0
+  mov r0, r1
+  add #4, r1
+  mac.w @r0+, @r1+
+  sts mach, r2
+  sts macl, r3
+  clrs
+  rts
+  nop
+  # REGISTER_OUT r2 0x00000011
+  # REGISTER_OUT r3 0x7fffffff
+
+test_macw_saturate_in_range:
+  # REGISTER_IN r2 0x00000010
+  # REGISTER_IN r3 0x00000010
+  sets
+  lds r2, mach
+  lds r3, macl
+  mova .WORDS, r0
+  add #2, r0
+  mov r0, r1
+  add #4, r1
+  mac.w @r0+, @r1+
+  sts mach, r2
+  sts macl, r3
+  clrs
+  rts
+  nop
+  # REGISTER_OUT r2 0x00000010
+  # REGISTER_OUT r3 0xfffffffb
+
+.align 4
+.LONGS:
+  .long 2
+  .long 3
+  .long -4
+  .long 5
+.WORDS:
+  .word 1000
+  .word -3
+  .word 2000
+  .word 7
@@ -0,0 +1,45 @@
+test_trace_side_exit:
+  # REGISTER_IN r0 7
+  # REGISTER_IN r1 0
+  cmp/eq #7, r0
+  bt .L1
+  add #1, r1
+  bra .L2
+  add #2, r1
+.L1:
+  add #4, r1
+.L2:
+  add #8, r1
+  rts
+  nop
+  # REGISTER_OUT r1 12
+
+test_trace_fallthrough:
+  # REGISTER_IN r0 8
+  # REGISTER_IN r1 0
+  cmp/eq #7, r0
+  bt .L3
+  add #1, r1
+  bra .L4
+  add #2, r1
+.L3:
+  add #4, r1
+.L4:
+  add #8, r1
+  rts
+  nop
+  # REGISTER_OUT r1 11
+
+test_trace_delay_fschg:
+  # REGISTER_IN fpscr 0x00040001
+  # REGISTER_IN r0 0
+  # REGISTER_IN dr0 0x4040000030300000
+  cmp/eq #1, r0
+  bt/s .L5
+  fschg
+  fmov dr0, dr2
+.L5:
+  rts
+  nop
+  # REGISTER_OUT fpscr 0x00140001
+  # REGISTER_OUT dr2 0x4040000030300000
@@ -0,0 +1,38 @@
+#include <inttypes.h>
+#include "core/time.h"
+#include "jit_stub.h"
+#include "retest.h"
+
+#define NUM_BLOCKS 0x10000
+
+TEST(jit_add_edge) {
+  struct jit *jit = stub_jit_create(1);
+
+  /* fill the cache with enough blocks to simulate a large title */
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    jit_compile_block(jit, stub_block_addr(i));
+  }
+
+  /* link each block to another, using the address of the branch at the end
+     of the source block as the edge's origin */
+  int64_t start = time_nanoseconds();
+
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    uint32_t src_addr = stub_block_addr(i);
+    uint32_t dst_addr = stub_block_addr((i * 7919) % NUM_BLOCKS);
+    uint8_t *src_code = stub_backend_lookup_code(&stub_backend, src_addr);
+    int size = stub_block_size(src_addr);
+    jit_add_edge(jit, src_code + size - 5, dst_addr);
+  }
+
+  int64_t end = time_nanoseconds();
+
+  CHECK_EQ(stub_num_patched, NUM_BLOCKS);
+
+  LOG_INFO("added %d edges with %d blocks resident in %.2f ms, %" PRId64
+           " ns / edge",
+           NUM_BLOCKS, NUM_BLOCKS, (end - start) / 1000000.0f,
+           (end - start) / NUM_BLOCKS);
+
+  stub_jit_destroy(jit);
+}
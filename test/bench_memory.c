@@ -0,0 +1,37 @@
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "retest.h"
+
+TEST(as_register_access) {
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  struct address_space *space = dc->sh4->memory_if->space;
+
+  /* mix of the sh4, holly and pvr register accesses a boot is dominated by */
+  static const uint32_t addrs[] = {
+      0xff000008, 0xffd80004, 0xa05f6900, 0xa05f8040, 0x005f6800, 0x8c010000,
+  };
+  static const int num_iters = 1000000;
+
+  uint32_t sum = 0;
+  int64_t start = time_nanoseconds();
+
+  for (int i = 0; i < num_iters; i++) {
+    for (int j = 0; j < (int)array_size(addrs); j++) {
+      sum += as_read32(space, addrs[j]);
+    }
+  }
+
+  int64_t end = time_nanoseconds();
+  int num_accesses = num_iters * (int)array_size(addrs);
+
+  LOG_INFO("%d register accesses in %.3f ms, %.2f ns / access (0x%x)",
+           num_accesses, (end - start) / 1000000.0f,
+           (end - start) / (float)num_accesses, sum);
+
+  dc_destroy(dc);
+}
@@ -0,0 +1,20 @@
+#include "core/core.h"
+#include "core/time.h"
+#include "retest.h"
+#include "timer_mix.h"
+
+TEST(scheduler_timer_mix) {
+  timer_mix_create();
+
+  int64_t start = time_nanoseconds();
+  timer_mix_run();
+  int64_t end = time_nanoseconds();
+
+  int fired = timer_mix_num_fired();
+
+  LOG_INFO("fired %d timers over one emulated second in %.3f ms, %.2f ns / "
+           "timer",
+           fired, (end - start) / 1000000.0f, (end - start) / (float)fired);
+
+  timer_mix_destroy();
+}
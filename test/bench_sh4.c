@@ -0,0 +1,39 @@
+#include "core/option.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "retest.h"
+#include "sh4_test.h"
+
+DECLARE_OPTION_INT(sh4_interp);
+
+static void bench_mac_loop(const char *backend, int sh4_interp) {
+  int old_sh4_interp = OPTION_sh4_interp;
+  OPTION_sh4_interp = sh4_interp;
+
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  int64_t start = time_nanoseconds();
+  sh4_test_run_mac_loop(dc);
+  int64_t end = time_nanoseconds();
+
+  LOG_INFO("%s ran %d mac.l iterations in %.2f ms, %.2f ns / iteration",
+           backend, SH4_MAC_LOOP_ITERS, (end - start) / 1000000.0f,
+           (end - start) / (float)SH4_MAC_LOOP_ITERS);
+
+  dc_destroy(dc);
+
+  OPTION_sh4_interp = old_sh4_interp;
+}
+
+TEST(sh4_mac_loop) {
+  bench_mac_loop("jit", 0);
+}
+
+TEST(sh4_mac_loop_interp) {
+  bench_mac_loop("interp", 1);
+}
+
+TEST(sh4_mac_loop_ir_interp) {
+  bench_mac_loop("ir_interp", 2);
+}
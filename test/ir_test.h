@@ -0,0 +1,22 @@
+#ifndef IR_TEST_H
+#define IR_TEST_H
+
+#include "jit/ir/ir.h"
+
+/* helpers shared by the ir pass tests */
+
+static inline int ir_test_count_instrs(struct ir *ir, enum ir_op op) {
+  int n = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      if (instr->op == op) {
+        n++;
+      }
+    }
+  }
+
+  return n;
+}
+
+#endif
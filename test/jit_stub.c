@@ -0,0 +1,171 @@
+#include "jit_stub.h"
+#include "core/option.h"
+#include "retest.h"
+
+#define CACHE_SIZE ((STUB_ADDR_MASK >> STUB_ADDR_SHIFT) + 1)
+
+DECLARE_OPTION_INT(async_jit);
+
+struct jit_backend stub_backend;
+uint8_t stub_code[STUB_CODE_SIZE];
+int stub_code_region;
+int stub_code_region_size = STUB_CODE_SIZE;
+int stub_num_patched;
+int stub_num_restored;
+uint8_t stub_guest_code[0x100];
+uint8_t stub_protected_pages[STUB_NUM_CODE_PAGES];
+int stub_data;
+
+static struct jit_frontend stub_frontend;
+static struct jit_guest stub_guest;
+static int code_used;
+static int code_limit = STUB_CODE_SIZE;
+static void *cache[CACHE_SIZE];
+
+static void stub_frontend_init(struct jit_frontend *frontend) {}
+
+static void stub_frontend_translate_code(struct jit_frontend *frontend,
+                                         struct jit_block *block,
+                                         struct ir *ir) {
+  block->guest_size = 4;
+  block->num_instrs = 1;
+  block->num_cycles = 1;
+}
+
+void stub_fallback(struct jit_guest *guest, uint32_t addr, uint32_t data) {}
+
+static const struct jit_opdef stub_opdef = {
+    0, "stub", "", 1, 0, &stub_fallback,
+};
+
+static const struct jit_opdef *stub_frontend_lookup_op(
+    struct jit_frontend *frontend, const void *instr) {
+  return &stub_opdef;
+}
+
+uint8_t stub_guest_r8(struct address_space *space, uint32_t addr) {
+  return stub_guest_code[addr % sizeof(stub_guest_code)];
+}
+
+static int stub_guest_protect_code(void *data, uint32_t addr, uint32_t size,
+                                   int protect) {
+  stub_protected_pages[(addr & STUB_ADDR_MASK) >> JIT_CODE_PAGE_SHIFT] =
+      protect;
+  return 1;
+}
+
+static void stub_backend_init(struct jit_backend *backend) {}
+
+static void stub_backend_reset(struct jit_backend *backend) {
+  code_used = 0;
+  code_limit = stub_code_region_size;
+  stub_code_region = 0;
+}
+
+static void stub_backend_next_region(struct jit_backend *backend, void **begin,
+                                     void **end) {
+  int num_regions = STUB_CODE_SIZE / stub_code_region_size;
+  stub_code_region = (stub_code_region + 1) % num_regions;
+  code_used = stub_code_region * stub_code_region_size;
+  code_limit = code_used + stub_code_region_size;
+  *begin = stub_code + code_used;
+  *end = stub_code + code_limit;
+}
+
+static int stub_backend_assemble_code(struct jit_backend *backend,
+                                      struct jit_block *block, struct ir *ir) {
+  int size = stub_block_size(block->guest_addr);
+
+  if (code_used + size > code_limit) {
+    return 0;
+  }
+
+  block->host_addr = stub_code + code_used;
+  block->host_size = size;
+  code_used += size;
+
+  return 1;
+}
+
+void *stub_backend_lookup_code(struct jit_backend *backend, uint32_t addr) {
+  return cache[(addr & STUB_ADDR_MASK) >> STUB_ADDR_SHIFT];
+}
+
+static void stub_backend_cache_code(struct jit_backend *backend, uint32_t addr,
+                                    void *code) {
+  cache[(addr & STUB_ADDR_MASK) >> STUB_ADDR_SHIFT] = code;
+}
+
+static void stub_backend_invalidate_code(struct jit_backend *backend,
+                                         uint32_t addr) {
+  cache[(addr & STUB_ADDR_MASK) >> STUB_ADDR_SHIFT] = NULL;
+}
+
+static void stub_backend_patch_edge(struct jit_backend *backend, void *code,
+                                    void *dst) {
+  stub_num_patched++;
+}
+
+static void stub_backend_restore_edge(struct jit_backend *backend, void *code,
+                                      uint32_t dst) {
+  stub_num_restored++;
+}
+
+uint32_t stub_block_addr(int i) {
+  /* scatter blocks throughout the address space */
+  return (((uint32_t)i * 40503) << STUB_ADDR_SHIFT) & STUB_ADDR_MASK;
+}
+
+int stub_block_size(uint32_t addr) {
+  /* vary the block sizes a bit so blocks straddle host pages */
+  return 64 + (addr % 7) * 48;
+}
+
+/* create a jit on top of the stubs, with the code buffer split into the given
+   number of regions */
+struct jit *stub_jit_create(int num_regions) {
+  memset(&stub_frontend, 0, sizeof(stub_frontend));
+  stub_frontend.init = &stub_frontend_init;
+  stub_frontend.translate_code = &stub_frontend_translate_code;
+  stub_frontend.lookup_op = &stub_frontend_lookup_op;
+
+  memset(&stub_backend, 0, sizeof(stub_backend));
+  stub_backend.init = &stub_backend_init;
+  stub_backend.reset = &stub_backend_reset;
+  stub_backend.next_region = &stub_backend_next_region;
+  stub_backend.assemble_code = &stub_backend_assemble_code;
+  stub_backend.lookup_code = &stub_backend_lookup_code;
+  stub_backend.cache_code = &stub_backend_cache_code;
+  stub_backend.invalidate_code = &stub_backend_invalidate_code;
+  stub_backend.patch_edge = &stub_backend_patch_edge;
+  stub_backend.restore_edge = &stub_backend_restore_edge;
+
+  memset(&stub_guest, 0, sizeof(stub_guest));
+  stub_guest.addr_mask = STUB_ADDR_MASK;
+  stub_guest.data = &stub_data;
+  stub_guest.r8 = &stub_guest_r8;
+  stub_guest.protect_code = &stub_guest_protect_code;
+
+  stub_code_region_size = STUB_CODE_SIZE / num_regions;
+  stub_backend_reset(&stub_backend);
+  stub_num_patched = 0;
+  stub_num_restored = 0;
+
+  /* the stub frontend can't be interpreted, compile blocks synchronously */
+  int async_jit = OPTION_async_jit;
+  OPTION_async_jit = 0;
+  struct jit *jit =
+      jit_create("test", &stub_frontend, &stub_backend, &stub_guest);
+  OPTION_async_jit = async_jit;
+  CHECK_NOTNULL(jit);
+
+  return jit;
+}
+
+void stub_jit_destroy(struct jit *jit) {
+  jit_destroy(jit);
+
+  /* leave the code buffer as a single region for the next user */
+  stub_code_region_size = STUB_CODE_SIZE;
+  stub_backend_reset(&stub_backend);
+}
@@ -0,0 +1,35 @@
+#ifndef JIT_STUB_H
+#define JIT_STUB_H
+
+#include "jit/backend/jit_backend.h"
+#include "jit/frontend/jit_frontend.h"
+#include "jit/jit.h"
+
+/* stub frontend / backend used to exercise the jit's block management without
+   generating any real code, shared by the jit tests and benchmarks */
+#define STUB_ADDR_MASK 0x001ffffc
+#define STUB_ADDR_SHIFT 2
+#define STUB_CODE_SIZE 0x1000000
+#define STUB_NUM_CODE_PAGES ((STUB_ADDR_MASK >> JIT_CODE_PAGE_SHIFT) + 1)
+
+extern struct jit_backend stub_backend;
+extern uint8_t stub_code[STUB_CODE_SIZE];
+extern int stub_code_region;
+extern int stub_code_region_size;
+extern int stub_num_patched;
+extern int stub_num_restored;
+extern uint8_t stub_guest_code[0x100];
+extern uint8_t stub_protected_pages[STUB_NUM_CODE_PAGES];
+extern int stub_data;
+
+void stub_fallback(struct jit_guest *guest, uint32_t addr, uint32_t data);
+uint8_t stub_guest_r8(struct address_space *space, uint32_t addr);
+void *stub_backend_lookup_code(struct jit_backend *backend, uint32_t addr);
+
+uint32_t stub_block_addr(int i);
+int stub_block_size(uint32_t addr);
+
+struct jit *stub_jit_create(int num_regions);
+void stub_jit_destroy(struct jit *jit);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SH4_TEST_H
+#define SH4_TEST_H
+
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "retest.h"
+
+/* programs shared by the sh4 tests and benchmarks */
+
+/* multiply-accumulate loop, the inner loop of most fixed-point transform and
+   audio mixing code:
+
+     mova .DATA, r0
+     mov r0, r4
+     mov r0, r5
+     add #8, r5
+     clrs
+     clrmac
+   .LOOP:
+     mov r4, r0
+     mov r5, r1
+     mac.l @r0+, @r1+
+     mac.l @r0+, @r1+
+     dt r2
+     bf .LOOP
+     sts mach, r6
+     sts macl, r7
+     rts
+     nop
+   .align 4
+   .DATA:
+     .long 2, 3, -4, 5 */
+#define SH4_MAC_LOOP_ITERS 1000000
+
+static const uint16_t sh4_mac_loop[] = {
+    0xc707, 0x6403, 0x6503, 0x7508, 0x0048, 0x0028, 0x6043, 0x6153,
+    0x010f, 0x010f, 0x4210, 0x8bf9, 0x060a, 0x071a, 0x000b, 0x0009,
+    0x0002, 0x0000, 0x0003, 0x0000, 0xfffc, 0xffff, 0x0005, 0x0000,
+};
+
+/* load the multiply-accumulate loop at 0x8c010000 and run it to completion */
+static inline void sh4_test_run_mac_loop(struct dreamcast *dc) {
+  as_memcpy_to_guest(dc->sh4->memory_if->space, 0x8c010000, sh4_mac_loop,
+                     sizeof(sh4_mac_loop));
+  sh4_reset(dc->sh4, 0x8c010000);
+  dc->sh4->ctx.r[2] = SH4_MAC_LOOP_ITERS;
+
+  dc_resume(dc);
+
+  while (dc->sh4->ctx.pc) {
+    dc_tick(dc, 1);
+  }
+
+  /* each iteration accumulates 2 * -4 + 3 * 5 */
+  int64_t expected = (int64_t)SH4_MAC_LOOP_ITERS * 7;
+  CHECK_EQ(dc->sh4->ctx.r[6], (uint32_t)(expected >> 32));
+  CHECK_EQ(dc->sh4->ctx.r[7], (uint32_t)expected);
+}
+
+#endif
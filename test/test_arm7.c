@@ -0,0 +1,70 @@
+#include "core/core.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "guest/aica/aica.h"
+#include "guest/arm7/arm7.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/scheduler.h"
+#include "guest/sh4/sh4.h"
+#include "retest.h"
+
+DECLARE_OPTION_INT(arm7_thread);
+
+#define COUNTER_ADDR 0x1000
+
+/* increments a counter in wave ram, reading an aica register each iteration */
+static const uint32_t counter_code[] = {
+    0xe3a01a01, /* mov r1, #0x1000 */
+    0xe3a00000, /* mov r0, #0 */
+    0xe3a03502, /* mov r3, #0x800000 */
+    0xe2800001, /* loop: add r0, r0, #1 */
+    0xe5810000, /* str r0, [r1] */
+    0xe5932000, /* ldr r2, [r3] */
+    0xeafffffb, /* b loop */
+};
+
+static uint32_t run_counter(int threaded) {
+  int arm7_thread = OPTION_arm7_thread;
+  OPTION_arm7_thread = threaded;
+
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  uint8_t *wave_ram = memory_translate(dc->memory, "aica wave ram", 0x0);
+  memcpy(wave_ram, counter_code, sizeof(counter_code));
+  memset(wave_ram + COUNTER_ADDR, 0, 4);
+
+  /* only run the arm7 and the timers */
+  dc->sh4->execute_if->running = 0;
+  arm7_reset(dc->arm);
+  dc_resume(dc);
+
+  struct address_space *space = dc->sh4->memory_if->space;
+
+  for (int i = 0; i < 60; i++) {
+    scheduler_tick(dc->scheduler, HZ_TO_NANO(60));
+
+    /* access the aica registers over the g2 bus while the arm7 may still be
+       running */
+    as_read32(space, 0x00700000);
+  }
+
+  arm7_sync(dc->arm);
+
+  uint32_t counter = *(uint32_t *)(wave_ram + COUNTER_ADDR);
+
+  dc_destroy(dc);
+
+  OPTION_arm7_thread = arm7_thread;
+
+  return counter;
+}
+
+TEST(arm7_thread) {
+  uint32_t expected = run_counter(0);
+  uint32_t actual = run_counter(1);
+
+  CHECK_GT(expected, 0u);
+  CHECK_EQ(expected, actual);
+}
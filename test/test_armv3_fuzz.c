@@ -0,0 +1,382 @@
+#include <string.h>
+#include "core/core.h"
+#include "core/option.h"
+#include "jit/backend/ir_interp/ir_interp_backend.h"
+#include "jit/backend/jit_backend.h"
+#include "jit/frontend/armv3/armv3_context.h"
+#include "jit/frontend/armv3/armv3_disasm.h"
+#include "jit/frontend/armv3/armv3_frontend.h"
+#include "jit/frontend/armv3/armv3_guest.h"
+#include "jit/frontend/jit_frontend.h"
+#include "jit/jit.h"
+#include "retest.h"
+
+#if ARCH_X64
+#include "jit/backend/x64/x64_backend.h"
+#endif
+
+DECLARE_OPTION_INT(async_jit);
+
+/* random instruction sequences are ran through the armv3 translators and then
+   again through each instruction's fallback on the same input state. the
+   sequences focus on what the translators inline: data processing flags with
+   a carry in, the shifter's carry out and block transfers writing back a base
+   which is also in the register list */
+#define FUZZ_SEED 0x5eed4321
+#define FUZZ_SEQUENCES 1000
+#define FUZZ_INSTRS 16
+
+/* guest memory is a flat buffer, with the code at its start. each load or
+   store is preceded by a mov pointing its base at the middle of the window,
+   far enough from either end that no offset steps out */
+#define FUZZ_MEM_SIZE 0x2000
+#define FUZZ_ADDR_MASK (FUZZ_MEM_SIZE - 4)
+#define FUZZ_CODE_ADDR 0x0
+#define FUZZ_WINDOW_ADDR 0x1000
+#define FUZZ_WINDOW_SIZE 0x1000
+#define FUZZ_BASE_ADDR (FUZZ_WINDOW_ADDR + FUZZ_WINDOW_SIZE / 2)
+
+/* mov rd, #FUZZ_BASE_ADDR, encoded as 0x6 rotated right by 22 */
+#define FUZZ_MOV_BASE 0xe3a00b06
+
+/* b . */
+#define FUZZ_SPIN 0xeafffffe
+
+static const uint32_t fuzz_ints[] = {
+    0x0, 0x1, 0x2, 0x1f, 0x20, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xffff,
+    0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff,
+};
+
+static uint8_t fuzz_mem[FUZZ_MEM_SIZE];
+static uint32_t fuzz_state;
+
+static uint32_t fuzz_rand() {
+  /* xorshift32, good enough and reproducible everywhere */
+  fuzz_state ^= fuzz_state << 13;
+  fuzz_state ^= fuzz_state >> 17;
+  fuzz_state ^= fuzz_state << 5;
+  return fuzz_state;
+}
+
+static uint8_t fuzz_r8(struct address_space *space, uint32_t addr) {
+  return fuzz_mem[addr & (FUZZ_MEM_SIZE - 1)];
+}
+
+static uint32_t fuzz_r32(struct address_space *space, uint32_t addr) {
+  uint32_t data;
+  memcpy(&data, &fuzz_mem[addr & FUZZ_ADDR_MASK], sizeof(data));
+  return data;
+}
+
+static void fuzz_w8(struct address_space *space, uint32_t addr, uint8_t data) {
+  fuzz_mem[addr & (FUZZ_MEM_SIZE - 1)] = data;
+}
+
+static void fuzz_w32(struct address_space *space, uint32_t addr,
+                     uint32_t data) {
+  memcpy(&fuzz_mem[addr & FUZZ_ADDR_MASK], &data, sizeof(data));
+}
+
+static void fuzz_lookup(struct address_space *space, uint32_t addr, void **ptr,
+                        void **userdata, mem_read_cb *read,
+                        mem_write_cb *write, uint32_t *offset) {
+  if (ptr) {
+    *ptr = &fuzz_mem[addr & (FUZZ_MEM_SIZE - 1)];
+  }
+  if (userdata) {
+    *userdata = NULL;
+  }
+  if (read) {
+    *read = NULL;
+  }
+  if (write) {
+    *write = NULL;
+  }
+  if (offset) {
+    *offset = 0;
+  }
+}
+
+static void fuzz_interrupt_check(void *data) {}
+
+static uint32_t fuzz_gen_int() {
+  return (fuzz_rand() & 1) ? fuzz_ints[fuzz_rand() % array_size(fuzz_ints)]
+                           : fuzz_rand();
+}
+
+static uint32_t fuzz_gen_cond() {
+  /* half of the instructions are conditional, never NV */
+  return (fuzz_rand() & 1) ? COND_AL : fuzz_rand() % COND_AL;
+}
+
+static uint32_t fuzz_gen_reg() {
+  /* the pc is only read, with its prefetch offset, by data processing */
+  return fuzz_rand() % 15;
+}
+
+static int fuzz_gen_data(uint32_t *code) {
+  uint32_t cond = fuzz_gen_cond();
+  uint32_t op = fuzz_rand() & 0xf;
+  uint32_t s = fuzz_rand() & 1;
+  uint32_t rn = (fuzz_rand() % 8) ? fuzz_gen_reg() : 15;
+  uint32_t rd = fuzz_gen_reg();
+  uint32_t op2 = 0;
+  uint32_t i = fuzz_rand() & 1;
+
+  /* tst, teq, cmp and cmn without s encode the psr transfers */
+  if (op >= 0x8 && op <= 0xb) {
+    s = 1;
+    rd = 0;
+  }
+
+  /* as do mov and mvn with an rn */
+  if (op == 0xd || op == 0xf) {
+    rn = 0;
+  }
+
+  if (i) {
+    /* rotated immediates produce a carry out only when rotated */
+    op2 = fuzz_rand() & 0xfff;
+  } else {
+    uint32_t rm = (fuzz_rand() % 8) ? fuzz_gen_reg() : 15;
+    uint32_t type = fuzz_rand() & 0x3;
+
+    if (fuzz_rand() % 4) {
+      /* immediate shift, an amount of 0 encodes lsr / asr #32 and rrx. rrx
+         isn't supported by the fallbacks, skip it */
+      uint32_t n = fuzz_rand() & 0x1f;
+      if (type == SHIFT_ROR && !n) {
+        n = 1;
+      }
+      op2 = (n << 7) | (type << 5) | rm;
+    } else {
+      /* register shift, left to the fallbacks */
+      uint32_t rs = fuzz_gen_reg();
+      op2 = (rs << 8) | (type << 5) | (1 << 4) | rm;
+    }
+  }
+
+  code[0] = (cond << 28) | (i << 25) | (op << 21) | (s << 20) | (rn << 16) |
+            (rd << 12) | op2;
+  return 1;
+}
+
+static int fuzz_gen_mul(uint32_t *code) {
+  uint32_t cond = fuzz_gen_cond();
+  uint32_t a = fuzz_rand() & 1;
+  uint32_t s = fuzz_rand() & 1;
+  uint32_t rd = fuzz_gen_reg();
+  uint32_t rn = fuzz_gen_reg();
+  uint32_t rs = fuzz_gen_reg();
+  uint32_t rm = fuzz_gen_reg();
+
+  code[0] = (cond << 28) | (a << 21) | (s << 20) | (rd << 16) | (rn << 12) |
+            (rs << 8) | (0x9 << 4) | rm;
+  return 1;
+}
+
+static int fuzz_gen_xfr(uint32_t *code) {
+  uint32_t cond = fuzz_gen_cond();
+  uint32_t p = fuzz_rand() & 1;
+  uint32_t u = fuzz_rand() & 1;
+  uint32_t b = fuzz_rand() & 1;
+  uint32_t l = fuzz_rand() & 1;
+  uint32_t rn = fuzz_gen_reg();
+  uint32_t rd = fuzz_gen_reg();
+  /* post-indexed transfers with w set are user mode transfers */
+  uint32_t w = p ? fuzz_rand() & 1 : 0;
+  /* keep word transfers aligned, unaligned loads rotate the result */
+  uint32_t offset = fuzz_rand() & (b ? 0x7ff : 0x7fc);
+
+  code[0] = FUZZ_MOV_BASE | (rn << 12);
+  code[1] = (cond << 28) | (0x1 << 26) | (p << 24) | (u << 23) | (b << 22) |
+            (w << 21) | (l << 20) | (rn << 16) | (rd << 12) | offset;
+  return 2;
+}
+
+static int fuzz_gen_blk(uint32_t *code) {
+  uint32_t cond = fuzz_gen_cond();
+  uint32_t p = fuzz_rand() & 1;
+  uint32_t u = fuzz_rand() & 1;
+  uint32_t w = fuzz_rand() & 1;
+  uint32_t l = fuzz_rand() & 1;
+  uint32_t rn = fuzz_gen_reg();
+  uint32_t rlist = fuzz_rand() & 0x7fff;
+
+  /* include the base in half of the transfers */
+  if (fuzz_rand() & 1) {
+    rlist |= 1 << rn;
+  }
+  if (!rlist) {
+    rlist = 1 << rn;
+  }
+
+  code[0] = FUZZ_MOV_BASE | (rn << 12);
+  code[1] = (cond << 28) | (0x4 << 25) | (p << 24) | (u << 23) | (w << 21) |
+            (l << 20) | (rn << 16) | rlist;
+  return 2;
+}
+
+static int fuzz_gen_instr(uint32_t *code) {
+  switch (fuzz_rand() % 8) {
+    case 0:
+      return fuzz_gen_mul(code);
+    case 1:
+    case 2:
+      return fuzz_gen_xfr(code);
+    case 3:
+    case 4:
+      return fuzz_gen_blk(code);
+    default:
+      return fuzz_gen_data(code);
+  }
+}
+
+static void fuzz_gen_context(struct armv3_context *ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+
+  for (int i = 0; i < 15; i++) {
+    ctx->r[i] = fuzz_gen_int();
+  }
+
+  ctx->r[15] = FUZZ_CODE_ADDR;
+  ctx->r[CPSR] =
+      MODE_SVC | (fuzz_rand() & (N_MASK | Z_MASK | C_MASK | V_MASK));
+}
+
+static void fuzz_dump(const uint32_t *code, int num_instrs) {
+  for (int i = 0; i < num_instrs; i++) {
+    uint32_t addr = FUZZ_CODE_ADDR + i * 4;
+    char buffer[128];
+    armv3_format(addr, code[i], buffer, sizeof(buffer));
+    LOG_INFO("  0x%08x 0x%08x %s", addr, code[i], buffer);
+  }
+}
+
+static void fuzz_run_fallbacks(struct armv3_guest *guest, uint32_t end_addr) {
+  struct armv3_context *ctx = guest->ctx;
+
+  while (ctx->r[15] != end_addr) {
+    uint32_t addr = ctx->r[15];
+    uint32_t data = guest->r32(guest->space, addr);
+    struct jit_opdef *def = armv3_get_opdef(data);
+    def->fallback((struct jit_guest *)guest, addr, data);
+  }
+}
+
+static void fuzz_compare(const uint32_t *code, int num_instrs,
+                         const struct armv3_context *expected,
+                         const struct armv3_context *actual,
+                         const uint8_t *expected_mem,
+                         const uint8_t *actual_mem) {
+  for (int i = 0; i <= CPSR; i++) {
+    if (expected->r[i] != actual->r[i]) {
+      fuzz_dump(code, num_instrs);
+    }
+    CHECK_EQ(expected->r[i], actual->r[i],
+             "r[%d] expected 0x%08x, actual 0x%08x", i, expected->r[i],
+             actual->r[i]);
+  }
+
+  for (int i = 0; i < FUZZ_WINDOW_SIZE; i++) {
+    if (expected_mem[i] != actual_mem[i]) {
+      fuzz_dump(code, num_instrs);
+    }
+    CHECK_EQ(expected_mem[i], actual_mem[i],
+             "0x%08x expected 0x%02x, actual 0x%02x", FUZZ_WINDOW_ADDR + i,
+             expected_mem[i], actual_mem[i]);
+  }
+}
+
+static void run_armv3_fuzz(struct jit_backend *backend) {
+  static struct armv3_context ctx;
+  static uint8_t in_mem[FUZZ_WINDOW_SIZE];
+  static uint8_t jit_mem[FUZZ_WINDOW_SIZE];
+  static uint8_t fallback_mem[FUZZ_WINDOW_SIZE];
+
+  struct jit_frontend *frontend = armv3_frontend_create();
+  struct armv3_guest *guest = armv3_guest_create();
+
+  guest->addr_mask = FUZZ_ADDR_MASK;
+  guest->offset_pc = (int)offsetof(struct armv3_context, r[15]);
+  guest->offset_cycles = (int)offsetof(struct armv3_context, run_cycles);
+  guest->offset_instrs = (int)offsetof(struct armv3_context, ran_instrs);
+  guest->offset_interrupts =
+      (int)offsetof(struct armv3_context, pending_interrupts);
+  guest->interrupt_check = &fuzz_interrupt_check;
+
+  guest->ctx = &ctx;
+  guest->mem = fuzz_mem;
+  guest->lookup = &fuzz_lookup;
+  guest->r8 = &fuzz_r8;
+  guest->r32 = &fuzz_r32;
+  guest->w8 = &fuzz_w8;
+  guest->w32 = &fuzz_w32;
+
+  /* compare against the translators, not blocks still queued up */
+  int async_jit = OPTION_async_jit;
+  OPTION_async_jit = 0;
+  struct jit *jit =
+      jit_create("armv3_fuzz", frontend, backend, (struct jit_guest *)guest);
+  OPTION_async_jit = async_jit;
+  CHECK_NOTNULL(jit);
+
+  fuzz_state = FUZZ_SEED;
+
+  for (int n = 0; n < FUZZ_SEQUENCES; n++) {
+    /* generate the sequence, spinning in place at the end */
+    uint32_t code[FUZZ_INSTRS * 2 + 1];
+    int num_instrs = 0;
+    for (int i = 0; i < FUZZ_INSTRS; i++) {
+      num_instrs += fuzz_gen_instr(&code[num_instrs]);
+    }
+    uint32_t end_addr = FUZZ_CODE_ADDR + num_instrs * 4;
+    code[num_instrs++] = FUZZ_SPIN;
+
+    for (int i = 0; i < FUZZ_WINDOW_SIZE; i++) {
+      in_mem[i] = (uint8_t)fuzz_rand();
+    }
+
+    memcpy(&fuzz_mem[FUZZ_CODE_ADDR], code, num_instrs * 4);
+    memcpy(&fuzz_mem[FUZZ_WINDOW_ADDR], in_mem, sizeof(in_mem));
+
+    fuzz_gen_context(&ctx);
+    struct armv3_context in = ctx;
+
+    /* run through the jit, the sequence is a single block which is entered
+       once before the cycles run out */
+    jit_free_blocks(jit);
+    jit_run(jit, 1);
+    struct armv3_context jit_out = ctx;
+    memcpy(jit_mem, &fuzz_mem[FUZZ_WINDOW_ADDR], sizeof(jit_mem));
+
+    /* run the same input through the fallbacks */
+    memcpy(&fuzz_mem[FUZZ_WINDOW_ADDR], in_mem, sizeof(in_mem));
+    ctx = in;
+    fuzz_run_fallbacks(guest, end_addr);
+    struct armv3_context fallback_out = ctx;
+    memcpy(fallback_mem, &fuzz_mem[FUZZ_WINDOW_ADDR], sizeof(fallback_mem));
+
+    fuzz_compare(code, num_instrs, &fallback_out, &jit_out, fallback_mem,
+                 jit_mem);
+  }
+
+  LOG_INFO("%d sequences of %d instructions matched the fallbacks",
+           FUZZ_SEQUENCES, FUZZ_INSTRS);
+
+  jit_destroy(jit);
+  armv3_guest_destroy(guest);
+  backend->destroy(backend);
+  frontend->destroy(frontend);
+}
+
+#if ARCH_X64
+TEST(armv3_fuzz_x64) {
+  DEFINE_JIT_CODE_BUFFER(armv3_fuzz_code);
+  run_armv3_fuzz(x64_backend_create(armv3_fuzz_code, sizeof(armv3_fuzz_code)));
+}
+#endif
+
+TEST(armv3_fuzz_ir_interp) {
+  run_armv3_fuzz(ir_interp_backend_create());
+}
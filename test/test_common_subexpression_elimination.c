@@ -0,0 +1,58 @@
+#include "jit/ir/ir.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
+#include "ir_test.h"
+#include "retest.h"
+
+static uint8_t ir_buffer[1024 * 1024];
+
+TEST(common_subexpression_elimination) {
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  struct ir_value *a = ir_load_context(&ir, 0x10, VALUE_I32);
+  struct ir_value *b = ir_load_context(&ir, 0x14, VALUE_I32);
+
+  /* commuted arguments and freshly allocated constants should both match */
+  struct ir_value *x = ir_add(&ir, a, b);
+  struct ir_value *y = ir_add(&ir, b, a);
+  struct ir_value *z = ir_and(&ir, x, ir_alloc_i32(&ir, 0xff));
+  struct ir_value *w = ir_and(&ir, y, ir_alloc_i32(&ir, 0xff));
+  ir_store_context(&ir, 0x18, z);
+  ir_store_context(&ir, 0x1c, w);
+
+  /* different constants and non-commutative ops shouldn't */
+  struct ir_value *u = ir_and(&ir, x, ir_alloc_i32(&ir, 0xfe));
+  struct ir_value *s0 = ir_sub(&ir, a, b);
+  struct ir_value *s1 = ir_sub(&ir, b, a);
+  ir_store_context(&ir, 0x20, u);
+  ir_store_context(&ir, 0x24, s0);
+  ir_store_context(&ir, 0x28, s1);
+
+  /* loads aren't pure, and are left for lse */
+  struct ir_value *c = ir_load_context(&ir, 0x10, VALUE_I32);
+  ir_store_context(&ir, 0x2c, c);
+
+  struct cse *cse = cse_create();
+  cse_run(cse, &ir);
+  cse_destroy(cse);
+
+  CHECK_EQ(ir_test_count_instrs(&ir, OP_ADD), 1);
+  CHECK_EQ(ir_test_count_instrs(&ir, OP_AND), 2);
+  CHECK_EQ(ir_test_count_instrs(&ir, OP_SUB), 2);
+  CHECK_EQ(ir_test_count_instrs(&ir, OP_LOAD_CONTEXT), 3);
+
+  /* both stores should now reference the first and */
+  list_for_each_entry(block, &ir.blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      if (instr->op != OP_STORE_CONTEXT) {
+        continue;
+      }
+
+      int offset = instr->arg[0]->i32;
+      if (offset == 0x18 || offset == 0x1c) {
+        CHECK_EQ(instr->arg[1], z);
+      }
+    }
+  }
+}
@@ -0,0 +1,261 @@
+#include "jit/ir/ir.h"
+#include "jit/jit_cache.h"
+#include "jit_stub.h"
+#include "retest.h"
+
+#define NUM_BLOCKS 0x10000
+
+TEST(jit_add_edge) {
+  struct jit *jit = stub_jit_create(1);
+
+  /* fill the cache with enough blocks to simulate a large title */
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    jit_compile_block(jit, stub_block_addr(i));
+  }
+
+  /* link each block to another, using the address of the branch at the end
+     of the source block as the edge's origin */
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    uint32_t src_addr = stub_block_addr(i);
+    uint32_t dst_addr = stub_block_addr((i * 7919) % NUM_BLOCKS);
+    uint8_t *src_code = stub_backend_lookup_code(&stub_backend, src_addr);
+    CHECK_NOTNULL(src_code);
+
+    int size = stub_block_size(src_addr);
+    jit_add_edge(jit, src_code + size - 5, dst_addr);
+  }
+
+  CHECK_EQ(stub_num_patched, NUM_BLOCKS);
+
+  /* edges to addresses without a compiled block shouldn't be added, even if
+     the address maps to the same entry as a compiled block */
+  uint8_t *src_code =
+      stub_backend_lookup_code(&stub_backend, stub_block_addr(0));
+  jit_add_edge(jit, src_code, stub_block_addr(1) | 0x80000000);
+  CHECK_EQ(stub_num_patched, NUM_BLOCKS);
+
+  stub_jit_destroy(jit);
+}
+
+static int stub_block_region(uint32_t addr) {
+  uint8_t *host_addr = stub_backend_lookup_code(NULL, addr);
+  if (!host_addr) {
+    return -1;
+  }
+  return (int)((host_addr - stub_code) / stub_code_region_size);
+}
+
+TEST(jit_evict_region) {
+  /* split the code buffer into four small regions */
+  struct jit *jit = stub_jit_create(4);
+
+  /* fill each region in turn. once the buffer wraps around, the first region
+     should be evicted on its own. blocks are compiled in address order, so
+     most of the guest pages are only used by blocks in a single region */
+  uint32_t first_addr = 0;
+  int num_blocks = 0;
+  int linked = 0;
+
+  for (int i = 0; stub_code_region || !linked; i++) {
+    uint32_t addr = (uint32_t)i << STUB_ADDR_SHIFT;
+
+    /* on overflow, dispatch would try to compile the block again */
+    jit_compile_block(jit, addr);
+    if (!stub_backend_lookup_code(&stub_backend, addr)) {
+      jit_compile_block(jit, addr);
+    }
+    CHECK_EQ(stub_block_region(addr), stub_code_region);
+
+    /* link the first block of the second region to the very first block */
+    if (stub_code_region == 1 && !linked) {
+      uint8_t *src_code = stub_backend_lookup_code(&stub_backend, addr);
+      jit_add_edge(jit, src_code + 59, first_addr);
+      CHECK_EQ(stub_num_patched, 1);
+      linked = 1;
+    }
+
+    num_blocks++;
+  }
+
+  /* the first region was evicted, restoring the edge into it. the only block
+     left in it is the one just compiled after the eviction */
+  int num_resident = 0;
+  int num_first_region = 0;
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    num_first_region += stub_block_region(block->guest_addr) == 0;
+    num_resident++;
+  }
+
+  CHECK_EQ(stub_backend_lookup_code(&stub_backend, first_addr), NULL);
+  CHECK_EQ(stub_num_restored, 1);
+  CHECK_EQ(num_first_region, 1);
+  CHECK_GT(num_resident, num_blocks / 2);
+
+  /* the guest pages which only had evicted blocks on them are no longer
+     protected */
+  static uint8_t resident_pages[array_size(stub_protected_pages)];
+  memset(resident_pages, 0, sizeof(resident_pages));
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    uint32_t addr = block->guest_addr & STUB_ADDR_MASK;
+    resident_pages[addr >> JIT_CODE_PAGE_SHIFT] = 1;
+  }
+
+  int num_unprotected = 0;
+  for (int i = 0; i < (int)array_size(stub_protected_pages); i++) {
+    CHECK_EQ(stub_protected_pages[i], resident_pages[i]);
+    num_unprotected += !stub_protected_pages[i];
+  }
+  CHECK_GT(num_unprotected, 0);
+
+  stub_jit_destroy(jit);
+  CHECK_EQ(memchr(stub_protected_pages, 1, sizeof(stub_protected_pages)), NULL);
+}
+
+static void write_ir(struct ir *ir, char *buffer, int size) {
+  FILE *output = tmpfile();
+  ir_write(ir, output);
+  rewind(output);
+  size_t n = fread(buffer, 1, size - 1, output);
+  buffer[n] = 0;
+  fclose(output);
+  CHECK_NE(n, 0u);
+}
+
+TEST(jit_cache) {
+  static uint8_t ir_buffer[0x10000];
+  static char expected[0x1000];
+  static char actual[0x1000];
+  static const char path[] = "test_jit_cache.bin";
+
+  struct jit *jit = stub_jit_create(1);
+
+  for (int i = 0; i < (int)sizeof(stub_guest_code); i++) {
+    stub_guest_code[i] = (uint8_t)i;
+  }
+
+  struct jit_block block = {0};
+  block.guest_addr = 0x10;
+  block.guest_size = 0x20;
+  block.num_instrs = 8;
+  block.num_cycles = 9;
+
+  /* build up a block referencing host pointers which need to be relocated */
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  struct ir_value *v = ir_load_context(&ir, 0x10, VALUE_I32);
+  v->reg = 3;
+  ir_store_context(&ir, 0x14, ir_add(&ir, v, ir_alloc_i32(&ir, 4)));
+  ir_call_1(&ir, ir_alloc_ptr(&ir, &stub_guest_r8),
+            ir_alloc_ptr(&ir, &stub_data));
+  /* guest values that happen to look like host pointers are left alone */
+  ir_store_context(&ir, 0x18, ir_alloc_i64(&ir, (intptr_t)&stub_guest_r8));
+  ir_fallback(&ir, &stub_fallback, 0x10, 0x1234);
+  ir_branch(&ir, ir_alloc_i32(&ir, 0x30));
+  ir.locals_size = 16;
+  write_ir(&ir, expected, sizeof(expected));
+
+  /* write the block out and read it back in with a new cache */
+  struct jit_cache *jc = jit_cache_create(jit, path);
+  struct jit_cache_key key;
+  jit_cache_key(jc, &block, &key);
+  jit_cache_save(jc, &block, &key, &ir);
+  jit_cache_destroy(jc);
+
+  jc = jit_cache_create(jit, path);
+
+  struct jit_block loaded = {0};
+  loaded.guest_addr = 0x10;
+  memset(&ir, 0, sizeof(ir));
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+  CHECK(jit_cache_load(jc, &loaded, &ir));
+  CHECK_EQ(loaded.guest_size, 0x20);
+  CHECK_EQ(loaded.num_instrs, 8);
+  CHECK_EQ(loaded.num_cycles, 9);
+  CHECK_EQ(ir.locals_size, 16);
+
+  struct ir_block *head = list_first_entry(&ir.blocks, struct ir_block, it);
+  struct ir_instr *first = list_first_entry(&head->instrs, struct ir_instr, it);
+  CHECK_EQ(first->result->reg, 3);
+
+  int num_ptrs = 0;
+  list_for_each_entry(instr, &head->instrs, struct ir_instr, it) {
+    for (int i = 0; i < IR_MAX_ARGS; i++) {
+      struct ir_value *arg = instr->arg[i];
+      if (arg && ir_is_constant(arg) && arg->host_ptr) {
+        num_ptrs++;
+      }
+    }
+    if (instr->op == OP_STORE_CONTEXT && instr->arg[0]->i32 == 0x18) {
+      CHECK(!instr->arg[1]->host_ptr);
+    }
+  }
+  CHECK_EQ(num_ptrs, 3);
+
+  write_ir(&ir, actual, sizeof(actual));
+  CHECK_STREQ(actual, expected);
+
+  /* blocks whose guest code has changed shouldn't be loaded */
+  stub_guest_code[0x2f] ^= 0xff;
+  memset(&ir, 0, sizeof(ir));
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+  CHECK(!jit_cache_load(jc, &loaded, &ir));
+
+  /* blocks referencing host pointers which can't be relocated aren't cached */
+  int other;
+  memset(&ir, 0, sizeof(ir));
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+  ir_call_1(&ir, ir_alloc_ptr(&ir, &stub_guest_r8), ir_alloc_ptr(&ir, &other));
+  ir_branch(&ir, ir_alloc_i32(&ir, 0x30));
+
+  block.guest_addr = 0x40;
+  jit_cache_key(jc, &block, &key);
+  jit_cache_save(jc, &block, &key, &ir);
+
+  loaded.guest_addr = 0x40;
+  memset(&ir, 0, sizeof(ir));
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+  CHECK(!jit_cache_load(jc, &loaded, &ir));
+
+  jit_cache_destroy(jc);
+  remove(path);
+
+  stub_jit_destroy(jit);
+}
+
+TEST(jit_get_hot_blocks) {
+  struct jit *jit = stub_jit_create(1);
+
+  /* give each block a run count that isn't in address order */
+  for (int i = 0; i < 100; i++) {
+    jit_compile_block(jit, stub_block_addr(i));
+  }
+
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    block->num_runs = (int)((block->guest_addr * 2654435761u) >> 16);
+  }
+
+  struct jit_block *blocks[8];
+  int n = jit_get_hot_blocks(jit, blocks, 8);
+  CHECK_EQ(n, 8);
+
+  /* the blocks should be the 8 most ran, in descending order */
+  int num_hotter = 0;
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    if (block->num_runs > blocks[7]->num_runs) {
+      num_hotter++;
+    }
+  }
+  CHECK_EQ(num_hotter, 7);
+
+  for (int i = 1; i < n; i++) {
+    CHECK_GE(blocks[i - 1]->num_runs, blocks[i]->num_runs);
+  }
+
+  stub_jit_destroy(jit);
+}
@@ -1,5 +1,6 @@
 #include "jit/ir/ir.h"
 #include "jit/passes/load_store_elimination_pass.h"
+#include "ir_test.h"
 #include "retest.h"
 
 static uint8_t ir_buffer[1024 * 1024];
@@ -79,3 +80,28 @@ static char scratch_buffer[1024 * 1024];
 
   CHECK_STREQ(scratch_buffer, output_str);
 }*/
+
+TEST(load_store_elimination_side_exit) {
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  struct ir_value *a = ir_load_context(&ir, 0x10, VALUE_I32);
+  ir_store_context(&ir, 0x14, a);
+
+  struct ir_value *cond = ir_cmp_eq(&ir, a, ir_alloc_i32(&ir, 0));
+  ir_branch_true(&ir, cond, ir_alloc_i32(&ir, 0x8c000000));
+
+  /* the load on the fallthrough path is redundant, however the first store
+     must be kept as the exit may read it */
+  struct ir_value *b = ir_load_context(&ir, 0x10, VALUE_I32);
+  ir_store_context(&ir, 0x14, ir_add(&ir, b, ir_alloc_i32(&ir, 1)));
+  ir_branch(&ir, ir_alloc_i32(&ir, 0x8c000010));
+
+  struct lse *lse = lse_create();
+  lse_run(lse, &ir);
+  lse_destroy(lse);
+
+  CHECK_EQ(ir_test_count_instrs(&ir, OP_LOAD_CONTEXT), 1);
+  CHECK_EQ(ir_test_count_instrs(&ir, OP_STORE_CONTEXT), 2);
+}
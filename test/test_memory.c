@@ -0,0 +1,136 @@
+#include "core/core.h"
+#include "core/option.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "retest.h"
+
+DECLARE_OPTION_INT(sh4_interp);
+
+TEST(as_dispatch) {
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  struct address_space *space = dc->sh4->memory_if->space;
+
+  /* physical memory is visible through each of its mirrors */
+  as_write32(space, 0x8c010000, 0xdeadbeef);
+  CHECK_EQ(as_read32(space, 0x0c010000), 0xdeadbeef);
+  CHECK_EQ(as_read32(space, 0xad010000), 0xdeadbeef);
+  CHECK_EQ(as_read16(space, 0x0e010002), 0xdead);
+  CHECK_EQ(as_read8(space, 0xac010000), 0xef);
+
+  /* mmio registers are dispatched to their handlers through each mirror, at
+     the offset inside of the region */
+  as_write32(space, 0x005f8040, 0x00123456);
+  CHECK_EQ(as_read32(space, 0xa05f8040), 0x00123456);
+  as_write32(space, 0xff000008, 0x8c000000);
+  CHECK_EQ(as_read32(space, 0x1f000008), 0x8c000000);
+
+  /* the lookup used by compiled code resolves to the same dispatch */
+  void *ptr;
+  void *userdata;
+  mmio_read_cb read;
+  mmio_write_cb write;
+  uint32_t offset;
+
+  as_lookup(space, 0x8c010000, &ptr, &userdata, &read, &write, &offset);
+  CHECK_EQ(ptr, as_translate(space, 0x8c010000));
+  CHECK(!read && !write);
+
+  as_lookup(space, 0xa05f8040, &ptr, &userdata, &read, &write, &offset);
+  CHECK(!ptr && read && write);
+  CHECK_EQ(read(userdata, offset, 0xffffffff), 0x00123456);
+
+  /* unmapped pages dispatch to the default handlers */
+  CHECK_EQ(as_read32(space, 0x00300000), 0);
+
+  dc_destroy(dc);
+}
+
+TEST(as_lookup_storage) {
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  struct address_space *space = dc->sh4->memory_if->space;
+
+  /* registers without callbacks resolve to their backing storage */
+  uint32_t *storage = as_lookup_storage(space, 0xa05f8040, 0);
+  CHECK_NOTNULL(storage);
+  CHECK_EQ(as_lookup_storage(space, 0x005f8040, 1), storage);
+  as_write32(space, 0x005f8040, 0x00abcdef);
+  CHECK_EQ(*storage, 0x00abcdef);
+
+  storage = as_lookup_storage(space, 0xff000008, 1);
+  CHECK_NOTNULL(storage);
+  *storage = 0x8c001000;
+  CHECK_EQ(as_read32(space, 0x1f000008), 0x8c001000);
+
+  /* side effects are only skipped for the direction without a callback */
+  CHECK_NOTNULL(as_lookup_storage(space, 0x005f6904, 0));
+  CHECK(!as_lookup_storage(space, 0x005f6904, 1));
+  CHECK(!as_lookup_storage(space, 0x005f6900, 0));
+
+  /* the pvr's id register drops writes */
+  CHECK_NOTNULL(as_lookup_storage(space, 0x005f8000, 0));
+  CHECK(!as_lookup_storage(space, 0x005f8000, 1));
+
+  /* physical memory and regions without storage have none */
+  CHECK(!as_lookup_storage(space, 0x8c010000, 0));
+  CHECK(!as_lookup_storage(space, 0x00700000, 0));
+
+  dc_destroy(dc);
+}
+
+/* increments TTB through a constant address, which compiled code accesses
+   directly */
+static const uint16_t storage_code[] = {
+    0xe1ff, /* mov #-1, r1 */
+    0x4128, /* shll16 r1 */
+    0x4118, /* shll8 r1 */
+    0x7108, /* add #8, r1 */
+    0x6012, /* mov.l @r1, r0 */
+    0x7001, /* add #1, r0 */
+    0x2102, /* mov.l r0, @r1 */
+    0x000b, /* rts */
+    0x0009, /* nop */
+};
+
+static void run_storage_code() {
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  struct sh4 *sh4 = dc->sh4;
+  struct address_space *space = sh4->memory_if->space;
+
+  as_memcpy_to_guest(space, 0x8c010000, storage_code, sizeof(storage_code));
+  sh4_reset(sh4, 0x8c010000);
+  as_write32(space, 0xff000008, 0x8c001000);
+  dc_resume(dc);
+
+  /* the first run faults when fastmem is enabled, recompiling the block to
+     access the register through its constant address */
+  for (int i = 0; i < 2; i++) {
+    sh4->ctx.pc = 0x8c010000;
+
+    while (sh4->ctx.pc) {
+      dc_tick(dc, 1);
+    }
+  }
+
+  CHECK_EQ(sh4->ctx.r[0], 0x8c001002);
+  CHECK_EQ(as_read32(space, 0xff000008), 0x8c001002);
+
+  dc_destroy(dc);
+}
+
+TEST(as_storage_x64) {
+  run_storage_code();
+}
+
+TEST(as_storage_ir_interp) {
+  int sh4_interp = OPTION_sh4_interp;
+  OPTION_sh4_interp = 2;
+  run_storage_code();
+  OPTION_sh4_interp = sh4_interp;
+}
@@ -0,0 +1,59 @@
+#include "jit/backend/jit_backend.h"
+#include "jit/ir/ir.h"
+#include "jit/passes/register_allocation_pass.h"
+#include "ir_test.h"
+#include "retest.h"
+
+static uint8_t ir_buffer[1024 * 1024];
+
+/* caller-saved registers are listed first, so they'd be picked if the
+   allocator took the first free register */
+static const struct jit_register ra_registers[] = {
+    {"caller0", VALUE_INT_MASK, JIT_CALLER_SAVED, NULL},
+    {"caller1", VALUE_INT_MASK, JIT_CALLER_SAVED, NULL},
+    {"callee0", VALUE_INT_MASK, JIT_CALLEE_SAVED, NULL},
+    {"callee1", VALUE_INT_MASK, JIT_CALLEE_SAVED, NULL},
+};
+
+static struct jit_emitter ra_emitters[IR_NUM_OPS];
+
+static void ra_callee(void) {}
+
+static int ra_reg_flags(struct ir_value *v) {
+  CHECK_NE(v->reg, NO_REGISTER);
+  return ra_registers[v->reg].flags;
+}
+
+TEST(register_allocation_call) {
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  /* let every op encode its constant arguments directly */
+  for (int i = 0; i < IR_NUM_OPS; i++) {
+    for (int j = 0; j < IR_MAX_ARGS; j++) {
+      ra_emitters[i].arg_flags[j] =
+          JIT_CONSTRAINT_IMM_I32 | JIT_CONSTRAINT_IMM_I64;
+    }
+  }
+
+  /* a is live across the call, b and c are dead before it */
+  struct ir_value *a = ir_load_context(&ir, 0x10, VALUE_I32);
+  struct ir_value *b = ir_load_context(&ir, 0x14, VALUE_I32);
+  struct ir_value *c = ir_add(&ir, b, ir_alloc_i32(&ir, 1));
+  ir_store_context(&ir, 0x18, c);
+  ir_call(&ir, ir_alloc_ptr(&ir, &ra_callee));
+  ir_store_context(&ir, 0x1c, a);
+
+  struct ra *ra = ra_create(ra_registers, array_size(ra_registers),
+                            ra_emitters, array_size(ra_emitters));
+  ra_run(ra, &ir);
+  ra_destroy(ra);
+
+  CHECK_EQ(ra_reg_flags(a), JIT_CALLEE_SAVED);
+  CHECK_EQ(ra_reg_flags(b), JIT_CALLER_SAVED);
+  CHECK_EQ(ra_reg_flags(c), JIT_CALLER_SAVED);
+
+  /* nothing needed to be spilled around the call */
+  CHECK_EQ(ir_test_count_instrs(&ir, OP_STORE_LOCAL), 0);
+}
@@ -0,0 +1,185 @@
+#include "core/core.h"
+#include "guest/dreamcast.h"
+#include "guest/scheduler.h"
+#include "retest.h"
+#include "timer_mix.h"
+
+#define MAX_FIRED 1024
+
+struct fired_log {
+  int order[MAX_FIRED];
+  int num_fired;
+};
+
+struct fired_timer {
+  struct fired_log *log;
+  int id;
+};
+
+static void fired_timer_cb(void *data) {
+  struct fired_timer *t = data;
+  struct fired_log *log = t->log;
+  CHECK_LT(log->num_fired, MAX_FIRED);
+  log->order[log->num_fired++] = t->id;
+}
+
+static struct dreamcast *create_machine() {
+  /* the scheduler only needs the run state and device list of the machine */
+  struct dreamcast *dc = calloc(1, sizeof(struct dreamcast));
+  dc->running = 1;
+  return dc;
+}
+
+TEST(scheduler_order) {
+  struct dreamcast *dc = create_machine();
+  struct scheduler *sch = scheduler_create(dc);
+  struct fired_log log = {0};
+
+  /* timers expiring at the same time fire in the order they were started */
+  static const int64_t expire[] = {50, 10, 30, 10, 20, 30, 10, 40};
+  static const int expected[] = {1, 3, 6, 4, 2, 5, 7, 0};
+  struct fired_timer timers[array_size(expire)];
+
+  for (int i = 0; i < (int)array_size(expire); i++) {
+    timers[i].log = &log;
+    timers[i].id = i;
+    scheduler_start_timer(sch, &fired_timer_cb, &timers[i], expire[i]);
+  }
+
+  scheduler_tick(sch, 25);
+  CHECK_EQ(log.num_fired, 4);
+
+  scheduler_tick(sch, 100);
+  CHECK_EQ(log.num_fired, (int)array_size(expected));
+
+  for (int i = 0; i < (int)array_size(expected); i++) {
+    CHECK_EQ(log.order[i], expected[i]);
+  }
+
+  scheduler_destroy(sch);
+  free(dc);
+}
+
+TEST(scheduler_cancel) {
+  struct dreamcast *dc = create_machine();
+  struct scheduler *sch = scheduler_create(dc);
+  struct fired_log log = {0};
+
+  struct fired_timer timers[16];
+  struct timer *handles[16];
+
+  for (int i = 0; i < 16; i++) {
+    timers[i].log = &log;
+    timers[i].id = i;
+    handles[i] =
+        scheduler_start_timer(sch, &fired_timer_cb, &timers[i], 100 - i * 5);
+  }
+
+  scheduler_tick(sch, 10);
+  CHECK_EQ(scheduler_remaining_time(sch, handles[0]), 90);
+
+  /* cancel every other timer, including the next to expire */
+  for (int i = 1; i < 16; i += 2) {
+    scheduler_cancel_timer(sch, handles[i]);
+  }
+
+  /* canceling twice is harmless */
+  scheduler_cancel_timer(sch, handles[15]);
+
+  scheduler_tick(sch, 1000);
+  CHECK_EQ(log.num_fired, 8);
+
+  for (int i = 0; i < 8; i++) {
+    CHECK_EQ(log.order[i], 14 - i * 2);
+  }
+
+  scheduler_destroy(sch);
+  free(dc);
+}
+
+TEST(scheduler_grow) {
+  struct dreamcast *dc = create_machine();
+  struct scheduler *sch = scheduler_create(dc);
+  struct fired_log log = {0};
+
+  /* start more timers than the initial pool holds, in reverse order */
+  static struct fired_timer timers[MAX_FIRED];
+
+  for (int i = MAX_FIRED - 1; i >= 0; i--) {
+    timers[i].log = &log;
+    timers[i].id = i;
+    scheduler_start_timer(sch, &fired_timer_cb, &timers[i], i + 1);
+  }
+
+  scheduler_tick(sch, MAX_FIRED);
+  CHECK_EQ(log.num_fired, MAX_FIRED);
+
+  for (int i = 0; i < MAX_FIRED; i++) {
+    CHECK_EQ(log.order[i], i);
+  }
+
+  scheduler_destroy(sch);
+  free(dc);
+}
+
+struct slice_device {
+  struct device;
+  int num_runs;
+  int64_t ran;
+};
+
+static void slice_device_run(struct device *dev, int64_t ns) {
+  struct slice_device *sd = (struct slice_device *)dev;
+  sd->num_runs++;
+  sd->ran += ns;
+}
+
+static void yield_timer_cb(void *data) {
+  scheduler_yield(data);
+}
+
+TEST(scheduler_slices) {
+  struct dreamcast *dc = create_machine();
+  struct scheduler *sch = scheduler_create(dc);
+
+  struct slice_device dev = {0};
+  dev.execute_if = dc_create_execute_interface(&slice_device_run, 1);
+  list_add(&dc->devices, &dev.it);
+
+  /* devices run the full distance to each timer as a single slice */
+  struct fired_log log = {0};
+  struct fired_timer timers[2] = {{&log, 0}, {&log, 1}};
+  scheduler_start_timer(sch, &fired_timer_cb, &timers[0], 300);
+  scheduler_start_timer(sch, &fired_timer_cb, &timers[1], 700);
+
+  scheduler_tick(sch, 1000);
+  CHECK_EQ(dev.num_runs, 3);
+  CHECK_EQ(dev.ran, 1000);
+
+  /* halted devices are skipped entirely */
+  dev.execute_if->halted = 1;
+  scheduler_tick(sch, 1000);
+  CHECK_EQ(dev.num_runs, 3);
+  dev.execute_if->halted = 0;
+
+  /* yielding ends the tick once the expired timers have run */
+  scheduler_start_timer(sch, &yield_timer_cb, sch, 100);
+  scheduler_tick(sch, 1000);
+  CHECK_EQ(dev.num_runs, 4);
+  CHECK_EQ(dev.ran, 1100);
+
+  dc_destroy_execute_interface(dev.execute_if);
+  scheduler_destroy(sch);
+  free(dc);
+}
+
+TEST(scheduler_timer_mix) {
+  timer_mix_create();
+  timer_mix_run();
+
+  /* allow for the rounding of each period */
+  CHECK(mix_timers[0].fired >= 15733 && mix_timers[0].fired <= 15735);
+  CHECK_EQ(mix_timers[5].fired, 1);
+
+  timer_mix_destroy();
+}
@@ -1,7 +1,14 @@
 #include "core/math.h"
+#include "core/option.h"
 #include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 #include "retest.h"
+#include "sh4_test.h"
+
+DECLARE_OPTION_INT(sh4_idle_loops);
+DECLARE_OPTION_INT(sh4_interp);
 
 static const uint32_t UNINITIALIZED_REG = 0xbaadf00d;
 
@@ -123,7 +130,7 @@ static void run_sh4_test(struct dreamcast *dc, const struct sh4_test *test) {
   }
 }
 
-TEST(sh4_x64) {
+static void run_sh4_tests() {
   struct dreamcast *dc = dc_create(NULL);
   CHECK_NOTNULL(dc);
 
@@ -176,3 +183,174 @@ TEST(sh4_x64) {
 
   dc_destroy(dc);
 }
+
+TEST(sh4_x64) {
+  run_sh4_tests();
+}
+
+TEST(sh4_interp) {
+  int sh4_interp = OPTION_sh4_interp;
+  OPTION_sh4_interp = 1;
+  run_sh4_tests();
+  OPTION_sh4_interp = sh4_interp;
+}
+
+TEST(sh4_ir_interp) {
+  int sh4_interp = OPTION_sh4_interp;
+  OPTION_sh4_interp = 2;
+  run_sh4_tests();
+  OPTION_sh4_interp = sh4_interp;
+}
+
+static void run_mac_loop() {
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  sh4_test_run_mac_loop(dc);
+
+  dc_destroy(dc);
+}
+
+TEST(sh4_mac_loop) {
+  run_mac_loop();
+}
+
+TEST(sh4_mac_loop_interp) {
+  int sh4_interp = OPTION_sh4_interp;
+  OPTION_sh4_interp = 1;
+  run_mac_loop();
+  OPTION_sh4_interp = sh4_interp;
+}
+
+TEST(sh4_mac_loop_ir_interp) {
+  int sh4_interp = OPTION_sh4_interp;
+  OPTION_sh4_interp = 2;
+  run_mac_loop();
+  OPTION_sh4_interp = sh4_interp;
+}
+
+/* code which patches the first instruction of a subroutine between calls to
+   it:
+
+     sts.l pr, @-r15
+     mov.l .SUB_ADDR, r0
+     jsr @r0
+     nop
+     mov r2, r3
+     mov.w .NEW_INSTR, r1
+     mov.w r1, @r0
+     jsr @r0
+     nop
+     lds.l @r15+, pr
+     rts
+     nop
+   .SUB:
+     mov #1, r2
+     rts
+     nop
+   .NEW_INSTR:
+     .word 0xe202 (mov #2, r2)
+   .SUB_ADDR:
+     .long .SUB */
+static const uint16_t smc_patch[] = {
+    0x4f22, 0xd007, 0x400b, 0x0009, 0x6323, 0x9108, 0x2011, 0x400b,
+    0x0009, 0x4f26, 0x000b, 0x0009, 0xe201, 0x000b, 0x0009, 0xe202,
+    0x0018, 0x8c01,
+};
+
+TEST(sh4_smc_patch) {
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  as_memcpy_to_guest(dc->sh4->memory_if->space, 0x8c010000, smc_patch,
+                     sizeof(smc_patch));
+  sh4_reset(dc->sh4, 0x8c010000);
+
+  dc_resume(dc);
+
+  while (dc->sh4->ctx.pc) {
+    dc_tick(dc, 1);
+  }
+
+  /* the write should invalidate the subroutine's block without the icache
+     being reset */
+  CHECK_EQ(dc->sh4->ctx.r[3], 1u);
+  CHECK_EQ(dc->sh4->ctx.r[2], 2u);
+
+  dc_destroy(dc);
+}
+
+/* loop polling a flag in memory, which is only set once a timer expires. once
+   released, the code spins in place:
+
+     mov.l .FLAG_ADDR, r1
+   .LOOP:
+     mov.l @r1, r0
+     tst r0, r0
+     bt .LOOP
+   .END:
+     bra .END
+     nop
+   .align 4
+   .FLAG_ADDR:
+     .long 0x8c020000 */
+#define IDLE_LOOP_FLAG_ADDR 0x8c020000
+#define IDLE_LOOP_END_ADDR 0x8c010008
+#define IDLE_LOOP_NS INT64_C(1000000)
+#define IDLE_LOOP_TICK_NS INT64_C(10000)
+
+static const uint16_t idle_loop[] = {
+    0xd102, 0x6012, 0x2008, 0x89fc, 0xaffe, 0x0009, 0x0000, 0x8c02,
+};
+
+static void idle_loop_release(void *data) {
+  struct dreamcast *dc = data;
+  as_write32(dc->sh4->memory_if->space, IDLE_LOOP_FLAG_ADDR, 1);
+}
+
+static int64_t run_idle_loop(int idle_loops) {
+  int sh4_idle_loops = OPTION_sh4_idle_loops;
+  OPTION_sh4_idle_loops = idle_loops;
+
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  struct address_space *space = dc->sh4->memory_if->space;
+  as_memcpy_to_guest(space, 0x8c010000, idle_loop, sizeof(idle_loop));
+  as_write32(space, IDLE_LOOP_FLAG_ADDR, 0);
+  sh4_reset(dc->sh4, 0x8c010000);
+
+  scheduler_start_timer(dc->scheduler, &idle_loop_release, dc, IDLE_LOOP_NS);
+
+  /* tick in short steps, summing up the instructions the sh4 ran in each. a
+     step is occasionally split by another device's timer, only the last
+     slice is counted for those */
+  int64_t instrs = 0;
+
+  dc_resume(dc);
+
+  for (int64_t t = 0; t < IDLE_LOOP_NS * 2; t += IDLE_LOOP_TICK_NS) {
+    dc_tick(dc, IDLE_LOOP_TICK_NS);
+    instrs += dc->sh4->ctx.ran_instrs;
+  }
+
+  /* the loop must have been released by the timer, and not before */
+  CHECK_EQ(dc->sh4->ctx.r[0], 1u);
+  CHECK_EQ(dc->sh4->ctx.pc, IDLE_LOOP_END_ADDR);
+
+  dc_destroy(dc);
+
+  OPTION_sh4_idle_loops = sh4_idle_loops;
+
+  return instrs;
+}
+
+TEST(sh4_idle_loop) {
+  int64_t spin_instrs = run_idle_loop(0);
+  int64_t idle_instrs = run_idle_loop(1);
+
+  /* spinning executes instructions for the entire 2ms, while each idle loop
+     yields up to the next scheduled event after a single pass */
+  CHECK_GT(spin_instrs, INT64_C(100000));
+  CHECK_LT(idle_instrs * 100, spin_instrs);
+}
@@ -0,0 +1,410 @@
+#include <ctype.h>
+#include <string.h>
+#include "core/core.h"
+#include "core/option.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "jit/frontend/jit_frontend.h"
+#include "jit/frontend/sh4/sh4_disasm.h"
+#include "jit/frontend/sh4/sh4_guest.h"
+#include "retest.h"
+
+DECLARE_OPTION_INT(sh4_interp);
+
+/* random instruction sequences are ran through the jit and then again through
+   each instruction's fallback on the same input state. the fallbacks are
+   simple enough to be trusted, so any difference in the output state points
+   at a bug in the ir passes or an emitter */
+#define FUZZ_SEED 0x5eed1234
+#define FUZZ_SEQUENCES 1000
+#define FUZZ_INSTRS 16
+
+#define FUZZ_CODE_ADDR 0x8c010000
+
+/* every register used as an address by a load or store is restricted to
+   r8-r15, pointing into the middle of this window. it's large enough that
+   the displacements and post-increments of a full sequence never step out */
+#define FUZZ_WINDOW_ADDR 0x8c100000
+#define FUZZ_WINDOW_SIZE 0x1000
+
+struct fuzz_reg {
+  const char *name;
+  size_t offset;
+  int num;
+};
+
+static struct fuzz_reg fuzz_regs[] = {
+    {"r", offsetof(struct sh4_context, r), 16},
+    {"ralt", offsetof(struct sh4_context, ralt), 8},
+    {"fr", offsetof(struct sh4_context, fr), 16},
+    {"xf", offsetof(struct sh4_context, xf), 16},
+    {"pr", offsetof(struct sh4_context, pr), 1},
+    {"sr", offsetof(struct sh4_context, sr), 1},
+    {"fpscr", offsetof(struct sh4_context, fpscr), 1},
+    {"dbr", offsetof(struct sh4_context, dbr), 1},
+    {"gbr", offsetof(struct sh4_context, gbr), 1},
+    {"vbr", offsetof(struct sh4_context, vbr), 1},
+    {"fpul", offsetof(struct sh4_context, fpul), 1},
+    {"mach", offsetof(struct sh4_context, mach), 1},
+    {"macl", offsetof(struct sh4_context, macl), 1},
+    {"sgr", offsetof(struct sh4_context, sgr), 1},
+    {"spc", offsetof(struct sh4_context, spc), 1},
+    {"ssr", offsetof(struct sh4_context, ssr), 1},
+};
+
+static const uint32_t fuzz_ints[] = {
+    0x0, 0x1, 0x2, 0x1f, 0x20, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xffff,
+    0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff,
+};
+
+static const float fuzz_floats[] = {
+    0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 2.0f, 3.25f, -7.75f, 100.0f, 1.0e-3f,
+    65536.0f, -123456.0f,
+};
+
+struct fuzz_op {
+  struct jit_opdef *def;
+  uint16_t fixed;
+  /* FPSCR bits the instruction requires to be valid */
+  uint32_t fpscr_mask;
+  uint32_t fpscr;
+  /* bits of each 4-bit register field which is used as an address or written
+     as an integer register */
+  uint16_t addr_mask;
+  uint16_t dst_mask;
+  int num_fields;
+  struct {
+    int shift;
+    int bits;
+  } fields[4];
+};
+
+static struct fuzz_op fuzz_ops[NUM_SH4_OPS];
+static int fuzz_num_ops;
+static uint32_t fuzz_state;
+
+static uint32_t fuzz_rand() {
+  /* xorshift32, good enough and reproducible everywhere */
+  fuzz_state ^= fuzz_state << 13;
+  fuzz_state ^= fuzz_state >> 17;
+  fuzz_state ^= fuzz_state << 5;
+  return fuzz_state;
+}
+
+static int fuzz_has_operand(const char *desc, const char *operand) {
+  size_t len = strlen(operand);
+
+  for (const char *s = strstr(desc, operand); s; s = strstr(s + 1, operand)) {
+    int start = s == desc || !isalnum(s[-1]);
+    int end = !isalnum(s[len]) && s[len] != '_';
+    if (start && end) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int fuzz_ends_with(const char *desc, const char *operand) {
+  size_t desc_len = strlen(desc);
+  size_t len = strlen(operand);
+  return desc_len > len && !strcmp(desc + desc_len - len, operand) &&
+         strchr(" ,", desc[desc_len - len - 1]);
+}
+
+static int fuzz_supported(struct jit_opdef *def) {
+  /* control flow is left to the rts ending each sequence, and the modes set by
+     SR / FPSCR are randomized up front instead of being changed mid-block */
+  if (def->flags & (SH4_FLAG_INVALID | SH4_FLAG_SET_PC | SH4_FLAG_SET_SR |
+                    SH4_FLAG_SET_FPSCR)) {
+    return 0;
+  }
+
+  /* pr is needed to return from the sequence */
+  if (def->op == SH4_OP_LDSPR || def->op == SH4_OP_LDSMPR) {
+    return 0;
+  }
+
+  /* the vector ops sum their products pairwise on the host, which rounds
+     differently than the fallbacks' sequential sums. the sh4 itself doesn't
+     compute these exactly either, so there's no right answer to compare */
+  if (def->op == SH4_OP_FIPR || def->op == SH4_OP_FTRV) {
+    return 0;
+  }
+
+  /* gbr and r0 relative addresses aren't constrained to the scratch window */
+  if (strstr(def->desc, "gbr)") || strstr(def->desc, "(r0,")) {
+    return 0;
+  }
+
+  return 1;
+}
+
+static void fuzz_init_ops() {
+  fuzz_num_ops = 0;
+
+  for (int i = 0; i < NUM_SH4_OPS; i++) {
+    struct jit_opdef *def = &sh4_opdefs[i];
+
+    if (!fuzz_supported(def)) {
+      continue;
+    }
+
+    struct fuzz_op *op = &fuzz_ops[fuzz_num_ops++];
+    memset(op, 0, sizeof(*op));
+    op->def = def;
+
+    if (def->op == SH4_OP_FMAC) {
+      op->fpscr_mask = PR_MASK;
+      op->fpscr = 0;
+    } else if (def->op == SH4_OP_FCNVDS || def->op == SH4_OP_FCNVSD) {
+      op->fpscr_mask = PR_MASK;
+      op->fpscr = PR_MASK;
+    }
+
+    int mem = def->flags & (SH4_FLAG_LOAD | SH4_FLAG_STORE);
+    int load_dst =
+        (def->flags & SH4_FLAG_LOAD) && fuzz_ends_with(def->desc, "rn");
+    int int_dst = fuzz_has_operand(def->desc, "rn");
+
+    /* fields are contiguous runs of the same character in the signature,
+       which is written from the most significant bit down */
+    const char *sig = def->sig;
+    int len = (int)strlen(sig);
+
+    for (int j = 0; j < len;) {
+      char c = sig[j];
+      int bits = 1;
+      while (j + bits < len && sig[j + bits] == c) {
+        bits++;
+      }
+      int shift = len - j - bits;
+      j += bits;
+
+      if (c == '0') {
+        continue;
+      }
+
+      if (c == '1') {
+        op->fixed |= ((1 << bits) - 1) << shift;
+        continue;
+      }
+
+      CHECK_LT(op->num_fields, (int)array_size(op->fields));
+      op->fields[op->num_fields].shift = shift;
+      op->fields[op->num_fields].bits = bits;
+      op->num_fields++;
+
+      if (bits != 4 || (c != 'n' && c != 'm')) {
+        continue;
+      }
+
+      uint16_t mask = 0xf << shift;
+
+      if (mem) {
+        if (c == 'n' && load_dst) {
+          op->dst_mask |= mask;
+        } else {
+          op->addr_mask |= mask;
+        }
+      } else if (c == 'n' && int_dst) {
+        op->dst_mask |= mask;
+      }
+    }
+  }
+}
+
+static uint16_t fuzz_gen_instr(const struct sh4_context *ctx) {
+  struct fuzz_op *op = NULL;
+
+  do {
+    op = &fuzz_ops[fuzz_rand() % fuzz_num_ops];
+  } while ((ctx->fpscr & op->fpscr_mask) != op->fpscr);
+  uint16_t raw = op->fixed;
+
+  for (int i = 0; i < op->num_fields; i++) {
+    int shift = op->fields[i].shift;
+    int bits = op->fields[i].bits;
+    raw |= (fuzz_rand() & ((1 << bits) - 1)) << shift;
+  }
+
+  /* addresses come from r8-r15, integer results go to r0-r7 */
+  raw |= op->addr_mask & 0x8888;
+  raw &= ~(op->dst_mask & 0x8888);
+
+  return raw;
+}
+
+static uint32_t fuzz_gen_float() {
+  float f = fuzz_floats[fuzz_rand() % array_size(fuzz_floats)];
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+static void fuzz_gen_context(struct sh4_context *ctx) {
+  for (int i = 0; i < 8; i++) {
+    ctx->r[i] = (fuzz_rand() & 1)
+                    ? fuzz_ints[fuzz_rand() % array_size(fuzz_ints)]
+                    : fuzz_rand();
+    ctx->ralt[i] = fuzz_rand();
+  }
+
+  for (int i = 8; i < 16; i++) {
+    uint32_t offset =
+        FUZZ_WINDOW_SIZE / 4 + (fuzz_rand() % (FUZZ_WINDOW_SIZE / 2));
+    ctx->r[i] = FUZZ_WINDOW_ADDR + (offset & ~7);
+  }
+
+  for (int i = 0; i < 16; i++) {
+    ctx->fr[i] = fuzz_gen_float();
+    ctx->xf[i] = fuzz_gen_float();
+  }
+
+  ctx->fpul = fuzz_rand();
+  ctx->mach = fuzz_rand();
+  ctx->macl = fuzz_rand();
+
+  /* randomize the precision and transfer size modes, each compiles into
+     different code */
+  ctx->fpscr &= ~(PR_MASK | SZ_MASK);
+  ctx->fpscr |= fuzz_rand() & (PR_MASK | SZ_MASK);
+
+  ctx->sr_t = fuzz_rand() & 1;
+  ctx->sr_s = fuzz_rand() & 1;
+  ctx->sr_m = fuzz_rand() & 1;
+  ctx->sr_qm = (fuzz_rand() & 1) << 31;
+}
+
+static void fuzz_dump(const uint16_t *code, int num_instrs) {
+  for (int i = 0; i < num_instrs; i++) {
+    uint32_t addr = FUZZ_CODE_ADDR + i * 2;
+    union sh4_instr instr = {code[i]};
+    char buffer[128];
+    sh4_format(addr, instr, buffer, sizeof(buffer));
+    LOG_INFO("  0x%08x 0x%04x %s", addr, code[i], buffer);
+  }
+}
+
+static void fuzz_run_fallbacks(struct dreamcast *dc) {
+  struct sh4 *sh4 = dc->sh4;
+  struct jit_guest *guest = (struct jit_guest *)sh4->guest;
+
+  while (sh4->ctx.pc) {
+    uint32_t addr = sh4->ctx.pc;
+    uint16_t raw = as_read16(sh4->memory_if->space, addr);
+    struct jit_opdef *def = sh4_get_opdef(raw);
+    def->fallback(guest, addr, raw);
+  }
+}
+
+static void fuzz_run_jit(struct dreamcast *dc) {
+  dc_resume(dc);
+
+  while (dc->sh4->ctx.pc) {
+    dc_tick(dc, 1);
+  }
+}
+
+static void fuzz_compare(const uint16_t *code, int num_instrs,
+                         const struct sh4_context *expected,
+                         const struct sh4_context *actual,
+                         const uint8_t *expected_mem,
+                         const uint8_t *actual_mem) {
+  for (int i = 0; i < (int)array_size(fuzz_regs); i++) {
+    struct fuzz_reg *reg = &fuzz_regs[i];
+    const uint32_t *a =
+        (const uint32_t *)((const uint8_t *)expected + reg->offset);
+    const uint32_t *b =
+        (const uint32_t *)((const uint8_t *)actual + reg->offset);
+
+    for (int j = 0; j < reg->num; j++) {
+      if (a[j] != b[j]) {
+        fuzz_dump(code, num_instrs);
+      }
+      CHECK_EQ(a[j], b[j], "%s[%d] expected 0x%08x, actual 0x%08x", reg->name,
+               j, a[j], b[j]);
+    }
+  }
+
+  for (int i = 0; i < FUZZ_WINDOW_SIZE; i++) {
+    if (expected_mem[i] != actual_mem[i]) {
+      fuzz_dump(code, num_instrs);
+    }
+    CHECK_EQ(expected_mem[i], actual_mem[i],
+             "0x%08x expected 0x%02x, actual 0x%02x", FUZZ_WINDOW_ADDR + i,
+             expected_mem[i], actual_mem[i]);
+  }
+}
+
+static void run_sh4_fuzz() {
+  struct dreamcast *dc = dc_create(NULL);
+  CHECK_NOTNULL(dc);
+
+  struct sh4 *sh4 = dc->sh4;
+  struct address_space *space = sh4->memory_if->space;
+
+  static uint8_t in_mem[FUZZ_WINDOW_SIZE];
+  static uint8_t jit_mem[FUZZ_WINDOW_SIZE];
+  static uint8_t fallback_mem[FUZZ_WINDOW_SIZE];
+
+  fuzz_state = FUZZ_SEED;
+  fuzz_init_ops();
+
+  for (int n = 0; n < FUZZ_SEQUENCES; n++) {
+    sh4_reset(sh4, FUZZ_CODE_ADDR);
+    fuzz_gen_context(&sh4->ctx);
+
+    /* generate the sequence, returning through pr at the end */
+    uint16_t code[FUZZ_INSTRS + 2];
+    for (int i = 0; i < FUZZ_INSTRS; i++) {
+      code[i] = fuzz_gen_instr(&sh4->ctx);
+    }
+    code[FUZZ_INSTRS] = 0x000b;
+    code[FUZZ_INSTRS + 1] = 0x0009;
+
+    for (int i = 0; i < FUZZ_WINDOW_SIZE; i++) {
+      in_mem[i] = (uint8_t)fuzz_rand();
+    }
+
+    as_memcpy_to_guest(space, FUZZ_CODE_ADDR, code, sizeof(code));
+    as_memcpy_to_guest(space, FUZZ_WINDOW_ADDR, in_mem, sizeof(in_mem));
+
+    struct sh4_context in = sh4->ctx;
+
+    /* run through the jit */
+    fuzz_run_jit(dc);
+    sh4_implode_sr(&sh4->ctx);
+    struct sh4_context jit_out = sh4->ctx;
+    as_memcpy_to_host(space, jit_mem, FUZZ_WINDOW_ADDR, sizeof(jit_mem));
+
+    /* run the same input through the fallbacks */
+    as_memcpy_to_guest(space, FUZZ_WINDOW_ADDR, in_mem, sizeof(in_mem));
+    sh4->ctx = in;
+    fuzz_run_fallbacks(dc);
+    sh4_implode_sr(&sh4->ctx);
+    struct sh4_context fallback_out = sh4->ctx;
+    as_memcpy_to_host(space, fallback_mem, FUZZ_WINDOW_ADDR,
+                      sizeof(fallback_mem));
+
+    fuzz_compare(code, array_size(code), &fallback_out, &jit_out, fallback_mem,
+                 jit_mem);
+  }
+
+  LOG_INFO("%d sequences of %d instructions matched the fallbacks",
+           FUZZ_SEQUENCES, FUZZ_INSTRS);
+
+  dc_destroy(dc);
+}
+
+TEST(sh4_fuzz_x64) {
+  run_sh4_fuzz();
+}
+
+TEST(sh4_fuzz_ir_interp) {
+  int sh4_interp = OPTION_sh4_interp;
+  OPTION_sh4_interp = 2;
+  run_sh4_fuzz();
+  OPTION_sh4_interp = sh4_interp;
+}
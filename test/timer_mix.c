@@ -0,0 +1,109 @@
+#include "timer_mix.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+
+struct mix_timer mix_timers[10];
+struct mix_timer mix_oneshots[2];
+
+static struct dreamcast *mix_dc;
+static struct scheduler *mix_sch;
+
+static void mix_periodic_cb(void *data) {
+  struct mix_timer *t = data;
+  t->fired++;
+  t->timer = scheduler_start_timer(t->sch, &mix_periodic_cb, t, t->period);
+}
+
+static void mix_oneshot_cb(void *data) {
+  struct mix_timer *t = data;
+  t->fired++;
+  t->timer = NULL;
+}
+
+static void mix_scanline_cb(void *data) {
+  struct mix_timer *t = data;
+  mix_periodic_cb(data);
+
+  /* kick off a render and a dma transfer each frame */
+  if (t->fired % 262 == 0) {
+    for (int i = 0; i < (int)array_size(mix_oneshots); i++) {
+      struct mix_timer *oneshot = &mix_oneshots[i];
+      oneshot->sch = t->sch;
+      oneshot->timer = scheduler_start_timer(t->sch, &mix_oneshot_cb,
+                                             oneshot, oneshot->period);
+    }
+  }
+
+  /* reprogram a tmu channel every few lines */
+  if (t->fired % 4 == 0) {
+    struct mix_timer *tmu = &mix_timers[7 + (t->fired / 4) % 3];
+    scheduler_cancel_timer(tmu->sch, tmu->timer);
+    tmu->timer =
+        scheduler_start_timer(tmu->sch, &mix_periodic_cb, tmu, tmu->period);
+  }
+}
+
+void timer_mix_create() {
+  /* the scheduler only needs the run state and device list of the machine */
+  mix_dc = calloc(1, sizeof(struct dreamcast));
+  mix_dc->running = 1;
+  mix_sch = scheduler_create(mix_dc);
+
+  static const int64_t periods[] = {
+      /* scanline */
+      HZ_TO_NANO(15734),
+      /* aica sample batch */
+      HZ_TO_NANO(44100 / 10),
+      /* aica timers */
+      HZ_TO_NANO(44100 / 256),
+      HZ_TO_NANO(44100 / 64),
+      HZ_TO_NANO(44100 / 16),
+      /* rtc */
+      NS_PER_SEC,
+      /* gdrom */
+      HZ_TO_NANO(75),
+      /* tmu */
+      HZ_TO_NANO(1000),
+      HZ_TO_NANO(12500),
+      HZ_TO_NANO(60),
+  };
+
+  memset(mix_timers, 0, sizeof(mix_timers));
+  memset(mix_oneshots, 0, sizeof(mix_oneshots));
+  mix_oneshots[0].period = HZ_TO_NANO(10000);
+  mix_oneshots[1].period = HZ_TO_NANO(500);
+
+  for (int i = 0; i < (int)array_size(periods); i++) {
+    struct mix_timer *t = &mix_timers[i];
+    t->sch = mix_sch;
+    t->period = periods[i];
+    t->timer = scheduler_start_timer(
+        mix_sch, i ? &mix_periodic_cb : &mix_scanline_cb, t, t->period);
+  }
+}
+
+void timer_mix_run() {
+  /* step through the second the same way the emulator does */
+  for (int i = 0; i < 1000; i++) {
+    scheduler_tick(mix_sch, HZ_TO_NANO(1000));
+  }
+}
+
+int timer_mix_num_fired() {
+  int fired = 0;
+  for (int i = 0; i < (int)array_size(mix_timers); i++) {
+    fired += mix_timers[i].fired;
+  }
+  for (int i = 0; i < (int)array_size(mix_oneshots); i++) {
+    fired += mix_oneshots[i].fired;
+  }
+  return fired;
+}
+
+void timer_mix_destroy() {
+  scheduler_destroy(mix_sch);
+  free(mix_dc);
+  mix_sch = NULL;
+  mix_dc = NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef TIMER_MIX_H
+#define TIMER_MIX_H
+
+#include "guest/scheduler.h"
+
+/* simulates the machine's timer mix for one emulated second: a periodic timer
+   per scanline, per audio sample batch, for each of the aica and tmu timers
+   and the rtc, plus the one-shot dma and render timers started each frame.
+   the tmu timers are cancelled and restarted as games reprogram them */
+struct mix_timer {
+  struct scheduler *sch;
+  struct timer *timer;
+  int64_t period;
+  int fired;
+};
+
+extern struct mix_timer mix_timers[10];
+extern struct mix_timer mix_oneshots[2];
+
+void timer_mix_create();
+void timer_mix_run();
+int timer_mix_num_fired();
+void timer_mix_destroy();
+
+#endif
@@ -1,11 +1,15 @@
+#include <inttypes.h>
 #include "core/filesystem.h"
 #include "core/log.h"
 #include "core/option.h"
+#include "core/time.h"
 #include "jit/backend/x64/x64_backend.h"
 #include "jit/frontend/sh4/sh4_disasm.h"
+#include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
 #include "jit/pass_stats.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/passes/conversion_elimination_pass.h"
 #include "jit/passes/dead_code_elimination_pass.h"
@@ -13,16 +17,71 @@
 #include "jit/passes/load_store_elimination_pass.h"
 #include "jit/passes/register_allocation_pass.h"
 
-DEFINE_OPTION_INT(help, 0, "Show help");
-DEFINE_OPTION_STRING(pass, "lse,cprop,cve,esimp,dce,ra",
+DEFINE_OPTION_STRING(pass, "lse,cprop,esimp,cse,dce,ra",
                      "Comma-separated list of passes to run");
+DEFINE_OPTION_INT(bench, 0, "Time each pass and the assembly of each block");
+DEFINE_OPTION_INT(bench_runs, 10,
+                  "Number of times each block is compiled when benchmarking");
+DEFINE_OPTION_STRING(bench_csv, "",
+                     "Path to write per-block benchmark results to as csv");
 
 DEFINE_STAT(ir_instrs_total, "total ir instructions");
 DEFINE_STAT(ir_instrs_removed, "removed ir instructions");
 
+#define MAX_PASSES 16
+
+/* timings for a single block, in nanoseconds */
+struct bench_result {
+  char name[64];
+  int num_instrs_before;
+  int num_instrs_after;
+  int64_t pass_time[MAX_PASSES];
+  int64_t assemble_time;
+  int64_t total_time;
+};
+
 static uint8_t ir_buffer[1024 * 1024];
-static uint8_t code[1024 * 1024];
-static int code_size = sizeof(code);
+DEFINE_JIT_CODE_BUFFER(code);
+
+/* passes are created once and reused for each block, the same as the jit */
+static struct lse *lse;
+static struct cprop *cprop;
+static struct esimp *esimp;
+static struct cse *cse;
+static struct dce *dce;
+static struct ra *ra;
+
+static char passes[MAX_PASSES][32];
+static int num_passes;
+
+static struct bench_result *results;
+static int num_results;
+static int max_results;
+
+/* stubs for the guest interfaces called while assembling, the generated code
+   is never ran */
+static void stub_interrupt_check(void *data) {}
+
+static void stub_lookup(struct address_space *space, uint32_t addr, void **ptr,
+                        void **userdata, mem_read_cb *read, mem_write_cb *write,
+                        uint32_t *offset) {
+  *ptr = code;
+}
+
+static void parse_passes() {
+  char list[OPTION_MAX_LENGTH];
+  strncpy(list, OPTION_pass, sizeof(list));
+  list[sizeof(list) - 1] = 0;
+
+  char *name = strtok(list, ",");
+  while (name) {
+    CHECK_LT(num_passes, MAX_PASSES);
+    strncpy(passes[num_passes], name, sizeof(passes[num_passes]));
+    passes[num_passes][sizeof(passes[num_passes]) - 1] = 0;
+    num_passes++;
+    name = strtok(NULL, ",");
+  }
+}
 
 static int get_num_instrs(const struct ir *ir) {
   int n = 0;
@@ -42,7 +101,7 @@ static void sanitize_ir(struct ir *ir) {
     list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
       if (instr->op != OP_BRANCH && instr->op != OP_BRANCH_FALSE &&
           instr->op != OP_BRANCH_TRUE && instr->op != OP_CALL &&
-          instr->op != OP_FALLBACK) {
+          instr->op != OP_CALL_COND && instr->op != OP_FALLBACK) {
         continue;
       }
 
@@ -54,81 +113,82 @@ static void sanitize_ir(struct ir *ir) {
   }
 }
 
-static void process_file(struct jit *jit, const char *filename,
-                         int disable_dumps) {
-  struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+static void read_ir(const char *filename, struct ir *ir) {
+  memset(ir, 0, sizeof(*ir));
+  ir->buffer = ir_buffer;
+  ir->capacity = sizeof(ir_buffer);
 
-  /* read in the input ir */
   FILE *input = fopen(filename, "r");
   CHECK(input);
-  int r = ir_read(input, &ir);
+  int r = ir_read(input, ir);
   fclose(input);
   CHECK(r);
 
   /* sanitize absolute addresses in the ir */
-  sanitize_ir(&ir);
+  sanitize_ir(ir);
+}
 
-  /* run optimization passes */
-  char passes[MAX_OPTION_LENGTH];
-  strncpy(passes, OPTION_pass, sizeof(passes));
+static void run_pass(const char *name, struct ir *ir) {
+  if (!strcmp(name, "lse")) {
+    lse_run(lse, ir);
+  } else if (!strcmp(name, "cprop")) {
+    cprop_run(cprop, ir);
+  } else if (!strcmp(name, "cve")) {
+    cve_run(ir);
+  } else if (!strcmp(name, "esimp")) {
+    esimp_run(esimp, ir);
+  } else if (!strcmp(name, "cse")) {
+    cse_run(cse, ir);
+  } else if (!strcmp(name, "dce")) {
+    dce_run(dce, ir);
+  } else if (!strcmp(name, "ra")) {
+    ra_run(ra, ir);
+  } else {
+    LOG_WARNING("Unknown pass %s", name);
+  }
+}
+
+static void assemble_ir(struct jit *jit, struct jit_block *block,
+                        struct ir *ir) {
+  memset(block, 0, sizeof(*block));
+
+  jit->backend->reset(jit->backend);
+  int res = jit->backend->assemble_code(jit->backend, block, ir);
+  CHECK(res);
+}
+
+static void process_file(struct jit *jit, const char *filename,
+                         int disable_dumps) {
+  struct ir ir;
+  read_ir(filename, &ir);
 
   int num_instrs_before = get_num_instrs(&ir);
 
-  char *name = strtok(passes, ",");
-  while (name) {
-    if (!strcmp(name, "lse")) {
-      struct lse *lse = lse_create();
-      lse_run(lse, &ir);
-      lse_destroy(lse);
-    } else if (!strcmp(name, "cprop")) {
-      struct cprop *cprop = cprop_create();
-      cprop_run(cprop, &ir);
-      cprop_destroy(cprop);
-    } else if (!strcmp(name, "dce")) {
-      struct dce *dce = dce_create();
-      dce_run(dce, &ir);
-      dce_destroy(dce);
-    } else if (!strcmp(name, "esimp")) {
-      struct esimp *esimp = esimp_create();
-      esimp_run(esimp, &ir);
-      esimp_destroy(esimp);
-    } else if (!strcmp(name, "ra")) {
-      struct ra *ra =
-          ra_create(jit->backend->registers, jit->backend->num_registers);
-      ra_run(ra, &ir);
-      ra_destroy(ra);
-    } else {
-      LOG_WARNING("Unknown pass %s", name);
-    }
+  /* run optimization passes */
+  for (int i = 0; i < num_passes; i++) {
+    run_pass(passes[i], &ir);
 
     /* print ir after each pass if requested */
     if (!disable_dumps) {
       LOG_INFO("===-----------------------------------------------------===");
-      LOG_INFO("IR after %s", name);
+      LOG_INFO("IR after %s", passes[i]);
       LOG_INFO("===-----------------------------------------------------===");
       ir_write(&ir, stdout);
       LOG_INFO("");
     }
-
-    name = strtok(NULL, ",");
   }
 
   int num_instrs_after = get_num_instrs(&ir);
 
   /* assemble backend code */
   struct jit_block block;
-
-  jit->backend->reset(jit->backend);
-  int res = jit->backend->assemble_code(jit->backend, &block, &ir);
-  CHECK(res);
+  assemble_ir(jit, &block, &ir);
 
   if (!disable_dumps) {
     LOG_INFO("===-----------------------------------------------------===");
     LOG_INFO("X64 code");
     LOG_INFO("===-----------------------------------------------------===");
-    jit->backend->dump_code(jit->backend, block.host_addr, block.host_size);
+    jit->backend->dump_code(jit->backend, &block);
     LOG_INFO("");
   }
 
@@ -137,6 +197,152 @@ static void process_file(struct jit *jit, const char *filename,
   STAT_ir_instrs_removed += num_instrs_before - num_instrs_after;
 }
 
+static void bench_file(struct jit *jit, const char *filename) {
+  if (num_results == max_results) {
+    max_results = max_results ? max_results * 2 : 256;
+    results = realloc(results, max_results * sizeof(struct bench_result));
+  }
+
+  struct bench_result *result = &results[num_results++];
+  memset(result, 0, sizeof(*result));
+  fs_basename(filename, result->name, sizeof(result->name));
+
+  /* compile the block multiple times, keeping the fastest time for each stage
+     to filter out noise from the rest of the system */
+  for (int run = 0; run < OPTION_bench_runs; run++) {
+    struct ir ir;
+    read_ir(filename, &ir);
+
+    int num_instrs_before = get_num_instrs(&ir);
+
+    for (int i = 0; i < num_passes; i++) {
+      int64_t start = time_nanoseconds();
+      run_pass(passes[i], &ir);
+      int64_t elapsed = time_nanoseconds() - start;
+
+      if (!run || elapsed < result->pass_time[i]) {
+        result->pass_time[i] = elapsed;
+      }
+    }
+
+    int num_instrs_after = get_num_instrs(&ir);
+
+    struct jit_block block;
+    int64_t start = time_nanoseconds();
+    assemble_ir(jit, &block, &ir);
+    int64_t elapsed = time_nanoseconds() - start;
+
+    if (!run || elapsed < result->assemble_time) {
+      result->assemble_time = elapsed;
+    }
+
+    result->num_instrs_before = num_instrs_before;
+    result->num_instrs_after = num_instrs_after;
+  }
+
+  result->total_time = result->assemble_time;
+  for (int i = 0; i < num_passes; i++) {
+    result->total_time += result->pass_time[i];
+  }
+
+  STAT_ir_instrs_total += result->num_instrs_before;
+  STAT_ir_instrs_removed +=
+      result->num_instrs_before - result->num_instrs_after;
+}
+
+static int bench_cmp(const void *a, const void *b) {
+  int64_t ta = *(const int64_t *)a;
+  int64_t tb = *(const int64_t *)b;
+  return (ta > tb) - (ta < tb);
+}
+
+static int64_t bench_percentile(const int64_t *sorted, int n, int p) {
+  return sorted[(int64_t)(n - 1) * p / 100];
+}
+
+static void bench_write_csv(const char *path) {
+  FILE *output = fopen(path, "w");
+  if (!output) {
+    LOG_WARNING("Failed to open %s", path);
+    return;
+  }
+
+  fprintf(output, "block,instrs_before,instrs_after");
+  for (int i = 0; i < num_passes; i++) {
+    fprintf(output, ",%s_ns", passes[i]);
+  }
+  fprintf(output, ",assemble_ns,total_ns\n");
+
+  for (int i = 0; i < num_results; i++) {
+    struct bench_result *result = &results[i];
+
+    fprintf(output, "%s,%d,%d", result->name, result->num_instrs_before,
+            result->num_instrs_after);
+    for (int j = 0; j < num_passes; j++) {
+      fprintf(output, ",%" PRId64, result->pass_time[j]);
+    }
+    fprintf(output, ",%" PRId64 ",%" PRId64 "\n", result->assemble_time,
+            result->total_time);
+  }
+
+  fclose(output);
+
+  LOG_INFO("Wrote %d blocks to %s", num_results, path);
+}
+
+static void bench_report() {
+  if (!num_results) {
+    LOG_WARNING("No blocks were benchmarked");
+    return;
+  }
+
+  int64_t pass_total[MAX_PASSES] = {0};
+  int64_t assemble_total = 0;
+  int64_t total = 0;
+  int64_t *sorted = malloc(num_results * sizeof(int64_t));
+
+  for (int i = 0; i < num_results; i++) {
+    struct bench_result *result = &results[i];
+
+    for (int j = 0; j < num_passes; j++) {
+      pass_total[j] += result->pass_time[j];
+    }
+    assemble_total += result->assemble_time;
+    total += result->total_time;
+    sorted[i] = result->total_time;
+  }
+
+  qsort(sorted, num_results, sizeof(int64_t), &bench_cmp);
+
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("Compile times for %d blocks", num_results);
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("%-12s %12s %12s %8s", "stage", "total (ms)", "mean (us)",
+           "share");
+
+  for (int i = 0; i < num_passes + 1; i++) {
+    const char *name = i < num_passes ? passes[i] : "assemble";
+    int64_t t = i < num_passes ? pass_total[i] : assemble_total;
+    LOG_INFO("%-12s %12.3f %12.3f %7.1f%%", name, t / 1000000.0,
+             t / 1000.0 / num_results, total ? t * 100.0 / total : 0.0);
+  }
+
+  LOG_INFO("%-12s %12.3f %12.3f %7.1f%%", "total", total / 1000000.0,
+           total / 1000.0 / num_results, 100.0);
+  LOG_INFO("");
+  LOG_INFO("per-block p50 %.3f us, p99 %.3f us, max %.3f us",
+           bench_percentile(sorted, num_results, 50) / 1000.0,
+           bench_percentile(sorted, num_results, 99) / 1000.0,
+           sorted[num_results - 1] / 1000.0);
+  LOG_INFO("");
+
+  free(sorted);
+
+  if (OPTION_bench_csv[0]) {
+    bench_write_csv(OPTION_bench_csv);
+  }
+}
+
 static void process_dir(struct jit *jit, const char *path) {
   DIR *dir = opendir(path);
 
@@ -156,49 +362,89 @@ static void process_dir(struct jit *jit, const char *path) {
     snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", path,
              ent->d_name);
 
-    LOG_INFO("Processing %s", filename);
-
-    process_file(jit, filename, 1);
+    if (OPTION_bench) {
+      bench_file(jit, filename);
+    } else {
+      LOG_INFO("Processing %s", filename);
+      process_file(jit, filename, 1);
+    }
   }
 
   closedir(dir);
 }
 
 int main(int argc, char **argv) {
-  options_parse(&argc, &argv);
-
-  if (OPTION_help) {
-    options_print_help();
+  /* options_parse prints the help itself when asked for it */
+  if (!options_parse(&argc, &argv)) {
     return EXIT_SUCCESS;
   }
 
+  if (argc < 2) {
+    LOG_INFO("usage: recc [options] <path to file or directory>");
+    return EXIT_FAILURE;
+  }
+
   const char *path = argv[1];
 
+  parse_passes();
+
   struct jit_guest guest = {0};
+  guest.addr_mask = 0x00fffffe;
+  guest.interrupt_check = &stub_interrupt_check;
+  guest.lookup = &stub_lookup;
   guest.r8 = (void *)code;
   guest.r16 = (void *)code;
   guest.r32 = (void *)code;
   guest.w8 = (void *)code;
   guest.w16 = (void *)code;
   guest.w32 = (void *)code;
+  guest.r64 = (void *)code;
+  guest.w64 = (void *)code;
+
+  struct jit_frontend *frontend = sh4_frontend_create();
+  struct jit_backend *backend = x64_backend_create(code, sizeof(code));
 
-  struct jit_backend *backend = x64_backend_create(code, code_size);
+  /* initialize jit, stubbing out the guest interfaces used during assembly
+     with valid addresses */
+  struct jit *jit = jit_create("recc", frontend, backend, &guest);
 
-  /* initailize jit, stubbing out guest interfaces that are used during
-     assembly to a valid address */
-  struct jit *jit = jit_create("recc", NULL, backend, &guest);
+  lse = lse_create();
+  cprop = cprop_create();
+  esimp = esimp_create();
+  cse = cse_create();
+  dce = dce_create();
+  ra = ra_create(backend->registers, backend->num_registers,
+                 backend->emitters, backend->num_emitters);
 
   if (fs_isfile(path)) {
-    process_file(jit, path, 0);
+    if (OPTION_bench) {
+      bench_file(jit, path);
+    } else {
+      process_file(jit, path, 0);
+    }
   } else {
     process_dir(jit, path);
   }
 
-  LOG_INFO("");
-  pass_stats_dump();
+  /* the pass stats would be inflated by each benchmark run */
+  if (OPTION_bench) {
+    bench_report();
+  } else {
+    LOG_INFO("");
+    pass_stats_dump();
+  }
+
+  ra_destroy(ra);
+  dce_destroy(dce);
+  cse_destroy(cse);
+  esimp_destroy(esimp);
+  cprop_destroy(cprop);
+  lse_destroy(lse);
 
   jit_destroy(jit);
   backend->destroy(backend);
+  frontend->destroy(frontend);
+  free(results);
 
   return EXIT_SUCCESS;
 }